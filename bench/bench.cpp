@@ -0,0 +1,904 @@
+// bench.cpp : Defines the entry point for the console application.
+//
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory_resource>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "utils/adaptive_sync.h"
+#include "utils/checkpoint.h"
+#include "utils/future.h"
+#include "utils/lock_profile.h"
+#include "utils/log_sink.h"
+#include "utils/memoize.h"
+#include "utils/memory_resource.h"
+#include "utils/modular.h"
+#include "utils/parallel.h"
+#include "utils/parallel_sort.h"
+#include "utils/per_thread.h"
+#include "utils/read_mostly_map.h"
+#include "utils/sieve.h"
+#include "utils/simd.h"
+#include "utils/spsc_queue.h"
+#include "utils/task.h"
+#include "utils/threadsafe_stack.h"
+#include "utils/utils.h"
+#include "utils/utils_inl.h"
+
+/* Benchmarks for the library code shared by the problems.*/
+
+namespace {
+
+// parallel_reduce should approach hardware_concurrency() times the std::accumulate rate on a large sum.
+void BenchReduce()
+{
+    std::vector<int> const data(1 << 26, 1);
+
+    Profile([&]() { Print(std::accumulate(data.begin(), data.end(), 0LL)); });
+    Profile([&]() { Print(parallel_reduce(data.begin(), data.end(), 0LL)); });
+}
+
+// Each thread increments its own counter; returns the total.
+template<typename Counters>
+long long CountInParallel(Counters& counters, unsigned numThreads)
+{
+    std::vector<std::thread> threads;
+
+    for (unsigned i = 0; i < numThreads; ++i)
+    {
+        threads.push_back(std::thread([&counters, i]() {
+            for (int n = 0; n < 10000000; ++n)
+            {
+                counters[i].fetch_add(1, std::memory_order_relaxed);
+            }
+        }));
+    }
+
+    std::for_each(threads.begin(), threads.end(), std::mem_fn(&std::thread::join));
+
+    long long total = 0;
+    for (unsigned i = 0; i < numThreads; ++i)
+    {
+        total += counters[i].load();
+    }
+    return total;
+}
+
+// Adjacent counters in a std::vector false-share cache lines, per_thread's padded slots don't.
+void BenchFalseSharing()
+{
+    unsigned const numThreads = std::max(std::thread::hardware_concurrency(), 2u);
+
+    std::vector<std::atomic<long long>> adjacent(numThreads);
+    per_thread<std::atomic<long long>> padded(numThreads, 0);
+
+    Profile([&]() { Print(CountInParallel(adjacent, numThreads)); });
+    Profile([&]() { Print(CountInParallel(padded, numThreads)); });
+}
+
+// Each thread pushes then pops, so the stack is never empty when popped; returns the number of operations.
+template<typename Stack, typename... Args>
+long long PushPopInParallel(unsigned numThreads, Args... args)
+{
+    int const pairsPerThread = 1000000 / numThreads;
+    Stack stack(args...);
+    std::vector<std::thread> threads;
+
+    for (unsigned i = 0; i < numThreads; ++i)
+    {
+        threads.push_back(std::thread([&stack, pairsPerThread]() {
+            int value = 0;
+            for (int n = 0; n < pairsPerThread; ++n)
+            {
+                stack.push(n);
+                stack.pop(value);
+            }
+        }));
+    }
+
+    std::for_each(threads.begin(), threads.end(), std::mem_fn(&std::thread::join));
+
+    return 2LL * pairsPerThread * numThreads;
+}
+
+// threadsafe_stack serialises on its mutex, lock_free_stack only on the head CAS.
+void BenchStacks()
+{
+    for (unsigned numThreads = 1; numThreads <= 64; numThreads *= 2)
+    {
+        out() << "threadsafe_stack, " << numThreads << " threads: ";
+        Profile([numThreads]() { Print(PushPopInParallel<threadsafe_stack<int>>(numThreads)); });
+
+        out() << "lock_free_stack, " << numThreads << " threads: ";
+        Profile([numThreads]() { Print(PushPopInParallel<lock_free_stack<int>>(numThreads)); });
+    }
+}
+
+// Streams count values from a producer to a consumer thread, batch at a time; returns their sum.
+long long Pipeline(long long count, std::size_t batch)
+{
+    spsc_queue<long long, true> ring(4096);
+    long long sum = 0;
+
+    std::thread consumer([&ring, &sum, count, batch]() {
+        std::vector<long long> values(batch);
+        for (long long received = 0; received < count;)
+        {
+            std::size_t const n = ring.wait_and_pop_n(values.begin(), batch);
+            sum = std::accumulate(values.begin(), values.begin() + n, sum);
+            received += n;
+        }
+    });
+
+    std::vector<long long> values(batch);
+    for (long long sent = 0; sent < count; sent += batch)
+    {
+        std::iota(values.begin(), values.end(), sent);
+        ring.push_all(values.begin(), batch);
+    }
+
+    consumer.join();
+    return sum;
+}
+
+// Messages per second through the SPSC ring, one at a time and in batches.
+void BenchPipeline()
+{
+    long long const count = 1 << 22; // a multiple of the batch size
+
+    Profile([count]() { Print(Pipeline(count, 1)); });
+    Profile([count]() { Print(Pipeline(count, 64)); });
+}
+
+// std::map behind a reader/writer lock, as dns_cache.
+class LockedMap
+{
+public:
+    bool find(std::string const& key, int& value) const
+    {
+        std::shared_lock<std::shared_timed_mutex> lk(mut);
+        std::map<std::string, int>::const_iterator const it = entries.find(key);
+        if (it == entries.end())
+            return false;
+        value = it->second;
+        return true;
+    }
+
+    void update_or_add_entry(std::string const& key, int value)
+    {
+        std::lock_guard<std::shared_timed_mutex> lk(mut);
+        entries[key] = value;
+    }
+
+private:
+    std::map<std::string, int> entries;
+    mutable std::shared_timed_mutex mut;
+};
+
+// Every thread does the same number of lookups with 1 in 100 operations an update, so linear scaling keeps the
+// time flat as threads are added; returns the number of hits.
+template<typename Map>
+long long ReadMostly(unsigned numThreads)
+{
+    int const numKeys = 1024;
+    int const opsPerThread = 200000;
+
+    std::vector<std::string> keys;
+    for (int i = 0; i < numKeys; ++i)
+    {
+        keys.push_back("host" + std::to_string(i) + ".example.com");
+    }
+
+    Map map;
+    for (int i = 0; i < numKeys; ++i)
+    {
+        map.update_or_add_entry(keys[i], i);
+    }
+
+    std::atomic<long long> hits(0);
+    std::vector<std::thread> threads;
+
+    for (unsigned t = 0; t < numThreads; ++t)
+    {
+        threads.push_back(std::thread([&map, &keys, &hits, t]() {
+            long long found = 0;
+            int value = 0;
+            for (int n = 0; n < opsPerThread; ++n)
+            {
+                std::string const& key = keys[(n * 7 + t * 131) % numKeys];
+                if (n % 100 == 0)
+                    map.update_or_add_entry(key, n);
+                else if (map.find(key, value))
+                    ++found;
+            }
+            hits += found;
+        }));
+    }
+
+    std::for_each(threads.begin(), threads.end(), std::mem_fn(&std::thread::join));
+
+    return hits;
+}
+
+void BenchReadMostly()
+{
+    unsigned const maxThreads = std::max(std::thread::hardware_concurrency(), 2u);
+
+    for (unsigned numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+    {
+        out() << "map + shared_timed_mutex, " << numThreads << " threads: ";
+        Profile([numThreads]() { Print(ReadMostly<LockedMap>(numThreads)); });
+
+        out() << "read_mostly_map, " << numThreads << " threads: ";
+        Profile([numThreads]() { Print(ReadMostly<read_mostly_map<std::string, int>>(numThreads)); });
+    }
+}
+
+// Each thread increments a shared counter under the lock numIncrements times.
+template<typename Mutex>
+long long CountUnderLock(Mutex& m, unsigned numThreads)
+{
+    int const numIncrements = 1 << 20;
+    long long counter = 0;
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < numThreads; ++t)
+    {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < numIncrements; ++i)
+            {
+                profiled_lock_guard<Mutex> lk(m, LOCK_SITE);
+                ++counter;
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    return counter;
+}
+
+// std::mutex::lock(site) doesn't exist, so the plain mutex gets a thin adaptor
+struct PlainMutex
+{
+    std::mutex m;
+    void lock(lock_site const&) { m.lock(); }
+    void unlock() { m.unlock(); }
+};
+
+void BenchLockProfiling()
+{
+    unsigned const maxThreads = std::max(std::thread::hardware_concurrency(), 2u);
+
+    for (unsigned numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+    {
+        out() << "std::mutex, " << numThreads << " threads: ";
+        Profile([numThreads]() { PlainMutex m; Print(CountUnderLock(m, numThreads)); });
+
+        out() << "profiled_mutex, " << numThreads << " threads: ";
+        Profile([numThreads]() { profiled_mutex<> m("counter_mutex"); Print(CountUnderLock(m, numThreads)); });
+    }
+
+    profiled_mutex<> m("counter_mutex");
+    CountUnderLock(m, maxThreads);
+
+    // as one write, so it stays in order with the Profile output
+    std::ostringstream report;
+    report_lock_contention(report);
+    out() << report.str();
+}
+
+// Reusable barrier on a mutex and condition_variable, for comparison with barrier.
+class CvBarrier
+{
+public:
+    explicit CvBarrier(unsigned count_) : count(count_), arrived(0), phase(0) {}
+
+    void arrive_and_wait()
+    {
+        std::unique_lock<std::mutex> lk(m);
+        unsigned const current = phase;
+        if (++arrived == count)
+        {
+            arrived = 0;
+            ++phase;
+            cond.notify_all();
+            return;
+        }
+        cond.wait(lk, [&]() { return phase != current; });
+    }
+
+private:
+    std::mutex m;
+    std::condition_variable cond;
+    unsigned const count;
+    unsigned arrived;
+    unsigned phase;
+};
+
+// Phased work - each thread sums its share of a segment, then all wait for the phase to end.
+template<typename Barrier>
+long long Phases(unsigned numThreads)
+{
+    int const numPhases = 10000;
+    int const segmentSize = 1 << 10;
+
+    Barrier sync(numThreads);
+    std::atomic<long long> total(0);
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < numThreads; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            for (int phase = 0; phase < numPhases; ++phase)
+            {
+                long long sum = 0;
+                for (int i = static_cast<int>(t); i < segmentSize; i += static_cast<int>(numThreads))
+                    sum += i;
+                total.fetch_add(sum, std::memory_order_relaxed);
+                sync.arrive_and_wait();
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    return total.load();
+}
+
+void BenchBarrier()
+{
+    unsigned const maxThreads = std::max(std::thread::hardware_concurrency(), 2u);
+
+    for (unsigned numThreads = 2; numThreads <= maxThreads; numThreads *= 2)
+    {
+        out() << "condition_variable barrier, " << numThreads << " threads: ";
+        Profile([numThreads]() { Print(Phases<CvBarrier>(numThreads)); });
+
+        out() << "barrier, " << numThreads << " threads: ";
+        Profile([numThreads]() { Print(Phases<barrier>(numThreads)); });
+    }
+}
+
+bool IsPrime(int n)
+{
+    if (n < 2)
+        return false;
+    for (int d = 2; d * d <= n; ++d)
+    {
+        if (n % d == 0)
+            return false;
+    }
+    return true;
+}
+
+int CountPrimes(int first, int last)
+{
+    int count = 0;
+    for (int n = first; n < last; ++n)
+        count += IsPrime(n);
+    return count;
+}
+
+int const numChunks = 256;
+int const chunkSize = 1 << 12;
+
+// a std::async per chunk, collected with blocking get()s
+long long PrimesAsync()
+{
+    std::vector<std::future<int>> chunks;
+    for (int i = 0; i < numChunks; ++i)
+        chunks.push_back(std::async(std::launch::async, CountPrimes, i * chunkSize, (i + 1) * chunkSize));
+
+    long long total = 0;
+    for (auto& chunk : chunks)
+        total += chunk.get();
+    return total;
+}
+
+// a pool task per chunk, aggregated by a continuation
+long long PrimesOnPool()
+{
+    std::vector<task_future<int>> chunks;
+    for (int i = 0; i < numChunks; ++i)
+        chunks.push_back(spawn([i]() { return CountPrimes(i * chunkSize, (i + 1) * chunkSize); }));
+
+    return when_all(std::move(chunks)).then([](task_future<std::vector<task_future<int>>> all) {
+        long long total = 0;
+        for (auto& chunk : all.get())
+            total += chunk.get();
+        return total;
+    }).get();
+}
+
+void BenchFutures()
+{
+    out() << "std::async per chunk: ";
+    Profile([]() { Print(PrimesAsync()); });
+
+    out() << "thread_pool + when_all: ";
+    Profile([]() { Print(PrimesOnPool()); });
+}
+
+// Divide and conquer prime count - halves the range until it's one chunk.
+long long CountPrimesAsync(int first, int last)
+{
+    if (last - first <= chunkSize)
+        return CountPrimes(first, last);
+
+    int const mid = first + (last - first) / 2;
+    std::future<long long> left = std::async(std::launch::async, CountPrimesAsync, first, mid);
+    long long const right = CountPrimesAsync(mid, last);
+    return left.get() + right;
+}
+
+task<long long> CountPrimesTask(thread_pool& pool, int first, int last)
+{
+    if (last - first <= chunkSize)
+        co_return CountPrimes(first, last);
+
+    int const mid = first + (last - first) / 2;
+    std::vector<task<long long>> halves;
+    halves.push_back(CountPrimesTask(pool, first, mid));
+    halves.push_back(CountPrimesTask(pool, mid, last));
+
+    std::vector<long long> const counts = co_await when_all_on(pool, std::move(halves));
+    co_return counts[0] + counts[1];
+}
+
+// every call a coroutine, to time the cost of a spawn
+task<long long> Fib(int n)
+{
+    if (n < 2)
+        co_return n;
+    co_return co_await Fib(n - 1) + co_await Fib(n - 2);
+}
+
+task<int> AwaitFuture(task_future<int> future)
+{
+    co_return co_await std::move(future);
+}
+
+// Awaits a spawned future whose token is cancelled while the coroutine is suspended - it must still be
+// resumed, with the value if the work had started and cancelled_error if not.
+int AwaitCancelled()
+{
+    std::atomic<bool> release(false);
+    cancellation_token token;
+    task_future<int> started = spawn(thread_pool::default_pool(), [&release]() {
+        while (!release.load())
+            std::this_thread::yield();
+        return 42;
+    }, token);
+
+    std::thread canceller([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        token.cancel();
+        release = true;
+    });
+
+    int result = -1;
+    try
+    {
+        result = sync_wait(AwaitFuture(std::move(started)));
+    }
+    catch (cancelled_error const&)
+    {
+    }
+    canceller.join();
+    return result;
+}
+
+long long FibPlain(int n)
+{
+    return n < 2 ? n : FibPlain(n - 1) + FibPlain(n - 2);
+}
+
+void BenchCoroutines()
+{
+    int const last = numChunks * chunkSize;
+
+    out() << "recursive std::async: ";
+    Profile([]() { Print(CountPrimesAsync(0, last)); });
+
+    out() << "recursive task + when_all_on: ";
+    Profile([]() { Print(sync_wait(CountPrimesTask(thread_pool::default_pool(), 0, last))); });
+
+    // ~2.7M calls each
+    out() << "fib(30), plain calls: ";
+    Profile([]() { Print(FibPlain(30)); });
+
+    out() << "fib(30), a task per call: ";
+    Profile([]() { Print(sync_wait(Fib(30))); });
+
+    out() << "co_await, chain cancelled while suspended: ";
+    Profile([]() { Print(AwaitCancelled()); });
+}
+
+// Inserts and erases through a set allocating from resource.
+long long SetChurn(std::pmr::memory_resource* resource)
+{
+    int const count = 1 << 20;
+    std::pmr::set<int> values(resource);
+    for (int i = 0; i < count; ++i)
+        values.insert(static_cast<int>((i * 2654435761u) % count));
+
+    long long total = 0;
+    for (int const v : values)
+        total += v;
+    return total;
+}
+
+void BenchAllocators()
+{
+    out() << "std::set, new/delete: ";
+    Profile([]() { Print(SetChurn(std::pmr::new_delete_resource())); });
+
+    out() << "std::pmr::set, arena_resource: ";
+    Profile([]() { arena_resource arena; Print(SetChurn(&arena)); });
+
+    out() << "std::pmr::set, pool_resource: ";
+    Profile([]() { pool_resource pool; Print(SetChurn(&pool)); });
+
+    unsigned const maxThreads = std::max(std::thread::hardware_concurrency(), 2u);
+    for (unsigned numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+    {
+        out() << "lock_free_stack, new/delete, " << numThreads << " threads: ";
+        Profile([numThreads]() { Print(PushPopInParallel<lock_free_stack<int>>(numThreads)); });
+
+        out() << "lock_free_stack, pool_resource, " << numThreads << " threads: ";
+        Profile([numThreads]() {
+            pool_resource pool;
+            Print(PushPopInParallel<pmr::lock_free_stack<int>>(numThreads, &pool));
+        });
+    }
+}
+
+// Each kernel at every instruction set level this CPU supports, against the scalar code it replaces.
+void BenchKernels()
+{
+    int const last = numChunks * chunkSize;
+    std::vector<int> const data(1 << 24, 1);
+
+    out() << "IsPrime loop: ";
+    Profile([&]() { Print(CountPrimes(0, last)); });
+    out() << "std::accumulate: ";
+    Profile([&]() { Print(std::accumulate(data.begin(), data.end(), 0LL)); });
+
+    isa_level const best = cpu_isa();
+    for (int level = static_cast<int>(isa_level::scalar); level <= static_cast<int>(best); ++level)
+    {
+        char const* const name = isa_name(set_kernel_isa(static_cast<isa_level>(level)));
+
+        Record("count_primes", name, [&]() { return simd_count_primes(0, last); });
+        Record("sum", name, [&]() { return simd_sum(data.data(), data.size()); });
+    }
+    set_kernel_isa(best);
+}
+
+long long LargestPrimeFactor(long long n)
+{
+    long long largest = 1;
+    for (long long factor = 2; factor * factor <= n; ++factor)
+    {
+        while (n % factor == 0)
+        {
+            n /= factor;
+            largest = factor;
+        }
+    }
+    return n > 1 ? n : largest;
+}
+
+// Threads factorising the same few numbers over and over, directly and through memoized. Each shard has room
+// for every number (capacity is split evenly between shards, and keys needn't hash evenly), so nothing is
+// evicted and each number is computed once, even when several threads miss on it together.
+void BenchMemoize()
+{
+    unsigned const numThreads = 4;
+    int const callsPerThread = 256;
+    long long const base = 600851475143;
+    int const distinct = 64;
+
+    auto run = [&](auto factorise) {
+        std::vector<long long> largest(numThreads);
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < numThreads; ++t)
+        {
+            threads.emplace_back([&, t]() {
+                for (int i = 0; i < callsPerThread; ++i)
+                    largest[t] = std::max(largest[t], factorise(base + (i * 7 + t) % distinct));
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        return *std::max_element(largest.begin(), largest.end());
+    };
+
+    out() << "LargestPrimeFactor, direct: ";
+    Profile([&]() { Print(run(&LargestPrimeFactor)); });
+
+    memoized<long long(long long)> memo(&LargestPrimeFactor, numThreads * distinct, numThreads);
+    out() << "LargestPrimeFactor, memoized: ";
+    Profile([&]() { Print(run([&memo](long long n) { return memo(n); })); });
+
+    std::ostringstream stats;
+    memo.stats().describe(stats);
+    out() << "memoized: " << stats.str();
+}
+
+// Checkpointing a segmented prime count: none, the default interval (nothing written before the end) and
+// after every segment - the worst case, which should still cost well under 1% with segments this size.
+void BenchCheckpoint()
+{
+    std::uint64_t const total = 1 << 22;
+    std::uint64_t const segment = 1 << 14;
+    std::uint64_t const key = checkpoint_key("bench count_primes", total);
+
+    auto count = [](std::uint64_t first, std::uint64_t last, std::size_t) {
+        return simd_count_primes(static_cast<std::uint32_t>(first), static_cast<std::uint32_t>(last));
+    };
+    auto plus = [](std::size_t a, std::size_t b) { return a + b; };
+
+    search_options options;
+    Record("resumable_search", "no checkpoint", [&]() {
+        return resumable_search(key, total, segment, std::size_t(0), count, plus, options);
+    });
+
+    options.path = std::filesystem::temp_directory_path() / "bench_count_primes.checkpoint";
+    Record("resumable_search", "checkpoint every 30s", [&]() {
+        return resumable_search(key, total, segment, std::size_t(0), count, plus, options);
+    });
+
+    options.interval = std::chrono::steady_clock::duration::zero();
+    Record("resumable_search", "checkpoint every segment", [&]() {
+        return resumable_search(key, total, segment, std::size_t(0), count, plus, options);
+    });
+}
+
+// Sorting 8M random 64-bit keys with std::sort and the parallel sorts (a std::set, as p4 used, takes 20 times
+// as long), then merging 8 sorted runs of them. Each reports the median, so they should all agree.
+void BenchSort()
+{
+    std::size_t const length = 1 << 23;
+    std::size_t const numRuns = 8;
+    std::mt19937_64 random(42);
+    std::vector<std::uint64_t> data(length);
+    for (auto& key : data)
+        key = random();
+
+    std::vector<std::uint64_t> work = data;
+    Record("sort", "std::sort", [&]() {
+        std::sort(work.begin(), work.end());
+        return work[length / 2];
+    });
+    work = data;
+    Record("sort", "parallel_quick_sort", [&]() {
+        parallel_quick_sort(work.begin(), work.end());
+        return work[length / 2];
+    });
+    work = data;
+    Record("sort", "parallel_radix_sort", [&]() {
+        parallel_radix_sort(work.begin(), work.end());
+        return work[length / 2];
+    });
+
+    std::vector<std::size_t> bounds;
+    for (std::size_t r = 0; r <= numRuns; ++r)
+        bounds.push_back(r * length / numRuns);
+    auto sortRuns = [&]() {
+        work = data;
+        for (std::size_t r = 0; r < numRuns; ++r)
+            std::sort(work.begin() + bounds[r], work.begin() + bounds[r + 1]);
+    };
+
+    sortRuns();
+    Record("merge 8 runs", "std::inplace_merge", [&]() {
+        for (std::size_t width = 1; width < numRuns; width *= 2)
+        {
+            for (std::size_t r = 0; r + width < numRuns; r += 2 * width)
+                std::inplace_merge(work.begin() + bounds[r], work.begin() + bounds[r + width],
+                    work.begin() + bounds[std::min(r + 2 * width, numRuns)]);
+        }
+        return work[length / 2];
+    });
+    sortRuns();
+    Record("merge 8 runs", "parallel_merge_runs", [&]() {
+        parallel_merge_runs(work.begin(), bounds, std::less<std::uint64_t>());
+        return work[length / 2];
+    });
+
+    // p4's Sorted at 4 digits: the 81M products of two 4-digit numbers, radix sorted and deduplicated. The
+    // keys and the sort's scratch take over 600MB, too much for a 32-bit address space.
+    if constexpr (sizeof(void*) >= 8)
+    {
+        Record("sort 4-digit products", "parallel_radix_sort + unique", []() {
+            std::uint32_t const lowest = 1000, count = 9000;
+            std::vector<std::uint32_t> products(static_cast<std::size_t>(count) * count);
+            for (std::uint32_t outer = 0; outer < count; ++outer)
+            {
+                for (std::uint32_t inner = 0; inner < count; ++inner)
+                    products[static_cast<std::size_t>(outer) * count + inner] = (lowest + outer) * (lowest + inner);
+            }
+            parallel_radix_sort(products.begin(), products.end());
+            return std::unique(products.begin(), products.end()) - products.begin();
+        });
+    }
+}
+
+// Modular products against the naive %: 64 rounds over 64K pairs of 32-bit residues (Montgomery's also by the
+// simd.h kernel at each level), then Fermat tests of 64K 64-bit numbers, 60 squarings and multiplications
+// each. The modulus is read at run time, as the problems' would be, so the compiler can't turn % into a
+// multiplication itself.
+void BenchModular()
+{
+    std::size_t const length = 1 << 16;
+    int const rounds = 64;
+    std::uint32_t volatile const runtimeModulus = 1000000007;
+    std::uint32_t const modulus = runtimeModulus;
+    std::mt19937_64 random(7);
+    std::vector<std::uint32_t> x(length), y(length), products(length);
+    for (std::size_t i = 0; i < length; ++i)
+    {
+        x[i] = static_cast<std::uint32_t>(random() % modulus);
+        y[i] = static_cast<std::uint32_t>(random() % modulus);
+    }
+    auto checksum = [&products]() { return std::accumulate(products.begin(), products.end(), 0ull); };
+
+    Record("modmul u32", "%", [&]() {
+        for (int round = 0; round < rounds; ++round)
+            for (std::size_t i = 0; i < length; ++i)
+                products[i] = static_cast<std::uint32_t>(static_cast<std::uint64_t>(x[i]) * y[i] % modulus);
+        return checksum();
+    });
+
+    barrett<std::uint32_t> const b32(modulus);
+    Record("modmul u32", "barrett", [&]() {
+        for (int round = 0; round < rounds; ++round)
+            for (std::size_t i = 0; i < length; ++i)
+                products[i] = b32.multiply(x[i], y[i]);
+        return checksum();
+    });
+
+    // Montgomery products of the same residues are x * y / R, so their checksum differs
+    montgomery<std::uint32_t> const m32(modulus);
+    Record("modmul u32", "montgomery", [&]() {
+        for (int round = 0; round < rounds; ++round)
+            for (std::size_t i = 0; i < length; ++i)
+                products[i] = m32.multiply(x[i], y[i]);
+        return checksum();
+    });
+
+    isa_level const best = cpu_isa();
+    for (int level = static_cast<int>(isa_level::scalar); level <= static_cast<int>(best); ++level)
+    {
+        char const* const name = isa_name(set_kernel_isa(static_cast<isa_level>(level)));
+        Record("modmul u32 montgomery", name, [&]() {
+            for (int round = 0; round < rounds; ++round)
+                mod_multiply(m32, x.data(), y.data(), products.data(), length);
+            return checksum();
+        });
+    }
+    set_kernel_isa(best);
+
+    int const numTests = 1 << 16;
+    std::uint64_t const first = 1000000000000000003;
+    Record("fermat u64", "%", [&]() {
+        int probable = 0;
+        for (int i = 0; i < numTests; ++i)
+        {
+            std::uint64_t const n = first + 2 * static_cast<std::uint64_t>(i);
+            std::uint64_t power = 1, base = 2;
+            for (std::uint64_t e = n - 1; e; e >>= 1)
+            {
+                if (e & 1)
+                    power = static_cast<std::uint64_t>(wide_uint<128>(power) * base % n);
+                base = static_cast<std::uint64_t>(wide_uint<128>(base) * base % n);
+            }
+            probable += power == 1;
+        }
+        return probable;
+    });
+    Record("fermat u64", "barrett", [&]() {
+        int probable = 0;
+        for (int i = 0; i < numTests; ++i)
+        {
+            barrett<std::uint64_t> const mod(first + 2 * static_cast<std::uint64_t>(i));
+            probable += mod_pow(mod, mod.to_residue(2), mod.modulus() - 1) == mod.one();
+        }
+        return probable;
+    });
+    Record("fermat u64", "montgomery", [&]() {
+        int probable = 0;
+        for (int i = 0; i < numTests; ++i)
+        {
+            montgomery<std::uint64_t> const mod(first + 2 * static_cast<std::uint64_t>(i));
+            probable += mod_pow(mod, mod.to_residue(2), mod.modulus() - 1) == mod.one();
+        }
+        return probable;
+    });
+}
+
+// Summing phi(n) below 4M: factorising each n by trial division, the linear sieve, the segmented sieve, and
+// the segmented sieve into a mapped file, then summing from the file - all the tables, as the problems would
+// want them, so the sieves' times include filling the other four.
+void BenchSieve()
+{
+    std::uint64_t const limit = 1 << 22;
+    auto sum = [limit](std::uint32_t const* totient) {
+        return std::accumulate(totient, totient + limit, 0ull);
+    };
+
+    Record("sum totient", "trial division", [&]() {
+        std::uint64_t total = 1;
+        for (std::uint32_t n = 2; n < limit; ++n)
+        {
+            std::uint32_t phi = 1, rest = n;
+            for (std::uint32_t p = 2; p * p <= rest; ++p)
+            {
+                if (rest % p)
+                    continue;
+                std::uint32_t power = 1;
+                for (; rest % p == 0; rest /= p)
+                    power *= p;
+                phi *= power / p * (p - 1);
+            }
+            if (rest > 1)
+                phi *= rest - 1;
+            total += phi;
+        }
+        return total;
+    });
+    Record("sum totient", "linear_sieve", [&]() { return sum(linear_sieve(limit).totient.data()); });
+    Record("sum totient", "segmented_sieve", [&]() { return sum(segmented_sieve(limit).totient.data()); });
+
+    std::string const path = (std::filesystem::temp_directory_path() / "bench_totient.sieve").string();
+    Record("sum totient", "write_sieve_file", [&]() {
+        write_sieve_file(path, limit, sieve_all);
+        return sum(sieve_file(path).totient());
+    });
+    Record("sum totient", "sieve_file", [&]() { return sum(sieve_file(path).totient()); });
+    std::filesystem::remove(path);
+}
+
+}  // namespace
+
+int main()
+{
+    out() << "kernels: " << isa_name(kernel_isa()) << "\n";
+
+    BenchReduce();
+    BenchFalseSharing();
+    BenchStacks();
+    BenchPipeline();
+    BenchReadMostly();
+    BenchLockProfiling();
+    BenchBarrier();
+    BenchFutures();
+    BenchCoroutines();
+    BenchAllocators();
+    BenchKernels();
+    BenchCheckpoint();
+    BenchMemoize();
+    BenchSort();
+    BenchModular();
+    BenchSieve();
+
+    return 0;
+}
@@ -6,10 +6,14 @@
 #include "stdafx.h"
 
 #include <numeric>
+#include <sstream>
 #include <vector>
 
+#include "utils/modular.h"
+#include "utils/tuner.h"
 #include "utils/utils.h"
 #include "utils/utils_inl.h"
+#include "utils/wide_uint.h"
 
 /* If we list all the natural numbers below 10 that are multiples of 3 or 5, we get 3, 5, 6 and 9. The sum of these multiples is 23.
    Find the sum of all the multiples of 3 or 5 below 1000. */
@@ -35,24 +39,66 @@ T Simple(T maxVal)
         }
     }
 
-    return std::accumulate(vec.begin(), vec.end(), 0);
+    return std::accumulate(vec.begin(), vec.end(), T(0));
 }
 
 template<typename T>
-int Optimised(T maxVal)
+T Optimised(T maxVal)
 {
-    return SumDivisibleBy(3, maxVal) + SumDivisibleBy(5, maxVal) - SumDivisibleBy(3 * 5, maxVal);
+    return SumDivisibleBy<T>(3, maxVal) + SumDivisibleBy<T>(5, maxVal) - SumDivisibleBy<T>(3 * 5, maxVal);
+}
+
+// The sum for any set of divisors, by inclusion-exclusion: each subset adds (or, even sized, takes away) the
+// multiples of its lcm.
+template<typename T>
+T SumDivisibleByAny(const std::vector<T>& divisors, T maxVal)
+{
+    T sum = 0;
+    for (std::size_t subset = 1; subset < (std::size_t(1) << divisors.size()); ++subset)
+    {
+        T multiple = 1;
+        bool odd = false;
+        for (std::size_t i = 0; i < divisors.size() && multiple < maxVal; ++i)
+        {
+            if (subset >> i & 1)
+            {
+                multiple = lcm(multiple, divisors[i]);
+                odd = !odd;
+            }
+        }
+
+        if (multiple < maxVal)
+            sum = odd ? sum + SumDivisibleBy(multiple, maxVal) : sum - SumDivisibleBy(multiple, maxVal);
+    }
+    return sum;
 }
 
 int main()
 {
     Profile([]() { Print(Simple(10)); });
     Profile([]() { Print(Simple(1000)); }); // answer is 233168
-    Profile([]() { Print(Simple(1000000)); });
+    Profile([]() { Print(Simple(1000000LL)); });
 
     Profile([]() { Print(Optimised(10)); });
     Profile([]() { Print(Optimised(1000)); });
-    Profile([]() { Print(Optimised(1000000)); });
+    Profile([]() { Print(Optimised(1000000LL)); });
+    Profile([]() { Print(SumDivisibleByAny<long long>({ 3, 5 }, 1000)); });
+    Profile([]() { Print(SumDivisibleByAny<long long>({ 4, 6, 10, 15, 21 }, 1000000)); });
+    // below 10^30, where p * (p + 1) needs more than 128 bits
+    Profile([]() { Print(Optimised(wide_uint<256>(1000000000000000) * 1000000000000000)); });
+
+    // whichever of the two is faster for maxVal on this host, timed once and kept in tuning.txt
+    tuned_function<int, int> sumMultiples("p1");
+    sumMultiples.add("Simple", [](int maxVal) { return Simple(maxVal); });
+    sumMultiples.add("Optimised", [](int maxVal) { return Optimised(maxVal); });
+    sumMultiples.load_or_tune("tuning.txt", size_sweep(1, 1 << 12));
+
+    std::ostringstream crossovers;
+    sumMultiples.describe(crossovers);
+    out() << crossovers.str();
+
+    Profile([&sumMultiples]() { Print(sumMultiples(10)); });
+    Profile([&sumMultiples]() { Print(sumMultiples(1000)); });
 
     return 0;
 }
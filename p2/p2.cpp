@@ -4,12 +4,16 @@
 #include "stdafx.h"
 
 #include <algorithm>
+#include <array>
+#include <cstdint>
 #include <iterator>
 #include <numeric>
 #include <vector>
 
+#include "utils/modular.h"
 #include "utils/utils.h"
 #include "utils/utils_inl.h"
+#include "utils/wide_uint.h"
 
 const int MAX_VAL = static_cast<int>(4e6);
 
@@ -39,12 +43,58 @@ T Simple()
     TVec vecEvenTerms;
     std::copy_if(vec.begin(), vec.end(), std::back_inserter(vecEvenTerms), [](auto i) { return i % 2 == 0; });
 
-    return std::accumulate(vecEvenTerms.begin(), vecEvenTerms.end(), 0);
+    return std::accumulate(vecEvenTerms.begin(), vecEvenTerms.end(), T(0));
+}
+
+// The sum of the first count even terms mod modulus, for counts far past any vector. The even terms follow
+// E(k + 1) = 4 E(k) + E(k - 1), so (E(k), E(k - 1), S(k)) advances by a matrix, raised to the power count - 1
+// by squaring.
+template<typename T>
+T EvenSumMod(std::uint64_t count, T modulus)
+{
+    typedef std::array<std::array<T, 3>, 3> TMatrix;
+
+    if (count == 0)
+        return 0;
+
+    const barrett<T> mod(modulus);
+    auto multiply = [&mod](const TMatrix& a, const TMatrix& b) {
+        TMatrix c = {};
+        for (std::size_t i = 0; i < 3; ++i)
+            for (std::size_t j = 0; j < 3; ++j)
+                for (std::size_t k = 0; k < 3; ++k)
+                    c[i][j] = mod.add(c[i][j], mod.multiply(a[i][k], b[k][j]));
+        return c;
+    };
+
+    TMatrix step = {{ { 4, 1, 0 }, { 1, 0, 0 }, { 4, 1, 1 } }};
+    TMatrix power = {};
+    for (std::size_t i = 0; i < 3; ++i)
+    {
+        for (std::size_t j = 0; j < 3; ++j)
+            step[i][j] = mod.to_residue(step[i][j]);
+        power[i][i] = mod.one();
+    }
+
+    for (std::uint64_t exponent = count - 1; exponent; exponent >>= 1)
+    {
+        if (exponent & 1)
+            power = multiply(power, step);
+        step = multiply(step, step);
+    }
+
+    // from (E(1), E(0), S(1)) = (2, 0, 2)
+    const T two = mod.to_residue(2);
+    return mod.from_residue(mod.add(mod.multiply(power[2][0], two), mod.multiply(power[2][2], two)));
 }
 
 int main()
 {
     Profile([]() { Print(Simple<int>()); });
+    Profile([]() { Print(Simple<wide_uint<128>>()); });
+    // the 11 even terms up to 4 million, then the first 10^18 mod 10^9 + 7
+    Profile([]() { Print(EvenSumMod<std::uint64_t>(11, 1000000007)); });
+    Profile([]() { Print(EvenSumMod<std::uint64_t>(1000000000000000000, 1000000007)); });
 
     return 0;
 }
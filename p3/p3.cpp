@@ -3,10 +3,17 @@
 
 #include "stdafx.h"
 
+#include <algorithm>
+#include <bit>
+#include <cstdint>
 #include <set>
+#include <vector>
 
+#include "utils/modular.h"
+#include "utils/sieve.h"
 #include "utils/utils.h"
 #include "utils/utils_inl.h"
+#include "utils/wide_uint.h"
 
 /* The prime factors of 13195 are 5, 7, 13 and 29
 
@@ -53,10 +60,133 @@ T Simple(T n)
     return lastFactor;
 }
 
+const std::uint64_t smallPrimes[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+
+// Miller-Rabin with the first 12 primes as bases, which is exact for every 64-bit n.
+bool IsPrime(std::uint64_t n)
+{
+    for (const std::uint64_t p : smallPrimes)
+    {
+        if (n % p == 0)
+            return n == p;
+    }
+    if (n < 2)
+        return false;
+
+    const montgomery<std::uint64_t> mod(n);
+    const unsigned twos = static_cast<unsigned>(std::countr_zero(n - 1));
+    const std::uint64_t odd = (n - 1) >> twos;
+    const std::uint64_t minusOne = mod.to_residue(n - 1);
+
+    for (const std::uint64_t base : smallPrimes)
+    {
+        std::uint64_t x = mod_pow(mod, mod.to_residue(base), odd);
+        if (x == mod.one() || x == minusOne)
+            continue;
+
+        unsigned squarings = 1;
+        for (; squarings < twos && x != minusOne; ++squarings)
+            x = mod.multiply(x, x);
+        if (x != minusOne)
+            return false;
+    }
+    return true;
+}
+
+// A factor of n, which must be odd and composite, by Pollard's rho with Brent's cycle finding - gcds taken
+// of the product of a batch of differences rather than of each one.
+std::uint64_t FindFactor(std::uint64_t n)
+{
+    const std::uint64_t batch = 128;
+    const montgomery<std::uint64_t> mod(n);
+
+    for (std::uint64_t c = 1;; ++c)
+    {
+        const std::uint64_t increment = mod.to_residue(c);
+        auto next = [&mod, increment](std::uint64_t x) { return mod.add(mod.multiply(x, x), increment); };
+
+        // in Montgomery form, x - y is (x - y) R mod n, which has the same gcd with n
+        std::uint64_t x = 0, y = mod.to_residue(2), saved = y, product = mod.one(), factor = 1;
+        for (std::uint64_t length = 1; factor == 1; length *= 2)
+        {
+            x = y;
+            for (std::uint64_t i = 0; i < length; ++i)
+                y = next(y);
+
+            for (std::uint64_t done = 0; done < length && factor == 1; done += batch)
+            {
+                saved = y;
+                for (std::uint64_t i = 0; i < std::min(batch, length - done); ++i)
+                {
+                    y = next(y);
+                    product = mod.multiply(product, mod.sub(x, y));
+                }
+                factor = binary_gcd(product, n);
+            }
+        }
+
+        // the batch went past the factor - step through it again one difference at a time
+        if (factor == n)
+        {
+            do
+            {
+                saved = next(saved);
+                factor = binary_gcd(mod.sub(x, saved), n);
+            } while (factor == 1);
+        }
+
+        if (factor != n)
+            return factor;
+    }
+}
+
+std::uint64_t Optimised(std::uint64_t n)
+{
+    std::uint64_t largest = 1;
+    for (; n % 2 == 0; n /= 2)
+        largest = 2;
+    if (n == 1)
+        return largest;
+    if (IsPrime(n))
+        return n;
+
+    const std::uint64_t factor = FindFactor(n);
+    return std::max({ largest, Optimised(factor), Optimised(n / factor) });
+}
+
+// The sum of the largest prime factors of 2 to limit - 1, factorising each by the smallest factor table:
+// n, n / spf(n), ... down to the largest.
+std::uint64_t SumLargestFactors(std::uint64_t limit)
+{
+    const std::vector<std::uint32_t> smallest = linear_sieve(limit, sieve_smallest_factor).smallest_factor;
+    std::uint64_t sum = 0;
+    for (std::uint32_t n = 2; n < limit; ++n)
+    {
+        std::uint32_t rest = n;
+        while (smallest[rest] != rest)
+            rest /= smallest[rest];
+        sum += rest;
+    }
+    return sum;
+}
+
 int main()
 {
     Profile([]() {Print(Simple(13195)); });
     Profile([]() {Print(Simple(600851475143)); });
+    Profile([]() {Print(Optimised(600851475143)); });
+    // the product of the two largest 32-bit primes, out of reach of trial division
+    Profile([]() {Print(Optimised(18446743979220271189ull)); });
+    // its square, past 64 bits
+    Profile([]() {Print(Simple(wide_uint<128>(600851475143) * 600851475143)); });
+    // every n below a million, one at a time and from a sieve
+    Profile([]() {
+        std::uint64_t sum = 0;
+        for (std::uint64_t n = 2; n < 1000000; ++n)
+            sum += Optimised(n);
+        Print(sum);
+    });
+    Profile([]() {Print(SumLargestFactors(1000000)); });
 
     return 0;
 }
@@ -7,7 +7,8 @@
 #include <mutex>
 #include <algorithm>
 
-std::list<int> some_list;
+std::list<int> some_list; // every push_back allocates a node - a std::pmr::list<int> on a pool_resource
+                          // (utils/memory_resource.h) recycles them instead
 std::mutex some_mutex;
 
 // guard list with mutex
@@ -86,6 +87,9 @@ public:
     }
 };
 
+// the mutex serialises all threads under contention - see utils/threadsafe_stack.h for lock_free_stack
+// (Treiber stack, split reference counts for ABA protection and reclamation, same push/pop interface)
+
 // deadlock
 // 2 or more mutexes (drum, drumstick)
 // always lock in the same order (works for most cases but may fail if locking two objects of the same type) lhs, rhs (2 threads reverse order)
@@ -201,6 +205,9 @@ public:
 
 thread_local unsigned long
 hierarchical_mutex::this_thread_hierarchy_value(ULONG_MAX);
+// utils/lock_profile.h has a named hierarchical_mutex (check in debug builds only) built on profiled_mutex,
+// which counts acquisitions and contended waits per lock - eg profiled_mutex<> some_mutex("some_mutex");
+// then report_lock_contention() shows which locks hurt throughput
 // flexible locking with unique_lock
 // unique_lock can be ctor with defer_lock
 // same code as above, unique_lock is slightly larger and slower
@@ -365,6 +372,9 @@ public:
     }
 };
 
+// readers still write the shared_mutex's cache line on every lookup, so read throughput doesn't scale with cores
+// - see utils/read_mostly_map.h for a sharded map with lock free snapshot reads and batched updates
+
 // recursive locking
 // recursive_mutex()
 // lock() * n, unlock * n (in same thread)
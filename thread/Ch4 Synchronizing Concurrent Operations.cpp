@@ -13,6 +13,7 @@
 
 
 // ok but sleep is too little or too much
+// (event_flag in utils/adaptive_sync.h spins briefly then parks, and is woken as soon as the flag is set)
 bool flag;
 std::mutex m;
 void wait_for_flag()
@@ -65,13 +66,38 @@ void data_processing_thread()
     }
 }
 
-// FULL cv queue
+// exactly one producer and one consumer - a wait free ring buffer avoids the mutex + condition_variable handoff
+// per chunk and only parks the consumer when the ring is empty (see utils/spsc_queue.h, push_n/pop_n for batches)
+spsc_queue<data_chunk, true> data_ring;
+
+void data_preparation_thread_spsc()
+{
+    while (more_data_to_prepare())
+    {
+        data_ring.push(prepare_data());
+    }
+}
+
+void data_processing_thread_spsc()
+{
+    while (true)
+    {
+        data_chunk data;
+        data_ring.wait_and_pop(data);
+        process(data);
+
+        if (is_last_chunk(data))
+            break;
+    }
+}
+
+// FULL cv queue (utils/threadsafe_queue.h moves values in and out and takes an allocator; threadbench measures it)
 template<typename T>
 class threadsafe_queue
 {
 private:
     mutable std::mutex mut;
-    std::queue<T> data_queue;
+    std::queue<T> data_queue; // std::queue<T, std::pmr::deque<T>> takes a memory resource (utils/memory_resource.h)
     std::condition_variable data_cond;
 public:
     threadsafe_queue()
@@ -130,6 +156,9 @@ public:
     }
 };
 
+// one mutex for every push and pop, a notify per push and a shared_ptr per pop - see utils/bounded_queue.h for
+// a bounded lock free MPMC alternative with the same interface that only sleeps after spinning
+
 // use futures for one off events - like an airplane call
 #include <future>
 #include <iostream>
@@ -149,6 +178,8 @@ auto f8 = std::async(
     baz, std::ref(x));
 auto f9 = std::async(baz, std::ref(x));
 f7.wait();
+// std::future can only be consumed by a blocking get() and launch::async may start a thread per call -
+// utils/future.h has task_future, run on a thread_pool, with then() continuations and when_all/when_any
 
 // can use packaged_task<> or promise<> instead of async()
 // packaged_task<> is the higher level abstraction
@@ -190,5 +221,7 @@ std::future<void> post_task_for_gui_thread(Func f)
     tasks.push_back(std::move(task));
     return res; // return future so caller may make use of (or ignore) the result once the task is executed in the above msg loop
 }
+// with coroutines the gui thread can be a scheduler to resume on instead - see thread_scheduler in utils/task.h:
+// co_await gui.schedule() continues the coroutine on the gui thread, which calls gui.run_pending() in its loop
 
 // if a task can't be expressed as a simple function call, or the result must come from more than one place then use a promise<>
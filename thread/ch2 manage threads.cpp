@@ -9,23 +9,24 @@
 
 #include <algorithm>
 #include <assert.h>
-#include <iostream>
 #include <memory>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "utils/log_sink.h"
+
 void fn()
 {
     for (int i = 0; i < 5; ++i)
-        std::cout << "the quick brown fox jumped over the lazy cow." << std::endl;
+        out() << "the quick brown fox jumped over the lazy cow.\n"; // line at a time, no flush (utils/log_sink.h)
 }
 
 void fn2(std::string& str)
 {
     for (int i = 0; i < 5; ++i)
     {
-        std::cout << str << std::endl;
+        out() << str << '\n';
         str += std::to_string(std::rand());
     }
 }
@@ -42,7 +43,7 @@ struct Widget
 
 void fn4(std::unique_ptr<Widget> pWidget)
 {
-    std::cout << "Widget state is " << pWidget->m_iState << std::endl;
+    out() << "Widget state is " << pWidget->m_iState << '\n';
 }
 
 class A
@@ -51,7 +52,7 @@ public:
 
     void show(std::string str)
     {
-        std::cout << "A::show() - " << str << std::endl;
+        out() << "A::show() - " << str << '\n';
     }
 };
 
@@ -107,6 +108,7 @@ public:
 // (naive) parallel accumulate
 // hardware_concurrency = #cores (hint) may be 0
 // doesn't handle exceptions - see ch8
+// see utils/parallel.h parallel_reduce for the production version
 template<typename Iterator, typename T>
 struct accumulate_block
 {
@@ -177,7 +179,7 @@ int main()
         std::thread t5(fn2, std::string("***T5***\n"));
         thread_guard g(t5);
 
-        std::cout << "other business at the call site\n";
+        out() << "other business at the call site\n";
     }
 
     // take care passing references/pointers to threads - the data always needs to outlive the thread.
@@ -230,7 +232,8 @@ int main()
     // can be used for storing in maps too
     // used to specialize algorithms, eg if this_thread.get_id() == master_thread then do something extra
 
-
+    // out() is queued for the log_sink's writer thread, which won't outlive main on every platform
+    default_log_sink().flush();
 
     return 0;
 }
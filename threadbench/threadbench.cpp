@@ -0,0 +1,310 @@
+// threadbench.cpp : Defines the entry point for the console application.
+//
+
+#include "stdafx.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils/adaptive_sync.h"
+#include "utils/bounded_queue.h"
+#include "utils/lock_profile.h"
+#include "utils/microbench.h"
+#include "utils/parallel.h"
+#include "utils/read_mostly_map.h"
+#include "utils/threadsafe_queue.h"
+#include "utils/threadsafe_stack.h"
+#include "utils/topology.h"
+
+/* Contention benchmarks for the thread library - each primitive at 1, 2, 4 .. N threads.
+   usage: threadbench [--threads N] [--ops N] [--push-percent P] [--write-percent W] [--json file]
+     --threads        most threads to run (default hardware threads)
+     --ops            operations per thread (default 1000000)
+     --push-percent   pushes in the stack mix, the rest are pops (default 50)
+     --write-percent  updates in the cache mix, the rest are lookups (default 5)
+     --json           also write the results to file */
+
+namespace {
+
+struct options
+{
+    unsigned max_threads = 0;
+    std::uint64_t ops = 1000000;
+    unsigned push_percent = 50;
+    unsigned write_percent = 5;
+    std::string json;
+};
+
+std::vector<bench_result> results;
+
+void Report(bench_result const& r)
+{
+    print_result(std::cout, r);
+    results.push_back(r);
+}
+
+std::string Percent(char const* what, unsigned percent)
+{
+    return std::string(what) + " " + std::to_string(percent) + "%";
+}
+
+// The stack is prefilled so pops mostly find something at any mix.
+template<typename Stack>
+void BenchStack(char const* variant, options const& opts)
+{
+    for (unsigned threads : thread_counts(opts.max_threads))
+    {
+        Stack stack;
+        for (int i = 0; i < 1000; ++i)
+            stack.push(i);
+
+        unsigned const percent = opts.push_percent;
+        Report(run_contended("stack", variant, Percent("push", percent), threads, opts.ops,
+            [&](unsigned t, std::uint64_t i) {
+                if (chance(t, i, percent))
+                {
+                    stack.push(static_cast<int>(i));
+                }
+                else
+                {
+                    int value;
+                    stack.try_pop(value);
+                }
+            }));
+    }
+}
+
+// Half the threads produce and half consume, each consumer taking as many items as a producer pushes.
+template<typename Queue>
+void BenchPipeline(char const* variant, options const& opts)
+{
+    for (unsigned threads : thread_counts(opts.max_threads))
+    {
+        if (threads < 2)
+            continue;
+        threads &= ~1u;
+
+        Queue queue;
+        Report(run_contended("pipeline", variant, "", threads, opts.ops,
+            [&](unsigned t, std::uint64_t i) {
+                if (t % 2)
+                {
+                    int value;
+                    queue.wait_and_pop(value);
+                }
+                else
+                {
+                    queue.push(static_cast<int>(i));
+                }
+            }));
+    }
+}
+
+std::size_t const numHosts = 1024;
+
+std::vector<std::string> HostNames()
+{
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < numHosts; ++i)
+        names.push_back("host" + std::to_string(i) + ".example.com");
+    return names;
+}
+
+// dns_cache from thread/Ch3 Sharing Data.cpp - a std::map behind a shared_mutex.
+class locked_map
+{
+public:
+    bool find(std::string const& key, int& value) const
+    {
+        std::shared_lock<std::shared_mutex> lk(mutex);
+        auto const it = entries.find(key);
+        if (it == entries.end())
+            return false;
+        value = it->second;
+        return true;
+    }
+
+    void update_or_add_entry(std::string const& key, int value)
+    {
+        std::lock_guard<std::shared_mutex> lk(mutex);
+        entries[key] = value;
+    }
+
+private:
+    std::map<std::string, int> entries;
+    mutable std::shared_mutex mutex;
+};
+
+template<typename Cache>
+void BenchCache(char const* variant, options const& opts)
+{
+    std::vector<std::string> const names = HostNames();
+
+    for (unsigned threads : thread_counts(opts.max_threads))
+    {
+        Cache cache;
+        for (std::size_t i = 0; i < numHosts; ++i)
+            cache.update_or_add_entry(names[i], static_cast<int>(i));
+
+        unsigned const percent = opts.write_percent;
+        Report(run_contended("dns_cache", variant, Percent("write", percent), threads, opts.ops,
+            [&](unsigned t, std::uint64_t i) {
+                std::string const& name = names[(i * 7919 + t) % numHosts];
+                if (chance(t, i, percent))
+                {
+                    cache.update_or_add_entry(name, static_cast<int>(i));
+                }
+                else
+                {
+                    int value;
+                    cache.find(name, value);
+                }
+            }));
+    }
+}
+
+// Every thread increments one counter under the lock - the worst case for contention.
+template<typename Mutex>
+void BenchMutex(char const* variant, options const& opts, std::function<Mutex*()> make)
+{
+    for (unsigned threads : thread_counts(opts.max_threads))
+    {
+        std::unique_ptr<Mutex> const mutex(make());
+        long long counter = 0;
+        Report(run_contended("mutex", variant, "", threads, opts.ops,
+            [&](unsigned, std::uint64_t) {
+                std::lock_guard<Mutex> lk(*mutex);
+                ++counter;
+            }));
+    }
+}
+
+// parallel_accumulate from thread/ch2 manage threads.cpp, with the thread count as a parameter.
+template<typename Iterator, typename T>
+T parallel_accumulate(Iterator first, Iterator last, T init, unsigned num_threads)
+{
+    std::size_t const length = std::distance(first, last);
+    std::size_t const block_size = length / num_threads;
+
+    std::vector<T> results(num_threads);
+    std::vector<std::thread> threads(num_threads - 1);
+    Iterator block_start = first;
+
+    for (unsigned i = 0; i < num_threads - 1; ++i)
+    {
+        Iterator block_end = block_start;
+        std::advance(block_end, block_size);
+        threads[i] = std::thread([block_start, block_end, &results, i]() {
+            results[i] = std::accumulate(block_start, block_end, T());
+        });
+        block_start = block_end;
+    }
+    results[num_threads - 1] = std::accumulate(block_start, last, T());
+
+    for (auto& t : threads)
+        t.join();
+
+    return std::accumulate(results.begin(), results.end(), init);
+}
+
+void BenchAccumulate(options const& opts)
+{
+    std::vector<int> const data(1 << 24, 1);
+    unsigned const batches = 20;
+    long long volatile sink = 0;
+
+    for (unsigned threads : thread_counts(opts.max_threads))
+    {
+        Report(run_batches("accumulate", "parallel_accumulate", threads, data.size(), batches, [&]() {
+            sink = parallel_accumulate(data.begin(), data.end(), 0LL, threads);
+        }));
+    }
+
+    Report(run_batches("accumulate", "parallel_reduce", detail::hardware_threads(), data.size(), batches, [&]() {
+        sink = parallel_reduce(data.begin(), data.end(), 0LL);
+    }));
+}
+
+bool ParseOptions(int argc, char* argv[], options& opts)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        char const* const value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value)
+            return false;
+
+        if (!std::strcmp(argv[i], "--threads"))
+            opts.max_threads = static_cast<unsigned>(std::strtoul(value, nullptr, 10));
+        else if (!std::strcmp(argv[i], "--ops"))
+            opts.ops = std::strtoull(value, nullptr, 10);
+        else if (!std::strcmp(argv[i], "--push-percent"))
+            opts.push_percent = static_cast<unsigned>(std::strtoul(value, nullptr, 10));
+        else if (!std::strcmp(argv[i], "--write-percent"))
+            opts.write_percent = static_cast<unsigned>(std::strtoul(value, nullptr, 10));
+        else if (!std::strcmp(argv[i], "--json"))
+            opts.json = value;
+        else
+            return false;
+        ++i;
+    }
+    return opts.push_percent <= 100 && opts.write_percent <= 100;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    options opts;
+    if (!ParseOptions(argc, argv, opts))
+    {
+        std::cerr << "usage: threadbench [--threads N] [--ops N] [--push-percent P] [--write-percent W]"
+            " [--json file]\n";
+        return 1;
+    }
+
+    cpu_topology::host().describe(std::cout);
+    std::cout << "kernels: " << isa_name(kernel_isa()) << "\n";
+    print_result_header(std::cout);
+
+    BenchStack<threadsafe_stack<int>>("threadsafe_stack", opts);
+    BenchStack<lock_free_stack<int>>("lock_free_stack", opts);
+
+    BenchPipeline<threadsafe_queue<int>>("threadsafe_queue", opts);
+    BenchPipeline<bounded_queue<int>>("bounded_queue", opts);
+
+    BenchCache<locked_map>("shared_mutex map", opts);
+    BenchCache<read_mostly_map<std::string, int>>("read_mostly_map", opts);
+
+    BenchMutex<std::mutex>("std::mutex", opts, []() { return new std::mutex(); });
+    BenchMutex<adaptive_mutex>("adaptive_mutex", opts, []() { return new adaptive_mutex(); });
+    BenchMutex<hierarchical_mutex>("hierarchical_mutex", opts, []() {
+        return new hierarchical_mutex("threadbench", 1000);
+    });
+
+    BenchAccumulate(opts);
+
+    if (!opts.json.empty())
+    {
+        std::ofstream file(opts.json);
+        write_json(file, results);
+        if (!file)
+        {
+            std::cerr << "couldn't write " << opts.json << '\n';
+            return 1;
+        }
+    }
+    return 0;
+}
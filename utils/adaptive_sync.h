@@ -0,0 +1,188 @@
+#pragma once
+
+// Spin-then-park synchronisation primitives - a mutex, a one shot event, a latch and a reusable barrier.
+// Waiters spin briefly (the wait is often over within a few hundred cycles) and then sleep on an address
+// wait (see atomic_wait.h), so a wake up costs microseconds rather than a polling interval, and a waiting
+// thread burns no CPU once parked. The releasing side only makes the wake call when someone is asleep.
+// Compare wait_for_flag in thread/Ch4 Synchronizing Concurrent Operations.cpp.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+#include "atomic_wait.h"
+
+// Mutex that spins before parking, adapting how long it spins to how long recent lock waits have taken.
+// state: 0 unlocked, 1 locked, 2 locked with (possible) sleepers.
+class adaptive_mutex
+{
+public:
+    static int const max_spin = 1000;
+
+    adaptive_mutex() : state(0), spin_estimate(16)
+    {
+    }
+
+    adaptive_mutex(adaptive_mutex const&) = delete;
+    adaptive_mutex& operator=(adaptive_mutex const&) = delete;
+
+    void lock()
+    {
+        std::uint32_t expected = 0;
+        if (state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed))
+            return;
+
+        // spin for up to twice the recent average before parking
+        int const estimate = spin_estimate.load(std::memory_order_relaxed);
+        int const limit = std::min(max_spin, estimate * 2 + 10);
+        for (int spin = 0; spin < limit; ++spin)
+        {
+            cpu_relax();
+            expected = 0;
+            if (state.load(std::memory_order_relaxed) == 0 &&
+                state.compare_exchange_weak(expected, 1, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                spin_estimate.store(estimate + (spin - estimate) / 8, std::memory_order_relaxed);
+                return;
+            }
+        }
+        spin_estimate.store(estimate + (limit - estimate) / 8, std::memory_order_relaxed);
+
+        // marks the lock as having sleepers, so unlock knows to wake one
+        while (state.exchange(2, std::memory_order_acquire) != 0)
+            atomic_wait(state, 2);
+    }
+
+    bool try_lock()
+    {
+        std::uint32_t expected = 0;
+        return state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock()
+    {
+        if (state.exchange(0, std::memory_order_release) == 2)
+            atomic_notify_one(state);
+    }
+
+private:
+    std::atomic<std::uint32_t> state;
+    std::atomic<int> spin_estimate;
+};
+
+// One shot event - wait() returns once set() has been called, immediately from then on.
+class event_flag
+{
+public:
+    event_flag() : flag(false)
+    {
+    }
+
+    event_flag(event_flag const&) = delete;
+    event_flag& operator=(event_flag const&) = delete;
+
+    void set()
+    {
+        flag.store(true, std::memory_order_release);
+        waiters.notify_all();
+    }
+
+    bool is_set() const
+    {
+        return flag.load(std::memory_order_acquire);
+    }
+
+    void wait()
+    {
+        waiters.wait_until([this] { return is_set(); });
+    }
+
+private:
+    std::atomic<bool> flag;
+    event_count waiters;
+};
+
+// Single use countdown (as C++20's std::latch) - waiters are released once count_down has been called
+// expected times in total.
+class latch
+{
+public:
+    explicit latch(std::ptrdiff_t expected) : count(expected)
+    {
+    }
+
+    latch(latch const&) = delete;
+    latch& operator=(latch const&) = delete;
+
+    void count_down(std::ptrdiff_t n = 1)
+    {
+        if (count.fetch_sub(n, std::memory_order_acq_rel) == n)
+            waiters.notify_all();
+    }
+
+    bool try_wait() const
+    {
+        return count.load(std::memory_order_acquire) == 0;
+    }
+
+    void wait()
+    {
+        waiters.wait_until([this] { return try_wait(); });
+    }
+
+    void arrive_and_wait(std::ptrdiff_t n = 1)
+    {
+        count_down(n);
+        wait();
+    }
+
+private:
+    std::atomic<std::ptrdiff_t> count;
+    event_count waiters;
+};
+
+// Reusable barrier for phased work (as C++20's std::barrier) - each phase completes once count threads
+// have arrived; the last to arrive runs the completion function before any thread is released.
+class barrier
+{
+public:
+    explicit barrier(std::ptrdiff_t count_, std::function<void()> completion_ = std::function<void()>()) :
+        count(count_),
+        completion(std::move(completion_)),
+        arrived(0),
+        phase(0)
+    {
+    }
+
+    barrier(barrier const&) = delete;
+    barrier& operator=(barrier const&) = delete;
+
+    void arrive_and_wait()
+    {
+        std::uint32_t const current = phase.load(std::memory_order_acquire);
+
+        if (arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == count)
+        {
+            // nobody can arrive for the next phase until it starts, so the reset can't race
+            arrived.store(0, std::memory_order_relaxed);
+            if (completion)
+                completion();
+
+            phase.store(current + 1, std::memory_order_release);
+            waiters.notify_all();
+            return;
+        }
+
+        waiters.wait_until([this, current] { return phase.load(std::memory_order_acquire) != current; });
+    }
+
+private:
+    std::ptrdiff_t const count;
+    std::function<void()> const completion;
+    std::atomic<std::ptrdiff_t> arrived;
+    std::atomic<std::uint32_t> phase;
+    event_count waiters;
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+// Waiting on an atomic's value - the OS address wait (WaitOnAddress on Windows, futex on Linux) under the
+// names C++20 gives it. Waits may return spuriously, callers re-check their condition.
+
+#include <atomic>
+#include <cstdint>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#else
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t), "address wait needs a plain 32 bit word");
+
+// Blocks while value == old.
+inline void atomic_wait(std::atomic<std::uint32_t>& value, std::uint32_t old)
+{
+#if defined(_WIN32)
+    WaitOnAddress(&value, &old, sizeof(old), INFINITE);
+#else
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&value), FUTEX_WAIT_PRIVATE, old, nullptr, nullptr, 0);
+#endif
+}
+
+inline void atomic_notify_one(std::atomic<std::uint32_t>& value)
+{
+#if defined(_WIN32)
+    WakeByAddressSingle(&value);
+#else
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&value), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+}
+
+inline void atomic_notify_all(std::atomic<std::uint32_t>& value)
+{
+#if defined(_WIN32)
+    WakeByAddressAll(&value);
+#else
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&value), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+// Spin loop hint - lets the sibling hyperthread run and saves power while busy waiting.
+inline void cpu_relax()
+{
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+    _mm_pause();
+#endif
+}
+
+// Spin-then-park handshake for a condition other threads make true (eg a queue becoming non-empty).
+// Waiters spin on their attempt, then sleep on the epoch word; notifiers only bump the epoch and make the
+// wake call when a waiter has announced itself, so the uncontended path is a fence and a load.
+class event_count
+{
+private:
+    static int const spin_limit = 128;
+
+    std::atomic<std::uint32_t> epoch;
+    std::atomic<std::uint32_t> sleeping;
+
+public:
+    event_count() : epoch(0), sleeping(0)
+    {
+    }
+
+    event_count(event_count const&) = delete;
+    event_count& operator=(event_count const&) = delete;
+
+    // Returns once attempt() returns true.
+    template<typename Attempt>
+    void wait_until(Attempt attempt)
+    {
+        for (int spin = 0; spin < spin_limit; ++spin)
+        {
+            if (attempt())
+                return;
+            cpu_relax();
+        }
+
+        for (;;)
+        {
+            // announce before the final attempt - pairs with the fence in notify so either the notifier
+            // sees the sleeper or the sleeper sees the notifier's update
+            sleeping.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::uint32_t const old = epoch.load(std::memory_order_acquire);
+
+            bool const done = attempt();
+            if (!done)
+                atomic_wait(epoch, old);
+
+            sleeping.fetch_sub(1, std::memory_order_relaxed);
+
+            if (done || attempt())
+                return;
+        }
+    }
+
+    // Call after making the condition true.
+    void notify_one()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed))
+        {
+            epoch.fetch_add(1, std::memory_order_release);
+            atomic_notify_one(epoch);
+        }
+    }
+
+    void notify_all()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed))
+        {
+            epoch.fetch_add(1, std::memory_order_release);
+            atomic_notify_all(epoch);
+        }
+    }
+};
@@ -0,0 +1,181 @@
+#pragma once
+
+// Bounded lock free MPMC queue - an alternative to threadsafe_queue (see thread/Ch4 Synchronizing Concurrent
+// Operations.cpp) with the same interface.
+// An array ring of cells, each carrying a sequence number (Vyukov): a producer claims the cell at enqueue_pos
+// when its sequence equals the position, a consumer the cell at dequeue_pos when it's one past, so producers
+// and consumers only contend on their own position counter. Values are moved in and out (T may be move only)
+// and the T& overloads don't allocate.
+// Blocking calls spin briefly, then sleep on an address wait. Pushes and pops only touch the wait word when
+// a thread is actually asleep, rather than notifying on every push.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "atomic_wait.h"
+#include "per_thread.h"
+
+template<typename T>
+class bounded_queue
+{
+private:
+    struct cell
+    {
+        std::atomic<std::size_t> sequence;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    std::size_t const mask;
+    std::unique_ptr<cell[]> const buffer;
+
+    alignas(cache_line_size) std::atomic<std::size_t> enqueue_pos;
+    alignas(cache_line_size) std::atomic<std::size_t> dequeue_pos;
+
+    alignas(cache_line_size) event_count not_empty;
+    alignas(cache_line_size) event_count not_full;
+
+    static std::size_t round_up_pow2(std::size_t n)
+    {
+        std::size_t size = 2;
+        while (size < n)
+            size <<= 1;
+        return size;
+    }
+
+public:
+    // capacity is rounded up to a power of two
+    explicit bounded_queue(std::size_t capacity = 1024) :
+        mask(round_up_pow2(capacity) - 1),
+        buffer(new cell[mask + 1]),
+        enqueue_pos(0),
+        dequeue_pos(0)
+    {
+        for (std::size_t i = 0; i <= mask; ++i)
+        {
+            buffer[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~bounded_queue()
+    {
+        std::size_t const last = enqueue_pos.load(std::memory_order_relaxed);
+        for (std::size_t pos = dequeue_pos.load(std::memory_order_relaxed); pos != last; ++pos)
+        {
+            reinterpret_cast<T*>(&buffer[pos & mask].storage)->~T();
+        }
+    }
+
+    bounded_queue(bounded_queue const&) = delete;
+    bounded_queue& operator=(bounded_queue const&) = delete;
+
+    // Returns false, leaving new_value untouched, if the queue is full.
+    bool try_push(T& new_value)
+    {
+        cell* target;
+        std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            target = &buffer[pos & mask];
+            std::size_t const sequence = target->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t const diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+
+            if (diff == 0)
+            {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (&target->storage) T(std::move(new_value));
+        target->sequence.store(pos + 1, std::memory_order_release);
+
+        not_empty.notify_one();
+        return true;
+    }
+
+    // Blocks while the queue is full.
+    void push(T new_value)
+    {
+        not_full.wait_until([&] { return try_push(new_value); });
+    }
+
+    bool try_pop(T& value)
+    {
+        cell* target;
+        std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            target = &buffer[pos & mask];
+            std::size_t const sequence = target->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t const diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+
+            if (diff == 0)
+            {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        T* const stored = reinterpret_cast<T*>(&target->storage);
+        value = std::move(*stored); // T's move assignment mustn't throw, the cell is already claimed
+        stored->~T();
+        target->sequence.store(pos + mask + 1, std::memory_order_release);
+
+        not_full.notify_one();
+        return true;
+    }
+
+    std::shared_ptr<T> try_pop()
+    {
+        T value;
+        if (!try_pop(value))
+            return std::shared_ptr<T>();
+        return std::make_shared<T>(std::move(value));
+    }
+
+    void wait_and_pop(T& value)
+    {
+        not_empty.wait_until([&] { return try_pop(value); });
+    }
+
+    std::shared_ptr<T> wait_and_pop()
+    {
+        T value;
+        wait_and_pop(value);
+        return std::make_shared<T>(std::move(value));
+    }
+
+    // only a snapshot while other threads are pushing or popping
+    bool empty() const
+    {
+        return enqueue_pos.load(std::memory_order_relaxed) == dequeue_pos.load(std::memory_order_relaxed);
+    }
+
+    std::size_t capacity() const
+    {
+        return mask + 1;
+    }
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+// Cooperative cancellation and time budgets.
+// A cancellation_token is a shared flag with an optional deadline. Long running work polls it, eg once per
+// row or segment, and stops by throwing cancelled_error. Nothing is interrupted: a kernel that never polls
+// runs to the end. Past the deadline, the first poll sets the flag, so later polls only read an atomic.
+// search_progress is what cancelled work leaves behind: the fraction of its search space it covered and the
+// best result found so far, which Profile reports when a budget runs out (see utils.h).
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+class cancelled_error : public std::runtime_error
+{
+public:
+    cancelled_error() : std::runtime_error("task cancelled")
+    {
+    }
+};
+
+// Copies share one flag and deadline.
+class cancellation_token
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    cancellation_token() : shared(std::make_shared<state>())
+    {
+    }
+
+    void cancel() const
+    {
+        shared->cancelled.store(true, std::memory_order_release);
+    }
+
+    // Cancels once deadline has passed (as seen by the next poll).
+    void cancel_at(clock::time_point deadline) const
+    {
+        shared->deadline.store(deadline.time_since_epoch().count(), std::memory_order_release);
+    }
+
+    template<typename Rep, typename Period>
+    void cancel_after(std::chrono::duration<Rep, Period> budget) const
+    {
+        cancel_at(clock::now() + std::chrono::duration_cast<clock::duration>(budget));
+    }
+
+    bool is_cancelled() const
+    {
+        if (shared->cancelled.load(std::memory_order_acquire))
+            return true;
+
+        clock::rep const deadline = shared->deadline.load(std::memory_order_relaxed);
+        if (deadline == no_deadline || clock::now().time_since_epoch().count() < deadline)
+            return false;
+
+        cancel();
+        return true;
+    }
+
+    void throw_if_cancelled() const
+    {
+        if (is_cancelled())
+            throw cancelled_error();
+    }
+
+private:
+    static constexpr clock::rep no_deadline = clock::duration::max().count();
+
+    struct state
+    {
+        std::atomic<bool> cancelled;
+        std::atomic<clock::rep> deadline;
+
+        state() : cancelled(false), deadline(no_deadline)
+        {
+        }
+    };
+
+    std::shared_ptr<state> shared;
+};
+
+// Progress of a search through units of work (rows, segments, ...) that may be shared by several threads.
+class search_progress
+{
+public:
+    search_progress() : covered(0), total(0)
+    {
+    }
+
+    search_progress(search_progress const&) = delete;
+    search_progress& operator=(search_progress const&) = delete;
+
+    void set_total(std::uint64_t units)
+    {
+        total.store(units, std::memory_order_relaxed);
+    }
+
+    void advance(std::uint64_t units = 1)
+    {
+        covered.fetch_add(units, std::memory_order_relaxed);
+    }
+
+    // 0 until set_total is called.
+    double fraction() const
+    {
+        std::uint64_t const of = total.load(std::memory_order_relaxed);
+        return of ? static_cast<double>(covered.load(std::memory_order_relaxed)) / static_cast<double>(of) : 0.0;
+    }
+
+    // Records the best result so far, as text - call it when the best improves rather than every step.
+    template<typename T>
+    void report_best(T const& value)
+    {
+        std::ostringstream text;
+        text << value;
+        std::lock_guard<std::mutex> lk(m);
+        best = text.str();
+    }
+
+    // Empty if nothing has been reported.
+    std::string best_so_far() const
+    {
+        std::lock_guard<std::mutex> lk(m);
+        return best;
+    }
+
+private:
+    std::atomic<std::uint64_t> covered;
+    std::atomic<std::uint64_t> total;
+    mutable std::mutex m;
+    std::string best;
+};
@@ -0,0 +1,316 @@
+#pragma once
+
+// Checkpoint and resume for long searches.
+// resumable_search splits [0, total) into fixed size segments and hands them out to worker threads. As each
+// segment finishes, its result is folded into the best so far and the segment is marked done in a bitmap.
+// At most once per interval, the worker finishing a segment writes the best so far and the bitmap to a
+// binary file. It writes a temporary file and renames it over the checkpoint, so a crash mid write leaves the
+// previous checkpoint intact. Starting the same search again (same key, total and segment size) resumes from
+// the file and skips the done segments. Segments don't depend on the thread count, so a run can resume with
+// more or fewer threads. Only segments in progress when the run stopped are repeated, at most one per thread.
+// A checkpoint is one buffered write of a bit per segment, about 125KB per million segments. At the default
+// interval of 30s that is far below 1% of the run, as long as segments are coarse (milliseconds or more each).
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include "cancellation.h"
+#include "parallel.h"
+
+class checkpoint_error : public std::runtime_error
+{
+public:
+    explicit checkpoint_error(std::string const& what) : std::runtime_error(what)
+    {
+    }
+};
+
+// Everything a checkpoint file records. T is the best so far, written as its bytes.
+template<typename T>
+struct search_state
+{
+    static_assert(std::is_trivially_copyable<T>::value, "the best so far is saved as raw bytes");
+
+    std::uint64_t key;                 // which search, see checkpoint_key
+    std::uint64_t total;               // the search covers [0, total)
+    std::uint64_t segment_size;
+    T best;
+    std::vector<std::uint64_t> done;   // bit i set once segment i is finished
+
+    search_state(std::uint64_t key_, std::uint64_t total_, std::uint64_t segment_size_, T best_) :
+        key(key_), total(total_), segment_size(segment_size_), best(best_), done((segments() + 63) / 64, 0)
+    {
+    }
+
+    std::uint64_t segments() const
+    {
+        return (total + segment_size - 1) / segment_size;
+    }
+
+    bool is_done(std::uint64_t segment) const
+    {
+        return (done[segment / 64] >> (segment % 64) & 1) != 0;
+    }
+
+    void mark_done(std::uint64_t segment)
+    {
+        done[segment / 64] |= std::uint64_t(1) << (segment % 64);
+    }
+
+    std::uint64_t count_done() const
+    {
+        std::uint64_t count = 0;
+        for (std::uint64_t segment = 0; segment < segments(); ++segment)
+            count += is_done(segment);
+        return count;
+    }
+};
+
+namespace detail {
+
+char const checkpoint_magic[8] = { 'E', 'U', 'L', 'R', 'C', 'K', 'P', 'T' };
+std::uint32_t const checkpoint_version = 1;
+
+inline std::uint64_t fnv1a(void const* data, std::size_t length, std::uint64_t hash = 0xcbf29ce484222325)
+{
+    unsigned char const* bytes = static_cast<unsigned char const*>(data);
+    for (std::size_t i = 0; i < length; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+template<typename U>
+void append_bytes(std::string& image, U const& value)
+{
+    image.append(reinterpret_cast<char const*>(&value), sizeof(value));
+}
+
+// image must hold at least sizeof(value) bytes
+template<typename U>
+void take_bytes(std::string_view& image, U& value)
+{
+    std::memcpy(&value, image.data(), sizeof(value));
+    image.remove_prefix(sizeof(value));
+}
+
+}  // namespace detail
+
+// A search's key, from its name and a parameter (eg the number of digits), so a checkpoint is only resumed
+// by the search that wrote it.
+inline std::uint64_t checkpoint_key(std::string_view name, std::uint64_t parameter)
+{
+    return detail::fnv1a(&parameter, sizeof(parameter), detail::fnv1a(name.data(), name.size()));
+}
+
+// Writes state to path, replacing any previous checkpoint only once the new one is complete.
+template<typename T>
+void write_checkpoint(std::filesystem::path const& path, search_state<T> const& state)
+{
+    std::string image(detail::checkpoint_magic, sizeof(detail::checkpoint_magic));
+    detail::append_bytes(image, detail::checkpoint_version);
+    detail::append_bytes(image, static_cast<std::uint32_t>(sizeof(T)));
+    detail::append_bytes(image, state.key);
+    detail::append_bytes(image, state.total);
+    detail::append_bytes(image, state.segment_size);
+    detail::append_bytes(image, state.best);
+    image.append(reinterpret_cast<char const*>(state.done.data()), state.done.size() * sizeof(std::uint64_t));
+    detail::append_bytes(image, detail::fnv1a(image.data(), image.size()));
+
+    std::filesystem::path temporary = path;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(image.data(), static_cast<std::streamsize>(image.size()));
+        file.close();
+        if (!file)
+            throw checkpoint_error("can't write checkpoint " + temporary.string());
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error)
+        throw checkpoint_error("can't replace checkpoint " + path.string() + ": " + error.message());
+}
+
+// Reads the checkpoint at path into state if it was written by the same search - same key, total, segment
+// size and type of best - and is intact. Otherwise returns false and leaves state alone.
+template<typename T>
+bool read_checkpoint(std::filesystem::path const& path, search_state<T>& state)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    std::string const image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    std::size_t const expected = sizeof(detail::checkpoint_magic) + 2 * sizeof(std::uint32_t) +
+        3 * sizeof(std::uint64_t) + sizeof(T) + state.done.size() * sizeof(std::uint64_t) + sizeof(std::uint64_t);
+    if (image.size() != expected ||
+        std::memcmp(image.data(), detail::checkpoint_magic, sizeof(detail::checkpoint_magic)) != 0)
+        return false;
+
+    std::uint64_t checksum;
+    std::memcpy(&checksum, image.data() + image.size() - sizeof(checksum), sizeof(checksum));
+    if (checksum != detail::fnv1a(image.data(), image.size() - sizeof(checksum)))
+        return false;
+
+    std::string_view rest(image);
+    rest.remove_prefix(sizeof(detail::checkpoint_magic));
+    std::uint32_t version, best_size;
+    std::uint64_t key, total, segment_size;
+    T best;
+    detail::take_bytes(rest, version);
+    detail::take_bytes(rest, best_size);
+    detail::take_bytes(rest, key);
+    detail::take_bytes(rest, total);
+    detail::take_bytes(rest, segment_size);
+    detail::take_bytes(rest, best);
+    if (version != detail::checkpoint_version || best_size != sizeof(T) || key != state.key ||
+        total != state.total || segment_size != state.segment_size)
+        return false;
+
+    state.best = best;
+    std::memcpy(state.done.data(), rest.data(), state.done.size() * sizeof(std::uint64_t));
+    return true;
+}
+
+struct search_options
+{
+    std::filesystem::path path;  // checkpoint file; empty for none
+    std::chrono::steady_clock::duration interval = std::chrono::seconds(30);
+    unsigned threads = 0;        // 0 for one per hardware thread
+    bool keep = false;           // keep the final checkpoint rather than removing it once the search completes
+    cancellation_token token;    // stops the search between segments, see resumable_search
+    search_progress* progress = nullptr;  // segments covered and the best so far, if set
+};
+
+// Returns combine(...combine(init, func(s0)), ...) over the segments [first, last) of [0, total), where
+// func(first, last, best) searches one segment knowing the best found so far (to prune with) and combine picks
+// the better of two results. combine must be associative and commutative, as segments finish in any order.
+// If func throws, the segments finished by then are checkpointed before the exception is rethrown (it is
+// rethrown even if that checkpoint can't be written). Likewise if options.token is cancelled: workers finish
+// their current segment, then cancelled_error is thrown, and a later run with the same checkpoint carries on
+// from there.
+template<typename T, typename Func, typename Combine>
+T resumable_search(std::uint64_t key, std::uint64_t total, std::uint64_t segment_size, T init, Func func,
+    Combine combine, search_options const& options = search_options())
+{
+    typedef std::chrono::steady_clock clock;
+
+    search_state<T> state(key, total, std::max<std::uint64_t>(segment_size, 1), init);
+    bool const checkpointing = !options.path.empty();
+    if (checkpointing)
+        read_checkpoint(options.path, state);
+
+    std::vector<std::uint64_t> pending;
+    for (std::uint64_t segment = 0; segment < state.segments(); ++segment)
+    {
+        if (!state.is_done(segment))
+            pending.push_back(segment);
+    }
+
+    if (options.progress)
+    {
+        options.progress->set_total(state.segments());
+        options.progress->advance(state.segments() - pending.size());
+        options.progress->report_best(state.best);
+    }
+
+    if (!pending.empty())
+    {
+        std::mutex m;
+        std::atomic<std::size_t> next(0);
+        clock::time_point last_saved = clock::now();
+
+        std::size_t const threads = std::min<std::size_t>(
+            options.threads ? options.threads : detail::hardware_threads(), pending.size());
+
+        try
+        {
+            detail::run_blocks(threads, [&](std::size_t) {
+                T best;
+                {
+                    std::lock_guard<std::mutex> lk(m);
+                    best = state.best;
+                }
+
+                for (std::size_t i; !options.token.is_cancelled() &&
+                    (i = next.fetch_add(1, std::memory_order_relaxed)) < pending.size();)
+                {
+                    std::uint64_t const first = pending[i] * state.segment_size;
+                    std::uint64_t const last = std::min(first + state.segment_size, state.total);
+                    T const found = func(first, last, best);
+
+                    std::lock_guard<std::mutex> lk(m);
+                    T const previous = state.best;
+                    state.best = combine(state.best, found);
+                    state.mark_done(pending[i]);
+                    best = state.best;
+                    if (options.progress)
+                    {
+                        options.progress->advance();
+                        if (std::memcmp(&previous, &best, sizeof(T)) != 0)  // compared as the file stores it
+                            options.progress->report_best(best);
+                    }
+
+                    if (checkpointing && clock::now() - last_saved >= options.interval)
+                    {
+                        write_checkpoint(options.path, state);
+                        last_saved = clock::now();
+                    }
+                }
+            });
+        }
+        catch (...)
+        {
+            if (checkpointing)
+            {
+                // the search's own exception is the one to report
+                try
+                {
+                    write_checkpoint(options.path, state);
+                }
+                catch (...)
+                {
+                }
+            }
+            throw;
+        }
+
+        if (next.load(std::memory_order_relaxed) < pending.size())
+        {
+            if (checkpointing)
+                write_checkpoint(options.path, state);
+            throw cancelled_error();
+        }
+    }
+
+    if (checkpointing)
+    {
+        if (options.keep)
+            write_checkpoint(options.path, state);
+        else
+        {
+            std::error_code ignored;
+            std::filesystem::remove(options.path, ignored);
+        }
+    }
+
+    return state.best;
+}
@@ -0,0 +1,309 @@
+#pragma once
+
+// Epoch based memory reclamation for lock free structures.
+// Readers bracket every access to shared nodes with an epoch_guard, which publishes the global epoch they
+// started in on their own cache line. A writer that unlinks a node hands it to epoch_retire, which parks it
+// on the calling thread's retire list tagged with the current epoch. The global epoch only advances once
+// every active reader has caught up with it, so a node retired in epoch e can't be reachable by any reader
+// once the epoch reaches e + 2 - it's then freed.
+// Retire lists are scanned every retire_threshold retirements, so the cost is amortised; a thread holding
+// more than retire_limit nodes (outside a guard) waits for the epoch to advance, bounding unreclaimed memory
+// to roughly retire_limit per thread as long as no reader stalls inside a guard.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "per_thread.h"
+
+namespace detail {
+
+struct retired_ptr
+{
+    void* ptr;
+    void (*deleter)(void*);
+    std::uint64_t epoch;
+
+    void reclaim() const
+    {
+        deleter(ptr);
+    }
+};
+
+// state is padded on both sides (new needn't honour over-aligned types) so no other data shares its line
+struct epoch_record
+{
+    char leading_padding[cache_line_size];
+    std::atomic<std::uint64_t> state; // (epoch << 1) | active - the only field other threads read
+    char padding[cache_line_size - sizeof(std::atomic<std::uint64_t>)];
+
+    // owning thread only
+    int nesting;
+    std::vector<retired_ptr> retired[3]; // by epoch % 3
+    std::size_t retired_count;
+    std::size_t since_scan;
+
+    std::atomic<bool> in_use;
+    epoch_record* next;
+
+    epoch_record() : state(0), nesting(0), retired_count(0), since_scan(0), in_use(true), next(nullptr)
+    {
+    }
+};
+
+class epoch_domain
+{
+public:
+    static std::size_t const retire_threshold = 64;
+    static std::size_t const retire_limit = 64 * retire_threshold;
+
+    static epoch_domain& instance()
+    {
+        static epoch_domain domain;
+        return domain;
+    }
+
+    ~epoch_domain()
+    {
+        // only at process exit - everything still retired is unreachable by now
+        epoch_record* record = records.load(std::memory_order_acquire);
+        while (record)
+        {
+            epoch_record* const next = record->next;
+            for (auto& list : record->retired)
+            {
+                for (auto const& r : list)
+                    r.reclaim();
+            }
+            delete record;
+            record = next;
+        }
+
+        for (auto const& r : orphans)
+            r.reclaim();
+    }
+
+    epoch_record& local()
+    {
+        thread_local record_holder holder(*this);
+        return *holder.record;
+    }
+
+    void enter(epoch_record& record)
+    {
+        if (record.nesting++)
+            return;
+
+        std::uint64_t const epoch = global_epoch.load(std::memory_order_relaxed);
+        record.state.store((epoch << 1) | 1, std::memory_order_relaxed);
+        // publish before reading any shared pointer - pairs with try_advance
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void exit(epoch_record& record)
+    {
+        if (--record.nesting)
+            return;
+
+        record.state.store(record.state.load(std::memory_order_relaxed) & ~std::uint64_t(1),
+            std::memory_order_release);
+    }
+
+    void retire(epoch_record& record, void* ptr, void (*deleter)(void*))
+    {
+        std::uint64_t const epoch = global_epoch.load(std::memory_order_seq_cst);
+        std::vector<retired_ptr>& list = record.retired[epoch % 3];
+
+        // the list's previous occupants are from epoch - 3 or earlier, so already safe
+        if (!list.empty() && list.front().epoch != epoch)
+            reclaim_list(record, list);
+
+        retired_ptr const r = { ptr, deleter, epoch };
+        list.push_back(r);
+        ++record.retired_count;
+
+        if (++record.since_scan >= retire_threshold)
+        {
+            record.since_scan = 0;
+            try_advance();
+            reclaim(record);
+
+            while (record.retired_count > retire_limit && !record.nesting)
+            {
+                std::this_thread::yield();
+                try_advance();
+                reclaim(record);
+            }
+        }
+    }
+
+    // Advances the global epoch if every active reader has seen the current one.
+    bool try_advance()
+    {
+        std::uint64_t epoch = global_epoch.load(std::memory_order_seq_cst);
+
+        for (epoch_record* record = records.load(std::memory_order_acquire); record; record = record->next)
+        {
+            std::uint64_t const state = record->state.load(std::memory_order_seq_cst);
+            if ((state & 1) && (state >> 1) != epoch)
+                return false;
+        }
+
+        bool const advanced = global_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+
+        if (orphan_count.load(std::memory_order_relaxed))
+            reclaim_orphans();
+
+        return advanced;
+    }
+
+    // Frees everything in record's lists that no reader can still reach.
+    void reclaim(epoch_record& record)
+    {
+        std::uint64_t const epoch = global_epoch.load(std::memory_order_seq_cst);
+
+        for (auto& list : record.retired)
+        {
+            if (!list.empty() && list.front().epoch + 2 <= epoch)
+                reclaim_list(record, list);
+        }
+    }
+
+private:
+    alignas(cache_line_size) std::atomic<std::uint64_t> global_epoch;
+    std::atomic<epoch_record*> records;
+
+    // retired nodes left behind by threads that have exited
+    std::mutex orphan_mutex;
+    std::vector<retired_ptr> orphans;
+    std::atomic<std::size_t> orphan_count;
+
+    // Claims a record for the calling thread for its lifetime.
+    struct record_holder
+    {
+        epoch_domain& domain;
+        epoch_record* record;
+
+        explicit record_holder(epoch_domain& domain_) : domain(domain_), record(domain_.acquire_record())
+        {
+        }
+        ~record_holder()
+        {
+            domain.release_record(*record);
+        }
+    };
+
+    epoch_domain() : global_epoch(0), records(nullptr), orphan_count(0)
+    {
+    }
+
+    epoch_domain(epoch_domain const&) = delete;
+    epoch_domain& operator=(epoch_domain const&) = delete;
+
+    epoch_record* acquire_record()
+    {
+        for (epoch_record* record = records.load(std::memory_order_acquire); record; record = record->next)
+        {
+            bool expected = false;
+            if (!record->in_use.load(std::memory_order_relaxed) &&
+                record->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                return record;
+        }
+
+        epoch_record* const record = new epoch_record();
+        record->next = records.load(std::memory_order_relaxed);
+        while (!records.compare_exchange_weak(record->next, record,
+            std::memory_order_release, std::memory_order_relaxed));
+        return record;
+    }
+
+    void release_record(epoch_record& record)
+    {
+        if (record.retired_count)
+        {
+            std::lock_guard<std::mutex> lk(orphan_mutex);
+            for (auto& list : record.retired)
+            {
+                orphans.insert(orphans.end(), list.begin(), list.end());
+                list.clear();
+            }
+            orphan_count.store(orphans.size(), std::memory_order_relaxed);
+            record.retired_count = 0;
+        }
+
+        record.state.store(0, std::memory_order_release);
+        record.in_use.store(false, std::memory_order_release);
+    }
+
+    void reclaim_list(epoch_record& record, std::vector<retired_ptr>& list)
+    {
+        for (auto const& r : list)
+            r.reclaim();
+
+        record.retired_count -= list.size();
+        list.clear();
+    }
+
+    void reclaim_orphans()
+    {
+        std::vector<retired_ptr> ready;
+        {
+            std::lock_guard<std::mutex> lk(orphan_mutex);
+            std::uint64_t const epoch = global_epoch.load(std::memory_order_seq_cst);
+
+            std::vector<retired_ptr>::iterator const keep = std::partition(orphans.begin(), orphans.end(),
+                [epoch](retired_ptr const& r) { return r.epoch + 2 > epoch; });
+            ready.assign(keep, orphans.end());
+            orphans.erase(keep, orphans.end());
+            orphan_count.store(orphans.size(), std::memory_order_relaxed);
+        }
+
+        for (auto const& r : ready)
+            r.reclaim();
+    }
+};
+
+template<typename T>
+void delete_retired(void* ptr)
+{
+    delete static_cast<T*>(ptr);
+}
+
+}  // namespace detail
+
+// Read side critical section - pointers loaded from a lock free structure stay valid until the guard ends.
+// Guards nest.
+class epoch_guard
+{
+public:
+    epoch_guard() : record(detail::epoch_domain::instance().local())
+    {
+        detail::epoch_domain::instance().enter(record);
+    }
+    ~epoch_guard()
+    {
+        detail::epoch_domain::instance().exit(record);
+    }
+
+    epoch_guard(epoch_guard const&) = delete;
+    epoch_guard& operator=(epoch_guard const&) = delete;
+
+private:
+    detail::epoch_record& record;
+};
+
+// Deletes ptr once no epoch_guard that could have seen it remains. ptr must already be unreachable for
+// new readers.
+template<typename T>
+void epoch_retire(T* ptr)
+{
+    detail::epoch_domain& domain = detail::epoch_domain::instance();
+    domain.retire(domain.local(), const_cast<void*>(static_cast<void const*>(ptr)),
+        &detail::delete_retired<typename std::remove_cv<T>::type>);
+}
@@ -0,0 +1,491 @@
+#pragma once
+
+// Composable futures on a thread_pool.
+// std::future can only be consumed by a blocking get(), and std::async(std::launch::async) may start a thread
+// per call (see thread/Ch4 Synchronizing Concurrent Operations.cpp). task_future runs its work on a
+// thread_pool and is consumed by attaching continuations - then() posts the next stage to the pool once this
+// one is ready, and when_all/when_any combine futures - so no worker sits blocked waiting for a result.
+// Continuations receive the ready future (as in the Concurrency TS) and call get() on it, which rethrows
+// any exception from the stage before.
+// Every stage of a chain shares a cancellation_token: cancelling it makes stages that haven't started fail
+// with cancelled_error instead of running, and a running stage can poll the token itself.
+// Callables are stored in std::function, so must be copyable.
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "adaptive_sync.h"
+#include "cancellation.h"
+#include "thread_pool.h"
+
+class broken_promise : public std::logic_error
+{
+public:
+    broken_promise() : std::logic_error("promise destroyed without a value")
+    {
+    }
+};
+
+template<typename T>
+class task_future;
+
+template<typename T>
+class task_promise;
+
+namespace detail {
+
+// stands in for a void result
+struct unit
+{
+};
+
+template<typename T>
+struct stored
+{
+    typedef T type;
+};
+
+template<>
+struct stored<void>
+{
+    typedef unit type;
+};
+
+template<typename T>
+class shared_state
+{
+public:
+    typedef typename stored<T>::type value_type;
+
+    shared_state(thread_pool& pool_, cancellation_token token_) :
+        pool(pool_),
+        token(std::move(token_)),
+        completed(false),
+        has_value(false)
+    {
+    }
+
+    ~shared_state()
+    {
+        if (has_value)
+            value_ptr()->~value_type();
+    }
+
+    shared_state(shared_state const&) = delete;
+    shared_state& operator=(shared_state const&) = delete;
+
+    thread_pool& pool;
+    cancellation_token const token;
+
+    // set the result with either emplace or set_exception, then complete
+    void emplace(value_type value)
+    {
+        new (&storage) value_type(std::move(value));
+        has_value = true;
+    }
+
+    void set_exception(std::exception_ptr e)
+    {
+        error = std::move(e);
+    }
+
+    // Makes the result visible and runs (ie posts) the continuations.
+    void complete()
+    {
+        std::vector<std::function<void()>> ready_continuations;
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            completed = true;
+            ready_continuations.swap(continuations);
+        }
+        ready.set();
+
+        for (auto& continuation : ready_continuations)
+            continuation();
+    }
+
+    bool is_ready() const
+    {
+        return ready.is_set();
+    }
+
+    // A pool worker runs other tasks while it waits instead of blocking the pool.
+    void wait()
+    {
+        thread_pool* const worker_of = thread_pool::current();
+        if (!worker_of)
+        {
+            ready.wait();
+            return;
+        }
+
+        while (!is_ready())
+        {
+            if (!worker_of->run_pending_task())
+                std::this_thread::yield();
+        }
+    }
+
+    value_type& value()
+    {
+        wait();
+        if (error)
+            std::rethrow_exception(error);
+        return *value_ptr();
+    }
+
+    // Calls func once the result is set - straight away if it already is.
+    void on_ready(std::function<void()> func)
+    {
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            if (!completed)
+            {
+                continuations.push_back(std::move(func));
+                return;
+            }
+        }
+        func();
+    }
+
+private:
+    std::mutex mutex;
+    bool completed;
+    std::vector<std::function<void()>> continuations;
+    event_flag ready;
+
+    std::exception_ptr error;
+    typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type storage;
+    bool has_value;
+
+    value_type* value_ptr()
+    {
+        return reinterpret_cast<value_type*>(&storage);
+    }
+};
+
+template<typename Func>
+unit call(Func& func, std::true_type /*returns void*/)
+{
+    func();
+    return unit();
+}
+
+template<typename Func>
+auto call(Func& func, std::false_type) -> decltype(func())
+{
+    return func();
+}
+
+// Runs func into state, unless the chain has been cancelled.
+template<typename T, typename Func>
+void run_into(shared_state<T>& state, Func& func)
+{
+    try
+    {
+        state.token.throw_if_cancelled();
+        state.emplace(call(func, std::is_void<T>()));
+    }
+    catch (...)
+    {
+        state.set_exception(std::current_exception());
+    }
+    state.complete();
+}
+
+template<typename T>
+struct take_value
+{
+    static T from(shared_state<T>& state)
+    {
+        return std::move(state.value());
+    }
+};
+
+template<>
+struct take_value<void>
+{
+    static void from(shared_state<void>& state)
+    {
+        state.value();
+    }
+};
+
+// when_all/when_any reach into the futures they combine
+struct future_access
+{
+    template<typename T>
+    static std::shared_ptr<shared_state<T>> const& state(task_future<T> const& future)
+    {
+        return future.state;
+    }
+
+    template<typename T>
+    static task_future<T> make(std::shared_ptr<shared_state<T>> state)
+    {
+        return task_future<T>(std::move(state));
+    }
+};
+
+}  // namespace detail
+
+// Move only, and single use like std::future - get() and then() consume it.
+template<typename T>
+class task_future
+{
+public:
+    task_future()
+    {
+    }
+
+    task_future(task_future&&) = default;
+    task_future& operator=(task_future&&) = default;
+    task_future(task_future const&) = delete;
+    task_future& operator=(task_future const&) = delete;
+
+    bool valid() const
+    {
+        return state != nullptr;
+    }
+
+    bool is_ready() const
+    {
+        return state->is_ready();
+    }
+
+    void wait() const
+    {
+        state->wait();
+    }
+
+    // Waits for and returns the result, rethrowing the task's exception. On a pool worker the wait runs
+    // other queued tasks - prefer then() inside tasks.
+    T get()
+    {
+        std::shared_ptr<detail::shared_state<T>> const consumed = std::move(state);
+        return detail::take_value<T>::from(*consumed);
+    }
+
+    // Posts func(ready future) to the pool once this future is ready, returning a future for its result.
+    template<typename Func>
+    auto then(Func func) -> task_future<std::invoke_result_t<Func, task_future>>
+    {
+        typedef std::invoke_result_t<Func, task_future> result_type;
+
+        std::shared_ptr<detail::shared_state<T>> const previous = std::move(state);
+        auto const next = std::make_shared<detail::shared_state<result_type>>(previous->pool, previous->token);
+
+        previous->on_ready([previous, next, func]() {
+            next->pool.post([previous, next, func]() mutable {
+                task_future ready_future(previous);
+                auto stage = [&]() { return func(std::move(ready_future)); };
+                detail::run_into(*next, stage);
+            });
+        });
+
+        return task_future<result_type>(next);
+    }
+
+    // Cancels this future's chain - stages that haven't started yet fail with cancelled_error.
+    void cancel() const
+    {
+        state->token.cancel();
+    }
+
+    cancellation_token token() const
+    {
+        return state->token;
+    }
+
+private:
+    template<typename U>
+    friend class task_future;
+    friend class task_promise<T>;
+    friend struct detail::future_access;
+
+    std::shared_ptr<detail::shared_state<T>> state;
+
+    explicit task_future(std::shared_ptr<detail::shared_state<T>> state_) : state(std::move(state_))
+    {
+    }
+};
+
+template<typename T>
+class task_promise
+{
+public:
+    typedef typename detail::stored<T>::type value_type;
+
+    // continuations of the future run on pool
+    explicit task_promise(thread_pool& pool = thread_pool::default_pool(),
+        cancellation_token token = cancellation_token()) :
+        state(std::make_shared<detail::shared_state<T>>(pool, std::move(token))),
+        satisfied(false)
+    {
+    }
+
+    // an unsatisfied promise leaves its future broken_promise rather than waiting forever
+    ~task_promise()
+    {
+        if (state && !satisfied)
+        {
+            state->set_exception(std::make_exception_ptr(broken_promise()));
+            state->complete();
+        }
+    }
+
+    task_promise(task_promise&& other) : state(std::move(other.state)), satisfied(other.satisfied)
+    {
+    }
+
+    task_promise(task_promise const&) = delete;
+    task_promise& operator=(task_promise const&) = delete;
+
+    task_future<T> get_future() const
+    {
+        return task_future<T>(state);
+    }
+
+    // set_value() for task_promise<void>
+    template<typename... Args>
+    void set_value(Args&&... args)
+    {
+        satisfied = true;
+        state->emplace(value_type(std::forward<Args>(args)...));
+        state->complete();
+    }
+
+    void set_exception(std::exception_ptr e)
+    {
+        satisfied = true;
+        state->set_exception(std::move(e));
+        state->complete();
+    }
+
+private:
+    std::shared_ptr<detail::shared_state<T>> state;
+    bool satisfied;
+};
+
+// Runs func() on pool, returning a future for its result. func is skipped if token is cancelled first.
+template<typename Func>
+auto spawn(thread_pool& pool, Func func, cancellation_token token = cancellation_token())
+    -> task_future<std::invoke_result_t<Func>>
+{
+    typedef std::invoke_result_t<Func> result_type;
+
+    auto const state = std::make_shared<detail::shared_state<result_type>>(pool, std::move(token));
+    pool.post([state, func]() mutable { detail::run_into(*state, func); });
+    return detail::future_access::make(state);
+}
+
+template<typename Func>
+auto spawn(Func func) -> task_future<std::invoke_result_t<Func>>
+{
+    return spawn(thread_pool::default_pool(), std::move(func));
+}
+
+template<typename T>
+task_future<typename std::decay<T>::type> make_ready_future(T&& value)
+{
+    task_promise<typename std::decay<T>::type> promise;
+    promise.set_value(std::forward<T>(value));
+    return promise.get_future();
+}
+
+// Ready once every future is, with the (ready) futures themselves so each can be get() for its result
+// or exception.
+template<typename T>
+task_future<std::vector<task_future<T>>> when_all(std::vector<task_future<T>> futures)
+{
+    typedef std::vector<task_future<T>> futures_type;
+
+    struct context
+    {
+        futures_type futures;
+        std::atomic<std::size_t> remaining;
+        task_promise<futures_type> promise;
+
+        context(futures_type&& futures_, thread_pool& pool) :
+            futures(std::move(futures_)), remaining(futures.size()), promise(pool)
+        {
+        }
+    };
+
+    if (futures.empty())
+        return make_ready_future(futures_type());
+
+    // snapshot the states first - the last to complete moves the futures out
+    std::vector<std::shared_ptr<detail::shared_state<T>>> states;
+    for (auto const& f : futures)
+        states.push_back(detail::future_access::state(f));
+
+    auto const ctx = std::make_shared<context>(std::move(futures), states.front()->pool);
+    task_future<futures_type> result = ctx->promise.get_future();
+
+    for (auto const& s : states)
+    {
+        s->on_ready([ctx]() {
+            if (ctx->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                ctx->promise.set_value(std::move(ctx->futures));
+        });
+    }
+    return result;
+}
+
+template<typename T>
+struct when_any_result
+{
+    std::size_t index; // of the first future to become ready
+    std::vector<task_future<T>> futures;
+};
+
+// Ready once any of the futures is.
+template<typename T>
+task_future<when_any_result<T>> when_any(std::vector<task_future<T>> futures)
+{
+    struct context
+    {
+        when_any_result<T> result;
+        std::atomic<bool> done;
+        task_promise<when_any_result<T>> promise;
+
+        context(std::vector<task_future<T>>&& futures, thread_pool& pool) : done(false), promise(pool)
+        {
+            result.index = 0;
+            result.futures = std::move(futures);
+        }
+    };
+
+    if (futures.empty())
+        throw std::invalid_argument("when_any needs at least one future");
+
+    std::vector<std::shared_ptr<detail::shared_state<T>>> states;
+    for (auto const& f : futures)
+        states.push_back(detail::future_access::state(f));
+
+    auto const ctx = std::make_shared<context>(std::move(futures), states.front()->pool);
+    task_future<when_any_result<T>> result = ctx->promise.get_future();
+
+    for (std::size_t i = 0; i < states.size(); ++i)
+    {
+        states[i]->on_ready([ctx, i]() {
+            if (!ctx->done.exchange(true, std::memory_order_acq_rel))
+            {
+                ctx->result.index = i;
+                ctx->promise.set_value(std::move(ctx->result));
+            }
+        });
+    }
+    return result;
+}
@@ -0,0 +1,564 @@
+#pragma once
+
+// Lock contention profiling.
+// profiled_mutex<Mutex> wraps a mutex (or shared mutex) under a name and records acquisitions, contended
+// acquisitions, wait and hold time histograms and the call sites that waited longest; report_lock_contention
+// prints every live profile, worst total wait first. hierarchical_mutex (see thread/Ch3 Sharing Data.cpp) is
+// built on it, with its hierarchy check kept to _DEBUG builds.
+// Waits are always timed - the clock is only read when a thread actually has to wait - and hold times for one
+// in hold_sample_rate acquisitions. LOCK_PROFILING chooses how acquisitions are counted:
+//   2 (the _DEBUG default) counts every one, a relaxed add on the thread's own counter shard;
+//   1 (the release default) counts one in hold_sample_rate, with its hold time, so an uncontended lock costs
+//     a try_lock and a thread local countdown, and the report's acquisition counts are estimates;
+//   0 leaves profiled_mutex a plain mutex.
+// It changes profiled_mutex's layout, so set it for the whole solution (in every project's preprocessor
+// definitions) or not at all - never in a source file.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "per_thread.h"
+
+#ifndef LOCK_PROFILING
+#ifdef _DEBUG
+#define LOCK_PROFILING 2
+#else
+#define LOCK_PROFILING 1
+#endif
+#endif
+
+// Where a lock was taken - pass LOCK_SITE to profiled_lock_guard or lock() to attribute waits to it.
+struct lock_site
+{
+    char const* file;
+    int line;
+    char const* function;
+};
+
+#define LOCK_SITE (lock_site{ __FILE__, __LINE__, __func__ })
+
+// Power of two buckets of nanoseconds - bucket i counts durations in [2^(i-1), 2^i).
+class latency_histogram
+{
+public:
+    static std::size_t const num_buckets = 40;
+
+    latency_histogram()
+    {
+        reset();
+    }
+
+    latency_histogram(latency_histogram const&) = delete;
+    latency_histogram& operator=(latency_histogram const&) = delete;
+
+    void record(std::uint64_t ns)
+    {
+        std::size_t bucket = 0;
+        while (bucket + 1 < num_buckets && (std::uint64_t(1) << bucket) <= ns)
+            ++bucket;
+
+        buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    std::uint64_t count() const
+    {
+        std::uint64_t n = 0;
+        for (auto const& b : buckets)
+            n += b.load(std::memory_order_relaxed);
+        return n;
+    }
+
+    std::uint64_t total_ns() const
+    {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    // upper bound of the bucket holding the p'th percentile (0 < p <= 100), 0 if empty
+    std::uint64_t percentile_ns(double p) const
+    {
+        std::uint64_t const n = count();
+        if (!n)
+            return 0;
+
+        std::uint64_t const rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(n * p / 100.0 + 0.5));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < num_buckets; ++i)
+        {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::uint64_t(1) << i;
+        }
+        return std::uint64_t(1) << (num_buckets - 1);
+    }
+
+    void reset()
+    {
+        for (auto& b : buckets)
+            b.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::uint64_t> buckets[num_buckets];
+    std::atomic<std::uint64_t> total;
+};
+
+class lock_profile;
+
+namespace detail {
+
+inline std::uint64_t lock_clock_ns()
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// every live profile, so they can be reported without the caller keeping a list
+class lock_profile_registry
+{
+public:
+    static lock_profile_registry& instance()
+    {
+        static lock_profile_registry registry;
+        return registry;
+    }
+
+    void add(lock_profile* profile)
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        profiles.push_back(profile);
+    }
+
+    void remove(lock_profile* profile)
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        profiles.erase(std::remove(profiles.begin(), profiles.end(), profile), profiles.end());
+    }
+
+    template<typename Func>
+    void for_each(Func func)
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        for (lock_profile* profile : profiles)
+            func(*profile);
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<lock_profile*> profiles;
+};
+
+inline void print_ns(std::ostream& os, std::uint64_t ns)
+{
+    if (ns >= 1000000000)
+        os << ns / 1e9 << "s";
+    else if (ns >= 1000000)
+        os << ns / 1e6 << "ms";
+    else if (ns >= 1000)
+        os << ns / 1e3 << "us";
+    else
+        os << ns << "ns";
+}
+
+}  // namespace detail
+
+// Statistics for one named lock.
+class lock_profile
+{
+public:
+    // hold times are timed, and with LOCK_PROFILING 1 acquisitions counted, for one acquisition in this many
+    // (per thread)
+    static unsigned const hold_sample_rate = 64;
+    static std::size_t const top_sites = 5;
+
+    struct site_stats
+    {
+        lock_site site;
+        std::uint64_t waits;
+        std::uint64_t wait_ns;
+    };
+
+    explicit lock_profile(char const* name_) : name(name_)
+    {
+        detail::lock_profile_registry::instance().add(this);
+    }
+
+    ~lock_profile()
+    {
+        detail::lock_profile_registry::instance().remove(this);
+    }
+
+    lock_profile(lock_profile const&) = delete;
+    lock_profile& operator=(lock_profile const&) = delete;
+
+    char const* const name;
+    sharded_counter acquisitions;
+    sharded_counter contended;
+    latency_histogram wait;
+    latency_histogram hold; // sampled
+
+    // true for the acquisitions whose hold time should be timed
+    static bool sample_hold()
+    {
+        thread_local unsigned countdown = 0;
+        if (countdown)
+        {
+            --countdown;
+            return false;
+        }
+        countdown = hold_sample_rate - 1;
+        return true;
+    }
+
+    // Slow path only - the lock was contended.
+    void record_wait(std::uint64_t ns, lock_site const& site)
+    {
+        contended.add();
+        wait.record(ns);
+
+        std::lock_guard<std::mutex> lk(sites_mutex);
+        site_stats& stats = sites[std::make_pair(site.file, site.line)];
+        stats.site = site;
+        ++stats.waits;
+        stats.wait_ns += ns;
+    }
+
+    // call sites by total wait, longest first
+    std::vector<site_stats> worst_sites(std::size_t count = top_sites) const
+    {
+        std::vector<site_stats> result;
+        {
+            std::lock_guard<std::mutex> lk(sites_mutex);
+            for (auto const& entry : sites)
+                result.push_back(entry.second);
+        }
+
+        std::sort(result.begin(), result.end(),
+            [](site_stats const& lhs, site_stats const& rhs) { return lhs.wait_ns > rhs.wait_ns; });
+        if (result.size() > count)
+            result.resize(count);
+        return result;
+    }
+
+    void report(std::ostream& os) const
+    {
+        long long const total = acquisitions.load();
+        long long const waits = contended.load();
+
+        os << name << ": " << (LOCK_PROFILING == 1 ? "about " : "") << total << " acquisitions, " << waits
+           << " contended";
+        if (total)
+            os << " (" << std::min(100.0, 100.0 * waits / total) << "%)";
+        os << "\n";
+
+        if (waits)
+            print_histogram(os, "  wait", wait);
+        if (hold.count())
+            print_histogram(os, "  hold (sampled)", hold);
+
+        for (site_stats const& s : worst_sites())
+        {
+            os << "    " << (s.site.file ? s.site.file : "unknown site") << "(" << s.site.line << ") "
+               << (s.site.function ? s.site.function : "") << ": " << s.waits << " waits, ";
+            detail::print_ns(os, s.wait_ns);
+            os << "\n";
+        }
+    }
+
+    void reset()
+    {
+        acquisitions.reset();
+        contended.reset();
+        wait.reset();
+        hold.reset();
+
+        std::lock_guard<std::mutex> lk(sites_mutex);
+        sites.clear();
+    }
+
+private:
+    mutable std::mutex sites_mutex;
+    std::map<std::pair<char const*, int>, site_stats> sites;
+
+    static void print_histogram(std::ostream& os, char const* label, latency_histogram const& h)
+    {
+        os << label << " total ";
+        detail::print_ns(os, h.total_ns());
+        os << ", p50 <= ";
+        detail::print_ns(os, h.percentile_ns(50));
+        os << ", p99 <= ";
+        detail::print_ns(os, h.percentile_ns(99));
+        os << ", max <= ";
+        detail::print_ns(os, h.percentile_ns(100));
+        os << "\n";
+    }
+};
+
+// Prints every live lock profile, worst total wait first.
+inline void report_lock_contention(std::ostream& os = std::cout)
+{
+    std::vector<lock_profile const*> profiles;
+    detail::lock_profile_registry::instance().for_each(
+        [&profiles](lock_profile const& profile) { profiles.push_back(&profile); });
+
+    std::sort(profiles.begin(), profiles.end(), [](lock_profile const* lhs, lock_profile const* rhs) {
+        return lhs->wait.total_ns() > rhs->wait.total_ns();
+    });
+
+    for (lock_profile const* profile : profiles)
+        profile->report(os);
+}
+
+// Named, instrumented Mutex. Meets the Lockable requirements (and SharedLockable if Mutex does), so it works
+// with std::lock_guard, std::unique_lock and std::lock; waits through those are attributed to an unknown site.
+// Use std::condition_variable_any to wait on it.
+// Shared acquisitions are counted and their waits timed, but hold times are only sampled for exclusive ones.
+template<typename Mutex = std::mutex>
+class profiled_mutex
+{
+public:
+    explicit profiled_mutex(char const* name)
+#if LOCK_PROFILING
+        : profile(name), hold_start(0)
+#endif
+    {
+        (void)name;
+    }
+
+    profiled_mutex(profiled_mutex const&) = delete;
+    profiled_mutex& operator=(profiled_mutex const&) = delete;
+
+    void lock()
+    {
+        lock(lock_site{ nullptr, 0, nullptr });
+    }
+
+    void lock(lock_site const& site)
+    {
+#if LOCK_PROFILING
+        if (!internal_mutex.try_lock())
+        {
+            std::uint64_t const start = detail::lock_clock_ns();
+            internal_mutex.lock();
+            profile.record_wait(detail::lock_clock_ns() - start, site);
+        }
+        acquired();
+#else
+        (void)site;
+        internal_mutex.lock();
+#endif
+    }
+
+    bool try_lock()
+    {
+        if (!internal_mutex.try_lock())
+            return false;
+#if LOCK_PROFILING
+        acquired();
+#endif
+        return true;
+    }
+
+    void unlock()
+    {
+#if LOCK_PROFILING
+        if (hold_start)
+        {
+            profile.hold.record(detail::lock_clock_ns() - hold_start);
+            hold_start = 0;
+        }
+#endif
+        internal_mutex.unlock();
+    }
+
+    void lock_shared()
+    {
+        lock_shared(lock_site{ nullptr, 0, nullptr });
+    }
+
+    void lock_shared(lock_site const& site)
+    {
+#if LOCK_PROFILING
+        if (!internal_mutex.try_lock_shared())
+        {
+            std::uint64_t const start = detail::lock_clock_ns();
+            internal_mutex.lock_shared();
+            profile.record_wait(detail::lock_clock_ns() - start, site);
+        }
+        acquired_shared();
+#else
+        (void)site;
+        internal_mutex.lock_shared();
+#endif
+    }
+
+    bool try_lock_shared()
+    {
+        if (!internal_mutex.try_lock_shared())
+            return false;
+#if LOCK_PROFILING
+        acquired_shared();
+#endif
+        return true;
+    }
+
+    void unlock_shared()
+    {
+        internal_mutex.unlock_shared();
+    }
+
+#if LOCK_PROFILING
+    lock_profile const& stats() const
+    {
+        return profile;
+    }
+#endif
+
+private:
+    Mutex internal_mutex;
+
+#if LOCK_PROFILING
+    lock_profile profile;
+    std::uint64_t hold_start; // only touched by the owner, 0 unless this hold is sampled
+
+    void acquired()
+    {
+#if LOCK_PROFILING >= 2
+        profile.acquisitions.add();
+        if (lock_profile::sample_hold())
+            hold_start = detail::lock_clock_ns();
+#else
+        if (lock_profile::sample_hold())
+        {
+            profile.acquisitions.add(lock_profile::hold_sample_rate);
+            hold_start = detail::lock_clock_ns();
+        }
+#endif
+    }
+
+    void acquired_shared()
+    {
+#if LOCK_PROFILING >= 2
+        profile.acquisitions.add();
+#else
+        if (lock_profile::sample_hold())
+            profile.acquisitions.add(lock_profile::hold_sample_rate);
+#endif
+    }
+#endif
+};
+
+// Lock hierarchy (thread/Ch3 Sharing Data.cpp) over a profiled_mutex. Locking a mutex whose value isn't
+// below every value the thread already holds throws std::logic_error - checked in _DEBUG builds only, so
+// release builds pay just for the profiling.
+class hierarchical_mutex
+{
+public:
+    hierarchical_mutex(char const* name, unsigned long value) :
+        internal_mutex(name),
+        hierarchy_value(value),
+        previous_hierarchy_value(0)
+    {
+        (void)hierarchy_value;
+    }
+
+    hierarchical_mutex(hierarchical_mutex const&) = delete;
+    hierarchical_mutex& operator=(hierarchical_mutex const&) = delete;
+
+    void lock()
+    {
+        lock(lock_site{ nullptr, 0, nullptr });
+    }
+
+    void lock(lock_site const& site)
+    {
+        check_for_hierarchy_violation();
+        internal_mutex.lock(site);
+        update_hierarchy_value();
+    }
+
+    void unlock()
+    {
+#ifdef _DEBUG
+        this_thread_hierarchy_value() = previous_hierarchy_value;
+#endif
+        internal_mutex.unlock();
+    }
+
+    bool try_lock()
+    {
+        check_for_hierarchy_violation();
+        if (!internal_mutex.try_lock())
+            return false;
+        update_hierarchy_value();
+        return true;
+    }
+
+#if LOCK_PROFILING
+    lock_profile const& stats() const
+    {
+        return internal_mutex.stats();
+    }
+#endif
+
+private:
+    profiled_mutex<std::mutex> internal_mutex;
+    unsigned long const hierarchy_value;
+    unsigned long previous_hierarchy_value;
+
+    // function local rather than a static member so the header needs no definition in a .cpp
+    static unsigned long& this_thread_hierarchy_value()
+    {
+        thread_local unsigned long value = ULONG_MAX;
+        return value;
+    }
+
+    void check_for_hierarchy_violation()
+    {
+#ifdef _DEBUG
+        if (this_thread_hierarchy_value() <= hierarchy_value)
+            throw std::logic_error("mutex hierarchy violated");
+#endif
+    }
+
+    void update_hierarchy_value()
+    {
+#ifdef _DEBUG
+        previous_hierarchy_value = this_thread_hierarchy_value();
+        this_thread_hierarchy_value() = hierarchy_value;
+#endif
+    }
+};
+
+// lock_guard that attributes any wait to a call site: profiled_lock_guard<...> lk(m, LOCK_SITE);
+template<typename Mutex>
+class profiled_lock_guard
+{
+public:
+    profiled_lock_guard(Mutex& m_, lock_site const& site) : m(m_)
+    {
+        m.lock(site);
+    }
+
+    ~profiled_lock_guard()
+    {
+        m.unlock();
+    }
+
+    profiled_lock_guard(profiled_lock_guard const&) = delete;
+    profiled_lock_guard& operator=(profiled_lock_guard const&) = delete;
+
+private:
+    Mutex& m;
+};
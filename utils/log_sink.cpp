@@ -0,0 +1,291 @@
+// log_sink.cpp : the log_sink writer thread and per-thread rings.
+//
+
+#include "stdafx.h"
+
+#include "log_sink.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "atomic_wait.h"
+#include "spsc_queue.h"
+
+namespace {
+
+// bytes a thread can have queued before it waits for the writer
+std::size_t const ring_size = 64 * 1024;
+
+// One per thread per sink. The thread owns line; the writer owns partial.
+struct producer
+{
+    spsc_queue<char, true> ring;
+    std::string line;          // the thread's unfinished line
+    std::string partial;       // start of a line the writer has only part of
+    std::atomic<bool> exited;  // the thread has gone - remove once drained
+    std::atomic<bool> closed;  // the sink has gone - the thread drops it
+
+    producer() : ring(ring_size), exited(false), closed(false)
+    {
+    }
+};
+
+// Identifies a sink for thread_producers; a sink's address can be reused by the next one.
+std::atomic<std::uint64_t> next_sink_id(0);
+
+// The calling thread's producers, by sink id, released (and marked exited) when the thread ends.
+struct thread_producers
+{
+    std::vector<std::pair<std::uint64_t, std::shared_ptr<producer>>> entries;
+
+    ~thread_producers()
+    {
+        for (auto& entry : entries)
+            entry.second->exited.store(true, std::memory_order_release);
+    }
+};
+
+thread_producers& this_thread_producers()
+{
+    thread_local thread_producers producers;
+    return producers;
+}
+
+}  // namespace
+
+struct log_sink::state
+{
+    std::ostream& os;
+    std::uint64_t const id;
+
+    std::mutex producers_mutex;
+    std::vector<std::shared_ptr<producer>> producers;
+    std::atomic<std::uint64_t> producers_version;
+
+    std::atomic<std::uint64_t> submitted; // lines sent by producers
+    std::atomic<std::uint64_t> written;   // lines written and flushed
+    std::atomic<std::uint64_t> flush_wanted; // the largest target of a flush() call
+    std::atomic<bool> stopping;
+    event_count work;                     // the writer waits for lines
+    event_count done;                     // flush() waits for the writer
+
+    std::thread writer;
+
+    explicit state(std::ostream& os_) :
+        os(os_), id(next_sink_id.fetch_add(1, std::memory_order_relaxed)), producers_version(0), submitted(0), written(0), flush_wanted(0), stopping(false)
+    {
+    }
+
+    producer& local()
+    {
+        thread_producers& mine = this_thread_producers();
+        for (auto const& entry : mine.entries)
+        {
+            if (entry.first == id)
+                return *entry.second;
+        }
+
+        // not written to this sink before - a good time to let go of the rings of sinks that have gone
+        mine.entries.erase(std::remove_if(mine.entries.begin(), mine.entries.end(),
+            [](std::pair<std::uint64_t, std::shared_ptr<producer>> const& entry) {
+                return entry.second->closed.load(std::memory_order_acquire);
+            }), mine.entries.end());
+
+        auto const p = std::make_shared<producer>();
+        {
+            std::lock_guard<std::mutex> lk(producers_mutex);
+            producers.push_back(p);
+        }
+        producers_version.fetch_add(1, std::memory_order_release);
+        mine.entries.push_back(std::make_pair(id, p));
+        return *p;
+    }
+
+    // Sends the complete lines at the front of p.line.
+    void send(producer& p)
+    {
+        std::size_t const end = p.line.rfind('\n');
+        if (end == std::string::npos)
+            return;
+
+        std::uint64_t const lines = static_cast<std::uint64_t>(std::count(p.line.begin(), p.line.begin() + end + 1, '\n'));
+        p.ring.push_all(p.line.data(), end + 1);
+        p.line.erase(0, end + 1);
+
+        submitted.fetch_add(lines, std::memory_order_release);
+        work.notify_one();
+    }
+
+    // Moves whatever p's ring holds into batch, keeping back any unfinished line. Returns the lines moved.
+    static std::uint64_t drain(producer& p, std::string& batch, std::vector<char>& scratch)
+    {
+        std::uint64_t lines = 0;
+        for (;;)
+        {
+            std::size_t const n = p.ring.pop_n(scratch.data(), scratch.size());
+            if (!n)
+                return lines;
+
+            char const* const first = scratch.data();
+            char const* const last = first + n;
+            char const* const end = std::find(std::make_reverse_iterator(last), std::make_reverse_iterator(first), '\n').base();
+            if (end == first)
+            {
+                p.partial.append(first, last);
+                continue;
+            }
+
+            lines += static_cast<std::uint64_t>(std::count(first, end, '\n'));
+            batch += p.partial;
+            batch.append(first, end);
+            p.partial.assign(end, last);
+        }
+    }
+
+    void run()
+    {
+        std::vector<std::shared_ptr<producer>> snapshot;
+        std::uint64_t snapshot_version = ~std::uint64_t(0);
+        std::vector<char> scratch(ring_size);
+        std::string batch;
+        std::uint64_t lines_written = 0;
+
+        for (;;)
+        {
+            // every line counted here is in a ring this pass drains: submitted goes up after the push, and a
+            // new producer is listed before its first push
+            std::uint64_t const covered = submitted.load(std::memory_order_acquire);
+            std::uint64_t const version = producers_version.load(std::memory_order_acquire);
+            if (version != snapshot_version)
+            {
+                std::lock_guard<std::mutex> lk(producers_mutex);
+                snapshot = producers;
+                snapshot_version = version;
+            }
+
+            std::uint64_t lines = 0;
+            for (auto const& p : snapshot)
+                lines += drain(*p, batch, scratch);
+
+            if (lines)
+            {
+                os.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+                batch.clear();
+                lines_written += lines;
+            }
+
+            // flush when dry, or as soon as a pass has covered what a flush() caller waits for
+            std::uint64_t const published = written.load(std::memory_order_relaxed);
+            if (!lines || flush_wanted.load(std::memory_order_acquire) > published)
+            {
+                os.flush();
+                if (covered > published)
+                    written.store(covered, std::memory_order_release);
+                done.notify_all();
+            }
+            if (lines)
+                continue;
+
+            // ran dry - drop the rings of threads that have gone
+            remove_exited();
+
+            if (stopping.load(std::memory_order_acquire) &&
+                submitted.load(std::memory_order_acquire) == lines_written)
+                return;
+
+            work.wait_until([&] {
+                return submitted.load(std::memory_order_acquire) != lines_written ||
+                    stopping.load(std::memory_order_acquire) ||
+                    producers_version.load(std::memory_order_acquire) != snapshot_version ||
+                    flush_wanted.load(std::memory_order_acquire) > written.load(std::memory_order_relaxed);
+            });
+        }
+    }
+
+    // A thread that exited mid-line left its last line unfinished; it's written as it is.
+    void remove_exited()
+    {
+        std::vector<std::shared_ptr<producer>> gone;
+        {
+            std::lock_guard<std::mutex> lk(producers_mutex);
+            auto const first_gone = std::stable_partition(producers.begin(), producers.end(),
+                [](std::shared_ptr<producer> const& p) {
+                    return !p->exited.load(std::memory_order_acquire) || !p->ring.empty();
+                });
+            gone.assign(first_gone, producers.end());
+            producers.erase(first_gone, producers.end());
+        }
+        if (gone.empty())
+            return;
+
+        producers_version.fetch_add(1, std::memory_order_release);
+        for (auto const& p : gone)
+            write_unfinished(*p);
+        os.flush();
+    }
+
+    void write_unfinished(producer& p)
+    {
+        if (!p.partial.empty() || !p.line.empty())
+            os << p.partial << p.line << '\n';
+    }
+};
+
+log_sink::log_sink(std::ostream& os) : impl(new state(os))
+{
+    impl->writer = std::thread(&state::run, impl.get());
+}
+
+log_sink::~log_sink()
+{
+    impl->stopping.store(true, std::memory_order_release);
+    impl->work.notify_all();
+    impl->writer.join();
+
+    // and whatever the remaining threads left unfinished
+    std::lock_guard<std::mutex> lk(impl->producers_mutex);
+    for (auto const& p : impl->producers)
+    {
+        impl->write_unfinished(*p);
+        p->closed.store(true, std::memory_order_release);
+    }
+    impl->os.flush();
+}
+
+void log_sink::write(std::string_view text)
+{
+    producer& p = impl->local();
+    p.line.append(text.data(), text.size());
+    impl->send(p);
+}
+
+void log_sink::write(result_record const& record)
+{
+    log_stream line(*this);
+    line << "problem=" << record.problem << " impl=" << record.impl << " result=" << record.result
+        << " seconds=" << record.seconds << '\n';
+}
+
+void log_sink::flush()
+{
+    std::uint64_t const target = impl->submitted.load(std::memory_order_acquire);
+    std::uint64_t wanted = impl->flush_wanted.load(std::memory_order_relaxed);
+    while (wanted < target && !impl->flush_wanted.compare_exchange_weak(wanted, target, std::memory_order_release))
+    {
+    }
+    impl->work.notify_one();
+    impl->done.wait_until([&] { return impl->written.load(std::memory_order_acquire) >= target; });
+}
+
+log_sink& default_log_sink()
+{
+    static log_sink sink(std::cout);
+    return sink;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+// Asynchronous, line-atomic output.
+// Writing to std::cout with std::endl flushes every line, interleaves the output of concurrent threads
+// mid-line and makes the writer wait for the console. A log_sink gives each writing thread its own wait free
+// ring (spsc_queue.h); text builds up in the thread's current line and only whole lines go into the ring, and
+// one background thread drains every ring into the stream in batches, flushing when it runs dry. So a thread
+// only waits if its ring fills faster than the stream can take it, and lines from different threads never mix.
+// Lines from one thread keep their order; lines from different threads are only ordered by when they finish.
+// The sink and its rings live in utils.dll (log_sink.cpp), so Print (inline in the caller) and Profile (in
+// the DLL) share one sink and one line per thread. Mixing direct std::cout output with the default sink
+// reorders it - write through out() instead, or flush() first.
+// Profile and Record flush the default sink before returning. Nothing may be left queued at exit: on Windows
+// ExitProcess kills the writer thread before utils.dll's statics are destroyed, so ~log_sink can't drain the
+// rings then - code writing through out() outside them should flush() before main returns.
+
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+// problem, implementation, result and time as one line:
+//   problem=p1 impl=Optimised result=233168 seconds=1.2e-06
+struct result_record
+{
+    std::string_view problem;
+    std::string_view impl;
+    std::string_view result;
+    double seconds;
+};
+
+class __declspec(dllexport) log_sink
+{
+public:
+    // os must outlive the sink.
+    explicit log_sink(std::ostream& os);
+
+    // Writes everything still queued, then stops the writer thread.
+    ~log_sink();
+
+    log_sink(log_sink const&) = delete;
+    log_sink& operator=(log_sink const&) = delete;
+
+    // Appends text to the calling thread's current line; each '\n' sends the line on.
+    void write(std::string_view text);
+
+    void write(result_record const& record);
+
+    // Waits until every line finished before the call (on any thread) is written and the stream flushed.
+    void flush();
+
+private:
+    struct state;
+    std::unique_ptr<state> impl;
+};
+
+// Writes to std::cout.
+__declspec(dllexport) log_sink& default_log_sink();
+
+namespace detail {
+
+// Calls emit with value as text: integers exactly, floating point as std::cout shows it by default (6
+// significant digits), both by std::to_chars; anything else through its operator<<.
+template<typename T, typename Emit>
+void format_text(T const& value, Emit emit)
+{
+    if constexpr (std::is_integral<T>::value)
+    {
+        char digits[24];
+        std::to_chars_result const r = std::to_chars(digits, digits + sizeof(digits), value);
+        emit(std::string_view(digits, static_cast<std::size_t>(r.ptr - digits)));
+    }
+    else if constexpr (std::is_floating_point<T>::value)
+    {
+        char digits[32];
+        std::to_chars_result const r = std::to_chars(digits, digits + sizeof(digits), value,
+            std::chars_format::general, 6);
+        emit(std::string_view(digits, static_cast<std::size_t>(r.ptr - digits)));
+    }
+    else
+    {
+        std::ostringstream formatted;
+        formatted << value;
+        emit(std::string_view(formatted.str()));
+    }
+}
+
+}  // namespace detail
+
+template<typename T>
+std::string to_text(T const& value)
+{
+    std::string text;
+    detail::format_text(value, [&text](std::string_view formatted) { text.assign(formatted); });
+    return text;
+}
+
+// Formats into a small buffer with std::to_chars and hands it to the sink in one write when the statement
+// ends, eg out() << "Result is " << result << '\n';
+class log_stream
+{
+public:
+    explicit log_stream(log_sink& sink_) : sink(sink_), used(0)
+    {
+    }
+
+    ~log_stream()
+    {
+        spill();
+    }
+
+    log_stream(log_stream const&) = delete;
+    log_stream& operator=(log_stream const&) = delete;
+
+    log_stream& operator<<(std::string_view text)
+    {
+        if (text.size() > sizeof(buffer) - used)
+        {
+            spill();
+            if (text.size() > sizeof(buffer))
+            {
+                sink.write(text);
+                return *this;
+            }
+        }
+        std::memcpy(buffer + used, text.data(), text.size());
+        used += text.size();
+        return *this;
+    }
+
+    log_stream& operator<<(char const* text)
+    {
+        return *this << std::string_view(text);
+    }
+
+    log_stream& operator<<(std::string const& text)
+    {
+        return *this << std::string_view(text);
+    }
+
+    log_stream& operator<<(char c)
+    {
+        return *this << std::string_view(&c, 1);
+    }
+
+    log_stream& operator<<(bool value)
+    {
+        return *this << (value ? "1" : "0");
+    }
+
+    template<typename T>
+    log_stream& operator<<(T const& value)
+    {
+        detail::format_text(value, [this](std::string_view text) { *this << text; });
+        return *this;
+    }
+
+private:
+    log_sink& sink;
+    char buffer[256];
+    std::size_t used;
+
+    void spill()
+    {
+        if (used)
+            sink.write(std::string_view(buffer, used));
+        used = 0;
+    }
+};
+
+inline log_stream out()
+{
+    return log_stream(default_log_sink());
+}
@@ -0,0 +1,164 @@
+// mapped_file.cpp : memory mapped files for mapped_file.h.
+//
+
+#include "stdafx.h"
+
+#include "mapped_file.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct mapped_file::mapping
+{
+    std::string path;
+    bool writable;
+    std::uint64_t size;
+    unsigned char* view;
+#if defined(_WIN32)
+    HANDLE file;
+    HANDLE section;
+#endif
+
+    // size is only used when writable - a read-only mapping is the size of the file.
+    mapping(std::string const& path_, bool writable_, std::uint64_t size_) :
+        path(path_), writable(writable_), size(size_), view(nullptr)
+    {
+#if defined(_WIN32)
+        file = CreateFileA(path.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, nullptr,
+            writable ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            throw mapped_file_error("can't open " + path);
+
+        LARGE_INTEGER length;
+        if (writable)
+            length.QuadPart = static_cast<LONGLONG>(size);
+        else if (GetFileSizeEx(file, &length))
+            size = static_cast<std::uint64_t>(length.QuadPart);
+        else
+        {
+            CloseHandle(file);
+            throw mapped_file_error("can't size " + path);
+        }
+
+        section = nullptr;
+        if (size)
+        {
+            section = CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, length.HighPart,
+                length.LowPart, nullptr);
+            if (section)
+                view = static_cast<unsigned char*>(MapViewOfFile(section, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+            if (!view)
+            {
+                if (section)
+                    CloseHandle(section);
+                CloseHandle(file);
+                throw mapped_file_error("can't map " + path);
+            }
+        }
+#else
+        int const fd = writable ? ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw mapped_file_error("can't open " + path);
+
+        struct stat status;
+        bool const sized = writable ? ftruncate(fd, static_cast<off_t>(size)) == 0 : fstat(fd, &status) == 0;
+        if (!sized)
+        {
+            ::close(fd);
+            throw mapped_file_error("can't size " + path);
+        }
+        if (!writable)
+            size = static_cast<std::uint64_t>(status.st_size);
+
+        if (size)
+        {
+            void* const mapped_view = mmap(nullptr, static_cast<std::size_t>(size), writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                MAP_SHARED, fd, 0);
+            if (mapped_view == MAP_FAILED)
+            {
+                ::close(fd);
+                throw mapped_file_error("can't map " + path);
+            }
+            view = static_cast<unsigned char*>(mapped_view);
+        }
+        ::close(fd);
+#endif
+    }
+
+    ~mapping()
+    {
+#if defined(_WIN32)
+        if (view)
+            UnmapViewOfFile(view);
+        if (section)
+            CloseHandle(section);
+        CloseHandle(file);
+#else
+        if (view)
+            munmap(view, static_cast<std::size_t>(size));
+#endif
+    }
+};
+
+mapped_file::mapped_file(std::unique_ptr<mapping> mapped_) : mapped(std::move(mapped_))
+{
+}
+
+mapped_file::~mapped_file()
+{
+}
+
+std::unique_ptr<mapped_file> mapped_file::create(std::string const& path, std::uint64_t size)
+{
+    return std::unique_ptr<mapped_file>(new mapped_file(std::make_unique<mapping>(path, true, size)));
+}
+
+std::unique_ptr<mapped_file> mapped_file::open(std::string const& path)
+{
+    return std::unique_ptr<mapped_file>(new mapped_file(std::make_unique<mapping>(path, false, 0)));
+}
+
+unsigned char* mapped_file::data()
+{
+    return mapped->view;
+}
+
+unsigned char const* mapped_file::data() const
+{
+    return mapped->view;
+}
+
+std::uint64_t mapped_file::size() const
+{
+    return mapped->size;
+}
+
+bool mapped_file::writable() const
+{
+    return mapped->writable;
+}
+
+void mapped_file::flush()
+{
+    if (!mapped->writable || !mapped->view)
+        return;
+#if defined(_WIN32)
+    bool const flushed = FlushViewOfFile(mapped->view, 0) && FlushFileBuffers(mapped->file);
+#else
+    bool const flushed = msync(mapped->view, static_cast<std::size_t>(mapped->size), MS_SYNC) == 0;
+#endif
+    if (!flushed)
+        throw mapped_file_error("can't write back " + mapped->path);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+// A file mapped into memory, for tables bigger than the heap should hold or worth keeping between runs (see
+// sieve.h). Pages are read and written back by the OS as they're touched, so a table can be filled in place,
+// segment by segment from several threads, and later opened and used without reading it in first.
+// POSIX open and mmap, or CreateFileMapping and MapViewOfFile on Windows.
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+class mapped_file_error : public std::runtime_error
+{
+public:
+    explicit mapped_file_error(std::string const& what) : std::runtime_error(what)
+    {
+    }
+};
+
+class __declspec(dllexport) mapped_file
+{
+public:
+    // Creates path, replacing any file there, size bytes long (zero filled) and mapped read-write.
+    static std::unique_ptr<mapped_file> create(std::string const& path, std::uint64_t size);
+
+    // Maps an existing file read-only.
+    static std::unique_ptr<mapped_file> open(std::string const& path);
+
+    // Unmaps, writing back any changes.
+    ~mapped_file();
+
+    mapped_file(mapped_file const&) = delete;
+    mapped_file& operator=(mapped_file const&) = delete;
+
+    unsigned char* data();
+    unsigned char const* data() const;
+    std::uint64_t size() const;
+    bool writable() const;
+
+    // Writes changes back to the file now, waiting until they're written.
+    void flush();
+
+private:
+    struct mapping;
+    std::unique_ptr<mapping> mapped;
+
+    explicit mapped_file(std::unique_ptr<mapping> mapped_);
+};
@@ -0,0 +1,310 @@
+#pragma once
+
+// Memoising pure functions across threads.
+// concurrent_cache maps keys to values computed on demand. It is striped: keys hash to shards, each with its
+// own adaptive_mutex, index and slots, so threads working on different keys rarely meet. Its size is
+// bounded per shard - capacity is split evenly between them, so keys that hash unevenly are evicted before
+// the cache as a whole is full; leave headroom (or use fewer shards) for a working set that must all stay.
+// A full shard evicts by CLOCK (a hand sweeps the slots, sparing any used since its last pass, once), which
+// approximates LRU without reordering anything on a hit.
+// Misses are single flight: the first thread to miss on a key computes it outside the lock, and threads
+// missing on the same key meanwhile wait for that result (event_flag, see adaptive_sync.h) rather than
+// computing it again. If the computation throws, every waiter gets the exception and the key is forgotten,
+// so the next call tries again.
+// memoized<R(Args...)> wraps a function in a cache keyed on its arguments, eg
+//   memoized<long long(long long, long long)> sum(&SumDivisibleBy<long long>);
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "adaptive_sync.h"
+#include "per_thread.h"
+#include "topology.h"
+
+struct cache_stats
+{
+    std::uint64_t hits = 0;        // found computed
+    std::uint64_t waits = 0;       // found being computed by another thread, and waited for it
+    std::uint64_t misses = 0;      // computed
+    std::uint64_t evictions = 0;
+    std::size_t size = 0;
+
+    double hit_rate() const
+    {
+        std::uint64_t const lookups = hits + waits + misses;
+        return lookups ? static_cast<double>(hits + waits) / static_cast<double>(lookups) : 0.0;
+    }
+
+    // eg 950 hits, 12 waits, 38 misses (96.2% hit), 6 evictions, 32 entries
+    void describe(std::ostream& os) const
+    {
+        os << hits << " hits, " << waits << " waits, " << misses << " misses (" << hit_rate() * 100 << "% hit), "
+            << evictions << " evictions, " << size << " entries\n";
+    }
+};
+
+namespace detail {
+
+// Combines std::hash of each element of a tuple.
+struct tuple_hash
+{
+    template<typename... T>
+    std::size_t operator()(std::tuple<T...> const& key) const
+    {
+        std::size_t seed = 0;
+        std::apply([&seed](auto const&... element) {
+            ((seed ^= std::hash<std::decay_t<decltype(element)>>()(element) + 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2)), ...);
+        }, key);
+        return seed;
+    }
+};
+
+}  // namespace detail
+
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class concurrent_cache
+{
+public:
+    // capacity is shared evenly between the shards, each evicting once its own share is full; num_shards is
+    // rounded up to a power of two (0 for four per hardware thread).
+    explicit concurrent_cache(std::size_t capacity = 4096, std::size_t num_shards = 0) :
+        shard_bits(bits_for(num_shards ? num_shards : 4 * cpu_topology::host().logical_count())),
+        shard_capacity(std::max<std::size_t>(capacity >> shard_bits, 1))
+    {
+        for (std::size_t i = 0; i < (std::size_t(1) << shard_bits); ++i)
+            shards.emplace_back(new shard());
+    }
+
+    concurrent_cache(concurrent_cache const&) = delete;
+    concurrent_cache& operator=(concurrent_cache const&) = delete;
+
+    // Returns key's value, calling compute() for it if it isn't cached or being computed already.
+    template<typename Compute>
+    Value get_or_compute(Key const& key, Compute compute)
+    {
+        shard& s = shard_for(key);
+        std::shared_ptr<flight> result;
+        std::size_t slot_index = 0;
+        bool computing = false;
+        {
+            std::lock_guard<adaptive_mutex> lk(s.mutex);
+            auto const found = s.index.find(key);
+            if (found != s.index.end())
+            {
+                slot& hit = s.slots[found->second];
+                hit.referenced = true;
+                result = hit.result;
+                ++(result->ready.is_set() ? s.stats.hits : s.stats.waits);
+            }
+            else
+            {
+                ++s.stats.misses;
+                result = std::make_shared<flight>();
+                slot_index = insert(s, key, result);
+                computing = true;
+            }
+        }
+
+        if (computing)
+        {
+            try
+            {
+                result->value.emplace(compute());
+            }
+            catch (...)
+            {
+                result->error = std::current_exception();
+                std::lock_guard<adaptive_mutex> lk(s.mutex);
+                forget(s, key, slot_index);
+            }
+            result->ready.set();
+        }
+        else
+            result->ready.wait();
+
+        if (result->error)
+            std::rethrow_exception(result->error);
+        return *result->value;
+    }
+
+    cache_stats stats() const
+    {
+        cache_stats total;
+        for (auto const& s : shards)
+        {
+            std::lock_guard<adaptive_mutex> lk(s->mutex);
+            total.hits += s->stats.hits;
+            total.waits += s->stats.waits;
+            total.misses += s->stats.misses;
+            total.evictions += s->stats.evictions;
+            total.size += s->index.size();
+        }
+        return total;
+    }
+
+    // Drops every computed entry (those being computed finish, uncached) and zeroes the statistics.
+    void clear()
+    {
+        for (auto& s : shards)
+        {
+            std::lock_guard<adaptive_mutex> lk(s->mutex);
+            s->index.clear();
+            s->slots.clear();
+            s->hand = 0;
+            s->stats = shard_stats();
+        }
+    }
+
+private:
+    // a value being computed, or computed
+    struct flight
+    {
+        event_flag ready;
+        std::optional<Value> value;
+        std::exception_ptr error;
+    };
+
+    struct slot
+    {
+        Key key;
+        std::shared_ptr<flight> result;
+        bool referenced;    // used since the clock hand last passed
+    };
+
+    struct shard_stats
+    {
+        std::uint64_t hits = 0;
+        std::uint64_t waits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+    };
+
+    // padded so neighbouring shards' locks don't share a line
+    struct shard
+    {
+        mutable adaptive_mutex mutex;
+        std::unordered_map<Key, std::size_t, Hash> index;  // slot of each key
+        std::vector<slot> slots;
+        std::size_t hand = 0;
+        shard_stats stats;
+        char padding[cache_line_size];
+    };
+
+    unsigned const shard_bits;
+    std::size_t const shard_capacity;
+    std::vector<std::unique_ptr<shard>> shards;
+    Hash const hasher = Hash();
+
+    static unsigned bits_for(std::size_t num_shards)
+    {
+        unsigned bits = 0;
+        while ((std::size_t(1) << bits) < num_shards)
+            ++bits;
+        return bits;
+    }
+
+    shard& shard_for(Key const& key)
+    {
+        // multiplicative hash so the shard takes the high bits, leaving the low ones for the index
+        std::uint64_t const mixed = static_cast<std::uint64_t>(hasher(key)) * 0x9E3779B97F4A7C15ull;
+        return *shards[shard_bits ? static_cast<std::size_t>(mixed >> (64 - shard_bits)) : 0];
+    }
+
+    // Adds key to s, evicting by CLOCK if s is full, and returns its slot. Slots still being computed are
+    // never evicted - if that's all of them, s grows past its capacity.
+    std::size_t insert(shard& s, Key const& key, std::shared_ptr<flight> const& result)
+    {
+        std::size_t victim = s.slots.size();
+        if (s.slots.size() >= shard_capacity)
+        {
+            for (std::size_t step = 0; step < 2 * s.slots.size(); ++step)
+            {
+                slot& candidate = s.slots[s.hand];
+                std::size_t const position = s.hand;
+                s.hand = (s.hand + 1) % s.slots.size();
+
+                if (candidate.referenced)
+                    candidate.referenced = false;
+                else if (candidate.result->ready.is_set())
+                {
+                    victim = position;
+                    break;
+                }
+            }
+        }
+
+        if (victim == s.slots.size())
+            s.slots.push_back(slot{ key, result, false });
+        else
+        {
+            forget(s, s.slots[victim].key, victim);
+            ++s.stats.evictions;
+            s.slots[victim] = slot{ key, result, false };
+        }
+        s.index[key] = victim;
+        return victim;
+    }
+
+    // Removes key from the index if it's still in slot position, which is left for the clock to reuse.
+    static void forget(shard& s, Key const& key, std::size_t position)
+    {
+        auto const found = s.index.find(key);
+        if (found != s.index.end() && found->second == position)
+            s.index.erase(found);
+    }
+};
+
+template<typename Signature>
+class memoized;
+
+template<typename R, typename... Args>
+class memoized<R(Args...)>
+{
+public:
+    typedef std::tuple<std::decay_t<Args>...> key_type;
+
+    template<typename Func>
+    explicit memoized(Func func_, std::size_t capacity = 4096, std::size_t num_shards = 0) :
+        func(std::move(func_)),
+        cache(capacity, num_shards)
+    {
+    }
+
+    R operator()(Args const&... args)
+    {
+        return cache.get_or_compute(key_type(args...), [&]() { return func(args...); });
+    }
+
+    cache_stats stats() const
+    {
+        return cache.stats();
+    }
+
+    void clear()
+    {
+        cache.clear();
+    }
+
+private:
+    std::function<R(Args...)> func;
+    concurrent_cache<key_type, R, detail::tuple_hash> cache;
+};
+
+// Memoises a function pointer, eg auto sum = memoize(&SumDivisibleBy<long long>);
+template<typename R, typename... Args>
+memoized<R(Args...)> memoize(R (*func)(Args...), std::size_t capacity = 4096)
+{
+    return memoized<R(Args...)>(func, capacity);
+}
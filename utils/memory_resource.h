@@ -0,0 +1,298 @@
+#pragma once
+
+// Memory resources for std::pmr containers.
+// Node based containers (std::list, std::set, std::stack's deque, shared_ptr control blocks) allocate on
+// nearly every operation. arena_resource hands out memory by bumping a pointer and frees nothing until it's
+// reset, so a whole problem run can allocate from one arena and drop it all at once; pool_resource recycles
+// fixed size blocks through per-thread free lists, for concurrent containers whose nodes are freed and
+// reallocated as they go.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+
+#include "per_thread.h"
+
+// Monotonic arena - not thread safe, one per thread or per problem run.
+// Chunks are taken from upstream, each twice the size of the one before; deallocate does nothing.
+class arena_resource : public std::pmr::memory_resource
+{
+public:
+    explicit arena_resource(std::size_t initial_size = 64 * 1024,
+        std::pmr::memory_resource* upstream_ = std::pmr::new_delete_resource()) :
+        upstream(upstream_),
+        first(nullptr),
+        current(nullptr),
+        ptr(nullptr),
+        end(nullptr),
+        next_size(std::max<std::size_t>(initial_size, 1024))
+    {
+    }
+
+    ~arena_resource()
+    {
+        release();
+    }
+
+    arena_resource(arena_resource const&) = delete;
+    arena_resource& operator=(arena_resource const&) = delete;
+
+    // Makes all the memory reusable in O(1), keeping the chunks - everything allocated so far is invalidated.
+    void reset()
+    {
+        current = first;
+        if (current)
+            enter(current);
+    }
+
+    // Returns every chunk upstream.
+    void release()
+    {
+        while (first)
+        {
+            chunk* const next = first->next;
+            upstream->deallocate(first, first->size, alignof(std::max_align_t));
+            first = next;
+        }
+        current = nullptr;
+        ptr = end = nullptr;
+    }
+
+private:
+    struct chunk
+    {
+        chunk* next;
+        std::size_t size;
+    };
+
+    std::pmr::memory_resource* const upstream;
+    chunk* first;
+    chunk* current;
+    char* ptr;
+    char* end;
+    std::size_t next_size;
+
+    static std::size_t header_size()
+    {
+        return (sizeof(chunk) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    }
+
+    void enter(chunk* c)
+    {
+        ptr = reinterpret_cast<char*>(c) + header_size();
+        end = reinterpret_cast<char*>(c) + c->size;
+    }
+
+    static std::size_t padding_for(char* p, std::size_t alignment)
+    {
+        std::uintptr_t const address = reinterpret_cast<std::uintptr_t>(p);
+        return (alignment - address % alignment) % alignment;
+    }
+
+    bool fits(std::size_t bytes, std::size_t alignment) const
+    {
+        return ptr && static_cast<std::size_t>(end - ptr) >= padding_for(ptr, alignment) + bytes;
+    }
+
+    // the next chunk (kept from before a reset) if it's big enough, otherwise a new one after current
+    void next_chunk(std::size_t bytes, std::size_t alignment)
+    {
+        std::size_t const needed = header_size() + bytes + alignment;
+        if (current && current->next && current->next->size >= needed)
+        {
+            current = current->next;
+            enter(current);
+            return;
+        }
+
+        while (next_size < needed)
+            next_size *= 2;
+
+        chunk* const c = static_cast<chunk*>(upstream->allocate(next_size, alignof(std::max_align_t)));
+        c->size = next_size;
+        next_size *= 2;
+
+        if (current)
+        {
+            c->next = current->next;
+            current->next = c;
+        }
+        else
+        {
+            c->next = first;
+            first = c;
+        }
+        current = c;
+        enter(c);
+    }
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        if (!fits(bytes, alignment))
+            next_chunk(bytes, alignment);
+
+        char* const result = ptr + padding_for(ptr, alignment);
+        ptr = result + bytes;
+        return result;
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override
+    {
+    }
+
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+// Thread safe pool of power of two sized blocks (min_block to max_block bytes), carved from chunks taken
+// from upstream. Each thread allocates and frees through its own per_thread slot, so threads don't contend
+// (a slot's mutex is only shared once there are more threads than slots); a block freed on another thread
+// joins that thread's free list. Larger requests go straight to upstream.
+// release() returns every chunk at once, and must not race with allocation.
+class pool_resource : public std::pmr::memory_resource
+{
+public:
+    static std::size_t const min_block = 8;
+    static std::size_t const max_block = 4096;
+    static std::size_t const chunk_size = 64 * 1024;
+
+    explicit pool_resource(std::pmr::memory_resource* upstream_ = std::pmr::new_delete_resource()) :
+        upstream(upstream_),
+        chunks(nullptr)
+    {
+    }
+
+    ~pool_resource()
+    {
+        release();
+    }
+
+    pool_resource(pool_resource const&) = delete;
+    pool_resource& operator=(pool_resource const&) = delete;
+
+    void release()
+    {
+        {
+            std::lock_guard<std::mutex> lk(chunks_mutex);
+            while (chunks)
+            {
+                chunk* const next = chunks->next;
+                upstream->deallocate(chunks, chunk_size, max_block);
+                chunks = next;
+            }
+        }
+
+        caches.for_each([](cache& c) {
+            std::lock_guard<std::mutex> lk(c.mutex);
+            std::fill(std::begin(c.free), std::end(c.free), nullptr);
+            c.ptr = c.end = nullptr;
+        });
+    }
+
+private:
+    static std::size_t const num_classes = 10; // 8 .. 4096
+
+    struct block
+    {
+        block* next;
+    };
+
+    struct chunk
+    {
+        chunk* next;
+    };
+
+    struct cache
+    {
+        std::mutex mutex;
+        block* free[num_classes] = {};
+        char* ptr = nullptr; // unused remainder of this slot's current chunk
+        char* end = nullptr;
+    };
+
+    std::pmr::memory_resource* const upstream;
+    per_thread<cache> caches;
+    std::mutex chunks_mutex;
+    chunk* chunks;
+
+    static std::size_t class_of(std::size_t bytes)
+    {
+        std::size_t index = 0;
+        while ((min_block << index) < bytes)
+            ++index;
+        return index;
+    }
+
+    // a fresh chunk for c to carve from - its first max_block bytes hold the chunk list link
+    void refill(cache& c)
+    {
+        char* const memory = static_cast<char*>(upstream->allocate(chunk_size, max_block));
+        {
+            std::lock_guard<std::mutex> lk(chunks_mutex);
+            chunk* const link = reinterpret_cast<chunk*>(memory);
+            link->next = chunks;
+            chunks = link;
+        }
+        c.ptr = memory + max_block;
+        c.end = memory + chunk_size;
+    }
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        std::size_t const size = std::max(bytes, alignment);
+        if (size > max_block)
+            return upstream->allocate(bytes, alignment);
+
+        std::size_t const index = class_of(size);
+        std::size_t const block_size = min_block << index;
+
+        cache& c = caches.local();
+        std::lock_guard<std::mutex> lk(c.mutex);
+
+        if (block* const b = c.free[index])
+        {
+            c.free[index] = b->next;
+            return b;
+        }
+
+        // blocks are carved at multiples of their own size, so they're aligned to it
+        std::uintptr_t const address = reinterpret_cast<std::uintptr_t>(c.ptr);
+        std::size_t const padding = (block_size - address % block_size) % block_size;
+        if (!c.ptr || static_cast<std::size_t>(c.end - c.ptr) < padding + block_size)
+            refill(c);
+        else
+            c.ptr += padding;
+
+        char* const result = c.ptr;
+        c.ptr += block_size;
+        return result;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+    {
+        std::size_t const size = std::max(bytes, alignment);
+        if (size > max_block)
+        {
+            upstream->deallocate(p, bytes, alignment);
+            return;
+        }
+
+        cache& c = caches.local();
+        std::lock_guard<std::mutex> lk(c.mutex);
+
+        block* const b = static_cast<block*>(p);
+        std::size_t const index = class_of(size);
+        b->next = c.free[index];
+        c.free[index] = b;
+    }
+
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
@@ -0,0 +1,240 @@
+#pragma once
+
+// Contention micro-benchmarks - throughput and latency percentiles of an operation run by 1, 2, 4 .. N
+// threads at once. Profile() times a whole run, which can't tell a primitive that's fast on average from one
+// that stalls every thousandth call, so run_contended also times a sample of the individual operations.
+// Results print as a table and write as JSON, one object per (name, variant, threads), alongside the
+// instruction set the simd.h kernels were dispatched to.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "adaptive_sync.h"
+#include "parallel.h"
+#include "simd.h"
+
+struct bench_result
+{
+    std::string name;    // what's measured, eg "stack"
+    std::string variant; // which implementation, eg "lock_free_stack"
+    std::string mix;     // operation mix, eg "push 50%"
+    unsigned threads;
+    std::uint64_t ops;
+    double seconds;
+    double ops_per_sec;
+    double p50_ns;
+    double p90_ns;
+    double p99_ns;
+    double p999_ns;
+    double max_ns;
+};
+
+namespace detail {
+
+// 1 in sample_every operations is timed - often enough for the 99.9th percentile of a million operations,
+// rarely enough that reading the clock doesn't dominate a lock free push
+std::uint64_t const sample_every = 16;
+
+inline double percentile(std::vector<double> const& sorted, double fraction)
+{
+    if (sorted.empty())
+        return 0;
+    std::size_t const index = static_cast<std::size_t>(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+inline bench_result make_result(std::string const& name, std::string const& variant, std::string const& mix,
+    unsigned threads, std::uint64_t ops, double seconds, std::vector<double>& latencies)
+{
+    std::sort(latencies.begin(), latencies.end());
+
+    bench_result result;
+    result.name = name;
+    result.variant = variant;
+    result.mix = mix;
+    result.threads = threads;
+    result.ops = ops;
+    result.seconds = seconds;
+    result.ops_per_sec = seconds > 0 ? ops / seconds : 0;
+    result.p50_ns = percentile(latencies, 0.5);
+    result.p90_ns = percentile(latencies, 0.9);
+    result.p99_ns = percentile(latencies, 0.99);
+    result.p999_ns = percentile(latencies, 0.999);
+    result.max_ns = latencies.empty() ? 0 : latencies.back();
+    return result;
+}
+
+inline void write_json_string(std::ostream& os, std::string const& s)
+{
+    os << '"';
+    for (char const c : s)
+    {
+        if (c == '"' || c == '\\')
+            os << '\\';
+        os << c;
+    }
+    os << '"';
+}
+
+}  // namespace detail
+
+// 1, 2, 4 .. up to and including max_threads (hardware threads by default).
+inline std::vector<unsigned> thread_counts(unsigned max_threads = 0)
+{
+    if (!max_threads)
+        max_threads = detail::hardware_threads();
+
+    std::vector<unsigned> counts;
+    for (unsigned n = 1; n < max_threads; n *= 2)
+        counts.push_back(n);
+    counts.push_back(max_threads);
+    return counts;
+}
+
+// Deterministic coin for operation mixes: true for percent% of the (thread, i) pairs. Stateless, so the op
+// needn't keep a generator per thread.
+inline bool chance(unsigned thread, std::uint64_t i, unsigned percent)
+{
+    std::uint64_t z = (i << 8 | thread) + 0x9E3779B97F4A7C15ull; // splitmix64
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    return z % 100 < percent;
+}
+
+// Runs op(thread, i) for i in [0, ops_per_thread) on each of num_threads threads, all released together.
+// Throughput is the total over the wall time from release until the last thread finishes.
+template<typename Op>
+bench_result run_contended(std::string const& name, std::string const& variant, std::string const& mix,
+    unsigned num_threads, std::uint64_t ops_per_thread, Op op)
+{
+    typedef std::chrono::steady_clock clock;
+
+    std::vector<std::vector<double>> samples(num_threads);
+    latch ready(num_threads + 1);
+    latch go(1);
+
+    std::atomic<bool> abandoned(false);
+
+    std::vector<std::thread> threads;
+    detail::join_threads joiner(threads); // if starting a thread throws
+    try
+    {
+        threads.reserve(num_threads); // so only the thread constructor can throw once one is running
+        for (unsigned t = 0; t < num_threads; ++t)
+        {
+            threads.push_back(std::thread([&, t]() {
+                std::vector<double>& latencies = samples[t];
+                latencies.reserve(static_cast<std::size_t>(ops_per_thread / detail::sample_every + 1));
+
+                ready.count_down();
+                go.wait();
+                if (abandoned.load(std::memory_order_relaxed))
+                    return;
+
+                for (std::uint64_t i = 0; i < ops_per_thread; ++i)
+                {
+                    if (i % detail::sample_every)
+                    {
+                        op(t, i);
+                        continue;
+                    }
+
+                    clock::time_point const start = clock::now();
+                    op(t, i);
+                    latencies.push_back(std::chrono::duration<double, std::nano>(clock::now() - start).count());
+                }
+            }));
+        }
+    }
+    catch (...)
+    {
+        // the threads already started are waiting for go - release them to return before joiner joins them
+        abandoned.store(true, std::memory_order_relaxed);
+        go.count_down();
+        throw;
+    }
+
+    ready.arrive_and_wait();
+    clock::time_point const start = clock::now();
+    go.count_down();
+    for (auto& t : threads)
+        t.join();
+    double const seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    std::vector<double> latencies;
+    for (auto const& s : samples)
+        latencies.insert(latencies.end(), s.begin(), s.end());
+
+    return detail::make_result(name, variant, mix, num_threads, ops_per_thread * num_threads, seconds, latencies);
+}
+
+// Times batches calls of func(), each doing ops_per_batch operations with threads threads - for work that
+// parallelises itself, like a reduction. The percentiles are per batch.
+template<typename Func>
+bench_result run_batches(std::string const& name, std::string const& variant, unsigned threads,
+    std::uint64_t ops_per_batch, unsigned batches, Func func)
+{
+    typedef std::chrono::steady_clock clock;
+
+    std::vector<double> latencies;
+    clock::time_point const start = clock::now();
+    for (unsigned b = 0; b < batches; ++b)
+    {
+        clock::time_point const batch_start = clock::now();
+        func();
+        latencies.push_back(std::chrono::duration<double, std::nano>(clock::now() - batch_start).count());
+    }
+    double const seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    return detail::make_result(name, variant, "", threads, ops_per_batch * batches, seconds, latencies);
+}
+
+inline void print_result_header(std::ostream& os)
+{
+    os << std::left << std::setw(12) << "name" << std::setw(24) << "variant" << std::setw(14) << "mix"
+        << std::right << std::setw(8) << "threads" << std::setw(14) << "ops/s" << std::setw(10) << "p50 ns"
+        << std::setw(10) << "p99 ns" << std::setw(12) << "p99.9 ns" << std::setw(12) << "max ns" << '\n';
+}
+
+inline void print_result(std::ostream& os, bench_result const& r)
+{
+    os << std::left << std::setw(12) << r.name << std::setw(24) << r.variant << std::setw(14) << r.mix
+        << std::right << std::setw(8) << r.threads << std::setw(14) << std::fixed << std::setprecision(0)
+        << r.ops_per_sec << std::setw(10) << r.p50_ns << std::setw(10) << r.p99_ns << std::setw(12)
+        << r.p999_ns << std::setw(12) << r.max_ns << '\n';
+    os.unsetf(std::ios_base::floatfield);
+    os << std::setprecision(6);
+}
+
+// {"isa": .., "benchmarks": [{"name": .., "variant": .., "mix": .., "threads": .., "ops": .., "seconds": ..,
+//   "ops_per_sec": .., "p50_ns": .., "p90_ns": .., "p99_ns": .., "p999_ns": .., "max_ns": ..}, ..]}
+inline void write_json(std::ostream& os, std::vector<bench_result> const& results)
+{
+    std::streamsize const precision = os.precision(9);
+    os << "{\"isa\": \"" << isa_name(kernel_isa()) << "\", \"benchmarks\": [";
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        bench_result const& r = results[i];
+        os << (i ? ",\n  " : "\n  ") << "{\"name\": ";
+        detail::write_json_string(os, r.name);
+        os << ", \"variant\": ";
+        detail::write_json_string(os, r.variant);
+        os << ", \"mix\": ";
+        detail::write_json_string(os, r.mix);
+        os << ", \"threads\": " << r.threads << ", \"ops\": " << r.ops << ", \"seconds\": " << r.seconds
+            << ", \"ops_per_sec\": " << r.ops_per_sec << ", \"p50_ns\": " << r.p50_ns << ", \"p90_ns\": "
+            << r.p90_ns << ", \"p99_ns\": " << r.p99_ns << ", \"p999_ns\": " << r.p999_ns << ", \"max_ns\": "
+            << r.max_ns << "}";
+    }
+    os << "\n]}\n";
+    os.precision(precision);
+}
@@ -0,0 +1,388 @@
+#pragma once
+
+// Modular arithmetic for the problems: gcd and lcm, and contexts for arithmetic modulo a fixed n, with
+// std::uint32_t, std::uint64_t or wide_uint residues.
+//  - montgomery<T> (n odd) keeps residues in Montgomery form, x * R mod n with R = 2^bits of T, where a
+//    product is a double width multiplication and a REDC - two more multiplications, no division.
+//  - barrett<T> takes any n. Residues are plain, and a product is reduced by multiplying with a
+//    precomputed floor(2^(2 * bits) / n).
+// Both have to_residue, from_residue, one, add, sub and multiply, and the free functions work with either:
+// mod_pow, mod_inverse, batch_inverse (Montgomery's trick - one inversion for a whole array) and
+// mod_multiply over arrays, which for montgomery<std::uint32_t> is a simd.h kernel.
+// binary_gcd is Stein's: one division to bring the operands to the same size, then shifts and subtractions.
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "simd.h"
+#include "wide_uint.h"
+
+namespace detail {
+
+template<typename T>
+struct double_width;
+
+template<>
+struct double_width<std::uint32_t>
+{
+    typedef std::uint64_t type;
+};
+
+template<>
+struct double_width<std::uint64_t>
+{
+    typedef wide_uint<128> type;
+};
+
+template<unsigned Bits>
+struct double_width<wide_uint<Bits>>
+{
+    typedef wide_uint<2 * Bits> type;
+};
+
+// a * b - returns the low half and sets high.
+inline std::uint32_t mul_wide(std::uint32_t a, std::uint32_t b, std::uint32_t& high)
+{
+    std::uint64_t const product = static_cast<std::uint64_t>(a) * b;
+    high = static_cast<std::uint32_t>(product >> 32);
+    return static_cast<std::uint32_t>(product);
+}
+
+inline std::uint64_t mul_wide(std::uint64_t a, std::uint64_t b, std::uint64_t& high)
+{
+    return mul_add(a, b, 0, 0, high);
+}
+
+template<unsigned Bits>
+wide_uint<Bits> mul_wide(wide_uint<Bits> const& a, wide_uint<Bits> const& b, wide_uint<Bits>& high)
+{
+    wide_uint<2 * Bits> const product = multiply_full(a, b);
+    high = wide_uint<Bits>(product >> Bits);
+    return wide_uint<Bits>(product);
+}
+
+// The high half of a * b, for Barrett's quotient.
+inline std::uint64_t mul_high(std::uint64_t a, std::uint64_t b)
+{
+    std::uint64_t high;
+    mul_add(a, b, 0, 0, high);
+    return high;
+}
+
+template<unsigned Bits>
+wide_uint<Bits> mul_high(wide_uint<Bits> const& a, wide_uint<Bits> const& b)
+{
+    return wide_uint<Bits>(multiply_full(a, b) >> Bits);
+}
+
+template<typename T>
+unsigned trailing_zeros(T value)
+{
+    return static_cast<unsigned>(std::countr_zero(static_cast<typename std::make_unsigned<T>::type>(value)));
+}
+
+template<unsigned Bits>
+unsigned trailing_zeros(wide_uint<Bits> const& value)
+{
+    unsigned zeros = 0;
+    for (std::size_t i = 0; i < wide_uint<Bits>::limb_count; ++i)
+    {
+        if (value.data()[i])
+            return zeros + static_cast<unsigned>(std::countr_zero(value.data()[i]));
+        zeros += 64;
+    }
+    return zeros;
+}
+
+// x + y mod n, for x, y < n, without overflowing T.
+template<typename T>
+T add_mod(T const& x, T const& y, T const& n)
+{
+    T const sum = x + y;
+    return sum < x || sum >= n ? sum - n : sum;
+}
+
+template<typename T>
+T sub_mod(T const& x, T const& y, T const& n)
+{
+    return x >= y ? x - y : x - y + n;
+}
+
+}  // namespace detail
+
+// Greatest common divisor of a and b, which must not be negative. binary_gcd(0, 0) is 0.
+template<typename T>
+T binary_gcd(T a, T b)
+{
+    if (a < b)
+        std::swap(a, b);
+    if (b == T(0))
+        return a;
+    a %= b;
+    if (a == T(0))
+        return b;
+
+    unsigned const shift = detail::trailing_zeros(a | b);
+    a >>= detail::trailing_zeros(a);
+    do
+    {
+        b >>= detail::trailing_zeros(b);
+        if (a > b)
+            std::swap(a, b);
+        b -= a;
+    } while (b != T(0));
+    return a << shift;
+}
+
+// Least common multiple, 0 if either is - it wraps (or, signed, overflows) if it doesn't fit in T.
+template<typename T>
+T lcm(T a, T b)
+{
+    if (a == T(0) || b == T(0))
+        return T(0);
+    return a / binary_gcd(a, b) * b;
+}
+
+template<typename T>
+class montgomery
+{
+public:
+    typedef T value_type;
+
+    // Throws std::domain_error unless modulus is odd and above 1.
+    explicit montgomery(T modulus_) : n(modulus_)
+    {
+        if (!(n & T(1)) || n == T(1))
+            throw std::domain_error("montgomery needs an odd modulus above 1");
+
+        // Newton's iteration for n^-1 mod R: n * n = 1 mod 8 for odd n, and each step doubles the bits that
+        // are right
+        n_inverse = n;
+        for (int bits = 3; bits < std::numeric_limits<T>::digits; bits *= 2)
+            n_inverse *= T(2) - n * n_inverse;
+
+        r1 = (T(0) - n) % n;
+        r2 = r1;
+        for (int bit = 0; bit < std::numeric_limits<T>::digits; ++bit)
+            r2 = detail::add_mod(r2, r2, n);
+    }
+
+    T modulus() const
+    {
+        return n;
+    }
+
+    // n^-1 mod R, for kernels doing their own REDC.
+    T modulus_inverse() const
+    {
+        return n_inverse;
+    }
+
+    // x * R mod n, for any x.
+    T to_residue(T const& x) const
+    {
+        return multiply(x % n, r2);
+    }
+
+    T from_residue(T const& x) const
+    {
+        return reduce(T(0), x);
+    }
+
+    T one() const
+    {
+        return r1;
+    }
+
+    T add(T const& x, T const& y) const
+    {
+        return detail::add_mod(x, y, n);
+    }
+
+    T sub(T const& x, T const& y) const
+    {
+        return detail::sub_mod(x, y, n);
+    }
+
+    T multiply(T const& x, T const& y) const
+    {
+        T high;
+        T const low = detail::mul_wide(x, y, high);
+        return reduce(high, low);
+    }
+
+private:
+    T n;
+    T n_inverse;
+    T r1;   // R mod n, ie 1 in Montgomery form
+    T r2;   // R^2 mod n, for to_residue
+
+    // (high:low) / R mod n, for high < n. With m = low * n^-1, m * n has the same low half as the input, so
+    // subtracting it leaves high - hi(m * n) with nothing borrowed.
+    T reduce(T const& high, T const& low) const
+    {
+        T const m = low * n_inverse;
+        T mn_high;
+        detail::mul_wide(m, n, mn_high);
+        return detail::sub_mod(high, mn_high, n);
+    }
+};
+
+template<typename T>
+class barrett
+{
+public:
+    typedef T value_type;
+    typedef typename detail::double_width<T>::type wide_type;
+
+    // Throws std::domain_error for 0.
+    explicit barrett(T modulus_) : n(modulus_)
+    {
+        if (n == T(0))
+            throw std::domain_error("barrett needs a modulus above 0");
+        factor = ~wide_type(0) / wide_type(n);
+    }
+
+    T modulus() const
+    {
+        return n;
+    }
+
+    T to_residue(T const& x) const
+    {
+        return x % n;
+    }
+
+    T from_residue(T const& x) const
+    {
+        return x;
+    }
+
+    T one() const
+    {
+        return T(1) % n;
+    }
+
+    T add(T const& x, T const& y) const
+    {
+        return detail::add_mod(x, y, n);
+    }
+
+    T sub(T const& x, T const& y) const
+    {
+        return detail::sub_mod(x, y, n);
+    }
+
+    T multiply(T const& x, T const& y) const
+    {
+        return reduce(wide_type(x) * wide_type(y));
+    }
+
+    // x mod n, for any double width x. The estimated quotient is at most two short.
+    T reduce(wide_type const& x) const
+    {
+        wide_type const quotient = detail::mul_high(x, factor);
+        wide_type remainder = x - quotient * wide_type(n);
+        while (remainder >= wide_type(n))
+            remainder -= wide_type(n);
+        return static_cast<T>(remainder);
+    }
+
+private:
+    T n;
+    wide_type factor;   // floor((2^(2 * bits) - 1) / n)
+};
+
+// base^exponent, by squaring - base and the result are residues of mod.
+template<typename Mod, typename E>
+typename Mod::value_type mod_pow(Mod const& mod, typename Mod::value_type base, E exponent)
+{
+    typename Mod::value_type result = mod.one();
+    while (exponent != E(0))
+    {
+        if (exponent & E(1))
+            result = mod.multiply(result, base);
+        base = mod.multiply(base, base);
+        exponent >>= 1;
+    }
+    return result;
+}
+
+// The inverse of residue x, or 0 if x and the modulus aren't coprime. Extended Euclid on the values, with
+// the coefficients kept as magnitudes (their signs alternate) so they stay below the modulus.
+template<typename Mod>
+typename Mod::value_type mod_inverse(Mod const& mod, typename Mod::value_type const& x)
+{
+    typedef typename Mod::value_type T;
+
+    T r0 = mod.modulus(), r1 = mod.from_residue(x);
+    T u0 = 0, u1 = 1;
+    bool negative = true;
+    while (r1 != T(0))
+    {
+        T const quotient = r0 / r1;
+        T const r2 = r0 - quotient * r1;
+        T const u2 = u0 + quotient * u1;
+        r0 = r1;
+        r1 = r2;
+        u0 = u1;
+        u1 = u2;
+        negative = !negative;
+    }
+
+    if (r0 != T(1))
+        return T(0);
+    return mod.to_residue(negative ? mod.modulus() - u0 : u0);
+}
+
+// inverses[i] = the inverse of residues[i], for length residues, with one mod_inverse and three
+// multiplications each. Returns false, leaving inverses undefined, if any residue has no inverse.
+template<typename Mod>
+bool batch_inverse(Mod const& mod, typename Mod::value_type const* residues, typename Mod::value_type* inverses,
+    std::size_t length)
+{
+    typedef typename Mod::value_type T;
+
+    if (!length)
+        return true;
+
+    // inverses[i] = residues[0] * ... * residues[i] until the single inversion
+    inverses[0] = residues[0];
+    for (std::size_t i = 1; i < length; ++i)
+        inverses[i] = mod.multiply(inverses[i - 1], residues[i]);
+
+    T inverse = mod_inverse(mod, inverses[length - 1]);
+    if (inverse == T(0))
+        return false;
+
+    for (std::size_t i = length; i-- > 1;)
+    {
+        T const next = mod.multiply(inverse, residues[i]);
+        inverses[i] = mod.multiply(inverse, inverses[i - 1]);
+        inverse = next;
+    }
+    inverses[0] = inverse;
+    return true;
+}
+
+// products[i] = x[i] * y[i], for length residues.
+template<typename Mod>
+void mod_multiply(Mod const& mod, typename Mod::value_type const* x, typename Mod::value_type const* y,
+    typename Mod::value_type* products, std::size_t length)
+{
+    for (std::size_t i = 0; i < length; ++i)
+        products[i] = mod.multiply(x[i], y[i]);
+}
+
+inline void mod_multiply(montgomery<std::uint32_t> const& mod, std::uint32_t const* x, std::uint32_t const* y,
+    std::uint32_t* products, std::size_t length)
+{
+    simd_montgomery_multiply(x, y, products, length, mod.modulus(), mod.modulus_inverse());
+}
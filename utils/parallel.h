@@ -0,0 +1,368 @@
+#pragma once
+
+// Parallel algorithms - parallel_reduce, parallel_transform_reduce, parallel_for_each and parallel_inclusive_scan.
+// Replaces the naive parallel_accumulate (see thread/ch2 manage threads.cpp)
+//  - grain size is derived from the input length and cache size rather than a fixed min_per_thread
+//  - block boundaries are found in one pass on the calling thread (O(1) per block for random access iterators)
+//  - exceptions thrown by any block are rethrown on the calling thread once all blocks have joined
+//  - parallel_for_each can be given a cancellation_token, which every block polls
+//  - arithmetic types on random access ranges are reduced with several independent accumulators so the
+//    inner loop vectorises, and integer sums use the simd.h kernel for the CPU's instruction set
+// The reduction op must be associative and commutative: blocks are combined left to right, but on random access
+// ranges of arithmetic types each block's accumulators take interleaved elements. parallel_inclusive_scan's
+// op need only be associative.
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "cancellation.h"
+#include "per_thread.h"
+#include "simd.h"
+#include "topology.h"
+
+namespace detail {
+
+// Elements between polls of a cancellation_token.
+std::size_t const cancellation_poll = 1024;
+
+// Independent accumulators in the vectorised reduce loop (enough for 8 x int32 per AVX2 register).
+std::size_t const reduce_lanes = 8;
+
+// CPUs this process may run on (see topology.h) - includes SMT siblings.
+inline unsigned hardware_threads()
+{
+    return cpu_topology::host().logical_count();
+}
+
+// Smallest block worth handing to another thread: enough elements to fill the host's L2, so that the cost
+// of starting a thread (tens of microseconds) is small compared with the work done.
+template<typename T>
+std::size_t default_grain()
+{
+    return std::max<std::size_t>(cpu_topology::host().l2_size() / sizeof(T), 1);
+}
+
+inline std::size_t num_blocks(std::size_t length, std::size_t grain)
+{
+    std::size_t const max_blocks = (length + grain - 1) / grain;
+    return std::max<std::size_t>(std::min<std::size_t>(hardware_threads(), max_blocks), 1);
+}
+
+// Splits [first, last) into num_blocks near equal blocks, returning the num_blocks + 1 boundaries.
+template<typename Iterator>
+std::vector<Iterator> partition(Iterator first, std::size_t length, std::size_t num_blocks)
+{
+    std::vector<Iterator> bounds;
+    bounds.reserve(num_blocks + 1);
+    bounds.push_back(first);
+
+    std::size_t const block_size = length / num_blocks;
+    std::size_t remainder = length % num_blocks;
+
+    for (std::size_t i = 0; i < num_blocks; ++i)
+    {
+        std::size_t const size = block_size + (remainder ? 1 : 0);
+        if (remainder)
+            --remainder;
+
+        std::advance(first, size);
+        bounds.push_back(first);
+    }
+
+    return bounds;
+}
+
+// Offset of block i's first element, matching partition().
+inline std::size_t block_offset(std::size_t length, std::size_t num_blocks, std::size_t i)
+{
+    return i * (length / num_blocks) + std::min(i, length % num_blocks);
+}
+
+// Joins every thread on scope exit, so an exception while launching doesn't leave joinable threads behind.
+class join_threads
+{
+public:
+    explicit join_threads(std::vector<std::thread>& threads_) : threads(threads_)
+    {
+    }
+
+    ~join_threads()
+    {
+        for (auto& t : threads)
+        {
+            if (t.joinable())
+                t.join();
+        }
+    }
+
+    join_threads(join_threads const&) = delete;
+    join_threads& operator=(join_threads const&) = delete;
+
+private:
+    std::vector<std::thread>& threads;
+};
+
+// Runs func(i) for each block i in [0, num_blocks), the last on the calling thread.
+// The first exception thrown (in block order) is rethrown after every block has finished.
+template<typename Func>
+void run_blocks(std::size_t num_blocks, Func func)
+{
+    std::vector<std::exception_ptr> errors(num_blocks);
+
+    auto guarded = [&](std::size_t i) {
+        try
+        {
+            func(i);
+        }
+        catch (...)
+        {
+            errors[i] = std::current_exception();
+        }
+    };
+
+    {
+        std::vector<std::thread> threads;
+        threads.reserve(num_blocks - 1);
+        join_threads joiner(threads);
+
+        for (std::size_t i = 0; i + 1 < num_blocks; ++i)
+        {
+            threads.push_back(std::thread(guarded, i));
+        }
+
+        guarded(num_blocks - 1);
+    }
+
+    for (auto const& error : errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+}
+
+struct identity
+{
+    template<typename U>
+    U&& operator()(U&& value) const
+    {
+        return std::forward<U>(value);
+    }
+};
+
+template<typename Iterator, typename T>
+struct use_lanes : std::integral_constant<bool,
+    std::is_arithmetic<T>::value &&
+    std::is_same<typename std::iterator_traits<Iterator>::iterator_category, std::random_access_iterator_tag>::value>
+{
+};
+
+// Reduces a non-empty block, returning (((x0 op x1) op x2) ...).
+template<typename Iterator, typename T, typename BinaryOp, typename UnaryOp>
+T reduce_block(Iterator first, Iterator last, BinaryOp op, UnaryOp transform, std::false_type)
+{
+    T result = transform(*first);
+
+    for (++first; first != last; ++first)
+    {
+        result = op(result, transform(*first));
+    }
+
+    return result;
+}
+
+// Plain sums of contiguous int or long long into a long long go to simd_sum, built for the CPU's instruction
+// set (see simd.h).
+template<typename Iterator, typename T, typename BinaryOp, typename UnaryOp>
+struct use_simd_sum : std::integral_constant<bool,
+    std::contiguous_iterator<Iterator> &&
+    (std::is_same<typename std::iterator_traits<Iterator>::value_type, int>::value ||
+        std::is_same<typename std::iterator_traits<Iterator>::value_type, long long>::value) &&
+    std::is_same<T, long long>::value &&
+    (std::is_same<BinaryOp, std::plus<T>>::value || std::is_same<BinaryOp, std::plus<>>::value) &&
+    std::is_same<UnaryOp, identity>::value>
+{
+};
+
+// Random access, arithmetic version - reduce_lanes independent accumulators break the loop carried dependency
+// so the compiler can keep them in one vector register. Lane j takes elements j, j + reduce_lanes, ... so op
+// has to be commutative as well as associative.
+template<typename Iterator, typename T, typename BinaryOp, typename UnaryOp>
+T reduce_block(Iterator first, Iterator last, BinaryOp op, UnaryOp transform, std::true_type)
+{
+    std::size_t const length = static_cast<std::size_t>(last - first);
+
+    if constexpr (use_simd_sum<Iterator, T, BinaryOp, UnaryOp>::value)
+        return simd_sum(std::to_address(first), length);
+
+    if (length < 2 * reduce_lanes)
+        return reduce_block<Iterator, T>(first, last, op, transform, std::false_type());
+
+    T lanes[reduce_lanes];
+    for (std::size_t lane = 0; lane < reduce_lanes; ++lane)
+    {
+        lanes[lane] = transform(first[lane]);
+    }
+
+    std::size_t i = reduce_lanes;
+    for (; i + reduce_lanes <= length; i += reduce_lanes)
+    {
+        for (std::size_t lane = 0; lane < reduce_lanes; ++lane)
+        {
+            lanes[lane] = op(lanes[lane], transform(first[i + lane]));
+        }
+    }
+
+    T result = lanes[0];
+    for (std::size_t lane = 1; lane < reduce_lanes; ++lane)
+    {
+        result = op(result, lanes[lane]);
+    }
+
+    for (; i < length; ++i)
+    {
+        result = op(result, transform(first[i]));
+    }
+
+    return result;
+}
+
+}  // namespace detail
+
+template<typename Iterator, typename T, typename BinaryOp, typename UnaryOp>
+T parallel_transform_reduce(Iterator first, Iterator last, T init, BinaryOp reduce, UnaryOp transform,
+    std::size_t grain = 0)
+{
+    std::size_t const length = static_cast<std::size_t>(std::distance(first, last));
+
+    if (!length)
+        return init;
+
+    std::size_t const num_blocks = detail::num_blocks(length, grain ? grain : detail::default_grain<T>());
+    detail::use_lanes<Iterator, T> const lanes;
+
+    if (num_blocks == 1)
+        return reduce(init, detail::reduce_block<Iterator, T>(first, last, reduce, transform, lanes));
+
+    std::vector<Iterator> const bounds = detail::partition(first, length, num_blocks);
+    // one cache line per block, so the workers' results don't false-share
+    per_thread<T> results(num_blocks);
+
+    detail::run_blocks(num_blocks, [&](std::size_t i) {
+        results[i] = detail::reduce_block<Iterator, T>(bounds[i], bounds[i + 1], reduce, transform, lanes);
+    });
+
+    return results.combine(init, reduce);
+}
+
+template<typename Iterator, typename T, typename BinaryOp>
+T parallel_reduce(Iterator first, Iterator last, T init, BinaryOp reduce, std::size_t grain = 0)
+{
+    return parallel_transform_reduce(first, last, init, reduce, detail::identity(), grain);
+}
+
+template<typename Iterator, typename T>
+T parallel_reduce(Iterator first, Iterator last, T init)
+{
+    return parallel_reduce(first, last, init, std::plus<T>());
+}
+
+// grain defaults to default_grain, enough elements to fill L2, so a short range runs as one block on the
+// calling thread; pass a smaller grain when func is expensive.
+template<typename Iterator, typename Func>
+void parallel_for_each(Iterator first, Iterator last, Func func, std::size_t grain = 0)
+{
+    std::size_t const length = static_cast<std::size_t>(std::distance(first, last));
+
+    if (!length)
+        return;
+
+    std::size_t const num_blocks = detail::num_blocks(length,
+        grain ? grain : detail::default_grain<typename std::iterator_traits<Iterator>::value_type>());
+    std::vector<Iterator> const bounds = detail::partition(first, length, num_blocks);
+
+    detail::run_blocks(num_blocks, [&](std::size_t i) {
+        std::for_each(bounds[i], bounds[i + 1], func);
+    });
+}
+
+// Stops early once token is cancelled - each block polls it every cancellation_poll elements - and throws
+// cancelled_error, after every block has stopped.
+template<typename Iterator, typename Func>
+void parallel_for_each(Iterator first, Iterator last, Func func, cancellation_token const& token, std::size_t grain = 0)
+{
+    parallel_for_each(first, last, [func, &token, count = std::size_t(0)](auto&& value) mutable {
+        if (++count % detail::cancellation_poll == 0)
+            token.throw_if_cancelled();
+        func(std::forward<decltype(value)>(value));
+    }, grain);
+}
+
+// Three phases: reduce each block but the last, scan the block totals serially, then scan each block
+// with its carry in. d_first must be random access so the blocks can be written concurrently.
+template<typename InIterator, typename OutIterator, typename BinaryOp>
+OutIterator parallel_inclusive_scan(InIterator first, InIterator last, OutIterator d_first, BinaryOp op,
+    std::size_t grain = 0)
+{
+    typedef typename std::iterator_traits<InIterator>::value_type T;
+
+    std::size_t const length = static_cast<std::size_t>(std::distance(first, last));
+
+    if (!length)
+        return d_first;
+
+    std::size_t const num_blocks = detail::num_blocks(length, grain ? grain : detail::default_grain<T>());
+
+    if (num_blocks == 1)
+        return std::partial_sum(first, last, d_first, op);
+
+    std::vector<InIterator> const bounds = detail::partition(first, length, num_blocks);
+    std::vector<T> carry(num_blocks);
+
+    // the op need only be associative, so block totals only take interleaved lanes for a sum
+    std::integral_constant<bool, detail::use_lanes<InIterator, T>::value &&
+        (std::is_same<BinaryOp, std::plus<T>>::value || std::is_same<BinaryOp, std::plus<>>::value)> const lanes;
+
+    detail::run_blocks(num_blocks - 1, [&](std::size_t i) {
+        carry[i + 1] = detail::reduce_block<InIterator, T>(bounds[i], bounds[i + 1], op, detail::identity(), lanes);
+    });
+
+    for (std::size_t i = 2; i < num_blocks; ++i)
+    {
+        carry[i] = op(carry[i - 1], carry[i]);
+    }
+
+    detail::run_blocks(num_blocks, [&](std::size_t i) {
+        InIterator in = bounds[i];
+        OutIterator out = d_first + detail::block_offset(length, num_blocks, i);
+
+        if (i == 0)
+        {
+            std::partial_sum(in, bounds[i + 1], out, op);
+            return;
+        }
+
+        T running = carry[i];
+        for (; in != bounds[i + 1]; ++in, ++out)
+        {
+            running = op(running, *in);
+            *out = running;
+        }
+    });
+
+    return d_first + length;
+}
+
+template<typename InIterator, typename OutIterator>
+OutIterator parallel_inclusive_scan(InIterator first, InIterator last, OutIterator d_first)
+{
+    return parallel_inclusive_scan(first, last, d_first,
+        std::plus<typename std::iterator_traits<InIterator>::value_type>());
+}
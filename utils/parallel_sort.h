@@ -0,0 +1,318 @@
+#pragma once
+
+// Parallel sorting and merging on a thread_pool - for result sets that would otherwise be kept ordered in a
+// std::set (see p4), a node per element walked by pointer.
+//  - parallel_quick_sort partitions, spawns the lower part as a pool task and carries on with the upper
+//    part, down to a cutoff where std::sort takes over. Each partition is one thread's pass, so the first
+//    levels limit how far it scales.
+//  - parallel_radix_sort is an LSD radix sort of integers, a byte per pass. Each pass, every block counts its
+//    digits, then scatters its elements to offsets from a prefix sum of the counts. So every pass is parallel
+//    and the work is linear. A pass where every element has the same digit (eg the high bytes of small
+//    keys) is skipped.
+//  - parallel_multiway_merge merges k sorted runs, split into parts at sampled splitter values, each part
+//    merged with a heap by a different task.
+// All three work on contiguous buffers in place (radix sort and merge_runs use a scratch buffer of the same
+// size). The calling thread joins in and, like task_future::get, runs queued tasks while it waits, so they
+// can be called from pool tasks too.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "future.h"
+#include "parallel.h"
+#include "thread_pool.h"
+
+namespace detail {
+
+// Below this many elements, a sort or merge part isn't worth a task.
+std::size_t const sort_cutoff = 1 << 14;
+
+// Runs func(i) for each i in [0, n) - the last on the calling thread, the rest as tasks on pool - and
+// rethrows the first exception once they've all finished.
+template<typename Func>
+void run_on_pool(thread_pool& pool, std::size_t n, Func const& func)
+{
+    std::vector<task_future<void>> tasks;
+    tasks.reserve(n - 1);
+    std::exception_ptr error;
+    try
+    {
+        for (std::size_t i = 0; i + 1 < n; ++i)
+            tasks.push_back(spawn(pool, [&func, i]() { func(i); }));
+        func(n - 1);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    for (auto& task : tasks)
+    {
+        try
+        {
+            task.get();
+        }
+        catch (...)
+        {
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+inline std::size_t sort_blocks(thread_pool& pool, std::size_t length)
+{
+    return std::max<std::size_t>(std::min<std::size_t>(pool.size(), length / sort_cutoff), 1);
+}
+
+template<typename Iterator, typename Compare>
+typename std::iterator_traits<Iterator>::value_type median_of_three(Iterator first, Iterator last, Compare& comp)
+{
+    auto const& a = *first;
+    auto const& b = first[(last - first) / 2];
+    auto const& c = last[-1];
+    if (comp(a, b))
+        return comp(b, c) ? b : comp(a, c) ? c : a;
+    return comp(a, c) ? a : comp(b, c) ? c : b;
+}
+
+template<typename Iterator, typename Compare>
+void quick_sort_task(thread_pool& pool, Iterator first, Iterator last, Compare comp, std::size_t cutoff)
+{
+    typedef typename std::iterator_traits<Iterator>::value_type T;
+
+    if (static_cast<std::size_t>(last - first) <= cutoff)
+    {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    // three way, so runs of equal keys end up in the middle rather than making the split lopsided
+    T const pivot = median_of_three(first, last, comp);
+    Iterator const middle1 = std::partition(first, last, [&](T const& x) { return comp(x, pivot); });
+    Iterator const middle2 = std::partition(middle1, last, [&](T const& x) { return !comp(pivot, x); });
+
+    task_future<void> lower = spawn(pool, [&pool, first, middle1, comp, cutoff]() {
+        quick_sort_task(pool, first, middle1, comp, cutoff);
+    });
+    try
+    {
+        quick_sort_task(pool, middle2, last, comp, cutoff);
+    }
+    catch (...)
+    {
+        lower.wait(); // it sorts the caller's range, so it mustn't outlive the call
+        throw;
+    }
+    lower.get();
+}
+
+// maps an integer to an unsigned key of the same order
+template<typename T>
+typename std::make_unsigned<T>::type radix_key(T value)
+{
+    typedef typename std::make_unsigned<T>::type U;
+    U const sign = std::is_signed<T>::value ? U(1) << (8 * sizeof(T) - 1) : U(0);
+    return static_cast<U>(value) ^ sign;
+}
+
+}  // namespace detail
+
+template<typename Iterator, typename Compare>
+void parallel_quick_sort(Iterator first, Iterator last, Compare comp, thread_pool& pool = thread_pool::default_pool())
+{
+    std::size_t const length = static_cast<std::size_t>(last - first);
+    std::size_t const cutoff = std::max(detail::sort_cutoff, length / (8 * pool.size()));
+    detail::quick_sort_task(pool, first, last, comp, cutoff);
+}
+
+template<typename Iterator>
+void parallel_quick_sort(Iterator first, Iterator last)
+{
+    parallel_quick_sort(first, last, std::less<typename std::iterator_traits<Iterator>::value_type>());
+}
+
+// Sorts integers ascending. Iterator must be contiguous.
+template<typename Iterator>
+void parallel_radix_sort(Iterator first, Iterator last, thread_pool& pool = thread_pool::default_pool())
+{
+    typedef typename std::iterator_traits<Iterator>::value_type T;
+    static_assert(std::is_integral<T>::value, "radix sort needs integer keys");
+
+    std::size_t const length = static_cast<std::size_t>(last - first);
+    if (length <= detail::sort_cutoff)
+    {
+        std::sort(first, last);
+        return;
+    }
+
+    std::size_t const radix = 256;
+    std::size_t const num_blocks = detail::sort_blocks(pool, length);
+    std::vector<std::size_t> counts(num_blocks * radix);   // then each block's offsets, digit by digit
+
+    T* source = std::to_address(first);
+    std::unique_ptr<T[]> const scratch(new T[length]);
+    T* target = scratch.get();
+
+    auto block_first = [&](std::size_t i) { return detail::block_offset(length, num_blocks, i); };
+
+    for (unsigned shift = 0; shift < 8 * sizeof(T); shift += 8)
+    {
+        auto digit = [shift](T value) { return static_cast<std::size_t>(detail::radix_key(value) >> shift & 0xFF); };
+
+        detail::run_on_pool(pool, num_blocks, [&](std::size_t i) {
+            std::size_t* const count = &counts[i * radix];
+            std::fill(count, count + radix, 0);
+            for (T const* p = source + block_first(i), *end = source + block_first(i + 1); p != end; ++p)
+                ++count[digit(*p)];
+        });
+
+        // every element has the same digit - nothing would move
+        std::size_t const first_digit = digit(source[0]);
+        std::size_t same = 0;
+        for (std::size_t i = 0; i < num_blocks; ++i)
+            same += counts[i * radix + first_digit];
+        if (same == length)
+            continue;
+
+        std::size_t offset = 0;
+        for (std::size_t d = 0; d < radix; ++d)
+        {
+            for (std::size_t i = 0; i < num_blocks; ++i)
+            {
+                std::size_t const count = counts[i * radix + d];
+                counts[i * radix + d] = offset;
+                offset += count;
+            }
+        }
+
+        detail::run_on_pool(pool, num_blocks, [&](std::size_t i) {
+            std::size_t* const next = &counts[i * radix];
+            for (T const* p = source + block_first(i), *end = source + block_first(i + 1); p != end; ++p)
+                target[next[digit(*p)]++] = *p;
+        });
+
+        std::swap(source, target);
+    }
+
+    if (source != std::to_address(first))
+    {
+        detail::run_on_pool(pool, num_blocks, [&](std::size_t i) {
+            std::copy(source + block_first(i), source + block_first(i + 1), std::to_address(first) + block_first(i));
+        });
+    }
+}
+
+// Merges the sorted runs [runs[r].first, runs[r].second) into d_first, which must be random access, and
+// returns the end of the output. Equal elements keep the order of their runs.
+template<typename InIterator, typename OutIterator, typename Compare>
+OutIterator parallel_multiway_merge(std::vector<std::pair<InIterator, InIterator>> const& runs, OutIterator d_first,
+    Compare comp, thread_pool& pool = thread_pool::default_pool())
+{
+    typedef typename std::iterator_traits<InIterator>::value_type T;
+
+    std::size_t length = 0;
+    for (auto const& run : runs)
+        length += static_cast<std::size_t>(run.second - run.first);
+    if (!length)
+        return d_first;
+
+    // splitters sampled evenly from every run, so each part holds about length / num_parts elements
+    std::size_t const num_parts = detail::sort_blocks(pool, length);
+    std::size_t const samples_per_run = 4 * num_parts;
+    std::vector<T> samples;
+    for (auto const& run : runs)
+    {
+        std::size_t const size = static_cast<std::size_t>(run.second - run.first);
+        for (std::size_t s = 0; size && s < samples_per_run; ++s)
+            samples.push_back(run.first[static_cast<std::ptrdiff_t>(s * size / samples_per_run)]);
+    }
+    std::sort(samples.begin(), samples.end(), comp);
+
+    // cut[p * k + r]: where part p starts in run r; every part takes the elements below its successor's splitter
+    std::size_t const k = runs.size();
+    std::vector<InIterator> cut((num_parts + 1) * k);
+    for (std::size_t r = 0; r < k; ++r)
+    {
+        cut[r] = runs[r].first;
+        cut[num_parts * k + r] = runs[r].second;
+    }
+    for (std::size_t p = 1; p < num_parts; ++p)
+    {
+        T const& splitter = samples[p * samples.size() / num_parts];
+        for (std::size_t r = 0; r < k; ++r)
+            cut[p * k + r] = std::lower_bound(runs[r].first, runs[r].second, splitter, comp);
+    }
+
+    std::vector<std::size_t> part_first(num_parts + 1, 0);
+    for (std::size_t p = 1; p <= num_parts; ++p)
+    {
+        for (std::size_t r = 0; r < k; ++r)
+            part_first[p] += static_cast<std::size_t>(cut[p * k + r] - runs[r].first);
+    }
+
+    detail::run_on_pool(pool, num_parts, [&](std::size_t p) {
+        // heap of (cursor, run) - ties go to the earlier run
+        typedef std::pair<InIterator, std::size_t> cursor;
+        std::vector<cursor> heap;
+        for (std::size_t r = 0; r < k; ++r)
+        {
+            if (cut[p * k + r] != cut[(p + 1) * k + r])
+                heap.push_back(cursor(cut[p * k + r], r));
+        }
+        auto later = [&comp](cursor const& a, cursor const& b) {
+            return comp(*b.first, *a.first) || (!comp(*a.first, *b.first) && a.second > b.second);
+        };
+        std::make_heap(heap.begin(), heap.end(), later);
+
+        OutIterator out = d_first + static_cast<std::ptrdiff_t>(part_first[p]);
+        while (!heap.empty())
+        {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            cursor& next = heap.back();
+            *out++ = *next.first++;
+            if (next.first == cut[(p + 1) * k + next.second])
+                heap.pop_back();
+            else
+                std::push_heap(heap.begin(), heap.end(), later);
+        }
+    });
+
+    return d_first + static_cast<std::ptrdiff_t>(length);
+}
+
+// Merges the sorted runs [first + bounds[i], first + bounds[i + 1]) of a contiguous buffer in place.
+template<typename Iterator, typename Compare>
+void parallel_merge_runs(Iterator first, std::vector<std::size_t> const& bounds, Compare comp,
+    thread_pool& pool = thread_pool::default_pool())
+{
+    typedef typename std::iterator_traits<Iterator>::value_type T;
+
+    if (bounds.size() < 3)
+        return;
+
+    std::vector<std::pair<T*, T*>> runs;
+    for (std::size_t r = 0; r + 1 < bounds.size(); ++r)
+        runs.push_back(std::make_pair(std::to_address(first) + bounds[r], std::to_address(first) + bounds[r + 1]));
+
+    std::size_t const length = bounds.back() - bounds.front();
+    std::vector<T> merged(length);
+    parallel_multiway_merge(runs, merged.begin(), comp, pool);
+
+    std::size_t const num_blocks = detail::sort_blocks(pool, length);
+    detail::run_on_pool(pool, num_blocks, [&](std::size_t i) {
+        std::move(merged.begin() + static_cast<std::ptrdiff_t>(detail::block_offset(length, num_blocks, i)),
+            merged.begin() + static_cast<std::ptrdiff_t>(detail::block_offset(length, num_blocks, i + 1)),
+            first + static_cast<std::ptrdiff_t>(bounds.front() + detail::block_offset(length, num_blocks, i)));
+    });
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+// Cache line padded per-thread slots.
+// Neighbouring threads writing adjacent elements of a std::vector<T> false-share cache lines, every write
+// invalidating the line in the other cores. per_thread<T> gives each slot a line (or lines) of its own and
+// combines them on demand; sharded_counter builds a contended counter on top of it.
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <thread>
+#include <utility>
+
+constexpr std::size_t cache_line_size = 64;
+
+namespace detail {
+
+// Small dense index for the calling thread, assigned on first use.
+inline std::size_t this_thread_index()
+{
+    static std::atomic<std::size_t> next_index(0);
+    thread_local std::size_t const index = next_index.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+inline std::size_t default_slot_count()
+{
+    std::size_t const hardware = std::thread::hardware_concurrency(); // hint, may be 0
+    std::size_t count = 1;
+    while (count < (hardware != 0 ? hardware : 2))
+        count <<= 1;
+    return count;
+}
+
+}  // namespace detail
+
+template<typename T>
+class per_thread
+{
+private:
+    struct alignas(cache_line_size) slot
+    {
+        template<typename... Args>
+        explicit slot(Args const&... args) : value(args...)
+        {
+        }
+
+        T value;
+    };
+
+    std::size_t count;
+    std::unique_ptr<char[]> storage; // std::allocator needn't honour over-aligned types, so align by hand
+    slot* slots;
+
+public:
+    per_thread() : per_thread(detail::default_slot_count())
+    {
+    }
+
+    // count slots, each value constructed from args
+    template<typename... Args>
+    explicit per_thread(std::size_t count_, Args const&... args) :
+        count(count_ ? count_ : 1),
+        storage(new char[count * sizeof(slot) + cache_line_size]),
+        slots(nullptr)
+    {
+        void* p = storage.get();
+        std::size_t space = count * sizeof(slot) + cache_line_size;
+        slots = static_cast<slot*>(std::align(cache_line_size, count * sizeof(slot), p, space));
+
+        std::size_t constructed = 0;
+        try
+        {
+            for (; constructed < count; ++constructed)
+            {
+                new (&slots[constructed]) slot(args...);
+            }
+        }
+        catch (...)
+        {
+            destroy(constructed);
+            throw;
+        }
+    }
+
+    ~per_thread()
+    {
+        destroy(count);
+    }
+
+    per_thread(per_thread const&) = delete;
+    per_thread& operator=(per_thread const&) = delete;
+
+    std::size_t size() const
+    {
+        return count;
+    }
+
+    // slot i - for algorithms that hand each worker an index of its own
+    T& operator[](std::size_t i)
+    {
+        return slots[i].value;
+    }
+    T const& operator[](std::size_t i) const
+    {
+        return slots[i].value;
+    }
+
+    // the calling thread's slot - threads share a slot once there are more threads than slots, so T must
+    // tolerate concurrent access (eg an atomic) unless the caller bounds the number of threads
+    T& local()
+    {
+        return slots[detail::this_thread_index() % count].value;
+    }
+
+    // init op slot[0] op slot[1] ... - not synchronised with concurrent writers
+    template<typename U, typename BinaryOp>
+    U combine(U init, BinaryOp op) const
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            init = op(std::move(init), slots[i].value);
+        }
+        return init;
+    }
+
+    template<typename Func>
+    void for_each(Func func)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            func(slots[i].value);
+        }
+    }
+
+private:
+    void destroy(std::size_t constructed)
+    {
+        while (constructed)
+        {
+            slots[--constructed].~slot();
+        }
+    }
+};
+
+// Counter sharded over cache lines - increments only touch the calling thread's line so they scale with
+// cores, reads sum the shards (and so are relatively expensive and only approximately current).
+class sharded_counter
+{
+private:
+    per_thread<std::atomic<long long>> shards;
+
+public:
+    explicit sharded_counter(std::size_t num_shards = detail::default_slot_count()) :
+        shards(num_shards, 0)
+    {
+    }
+
+    void add(long long n = 1)
+    {
+        shards.local().fetch_add(n, std::memory_order_relaxed);
+    }
+
+    long long load() const
+    {
+        return shards.combine(0LL, [](long long total, std::atomic<long long> const& shard) {
+            return total + shard.load(std::memory_order_relaxed);
+        });
+    }
+
+    void reset()
+    {
+        shards.for_each([](std::atomic<long long>& shard) { shard.store(0, std::memory_order_relaxed); });
+    }
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+// Concurrent map for read-mostly data (eg the dns_cache in thread/Ch3 Sharing Data.cpp).
+// Each shard publishes an immutable snapshot (RCU style): readers load the snapshot pointer and look up
+// without locking, so they never write a line another thread reads - the only write is to their own epoch
+// record (see epoch.h). Writers copy the affected shards, apply a whole batch of updates, publish the new
+// snapshots and retire the old ones, which are freed once no reader can still hold them.
+// Best for small/medium shards with rare, batched updates - every write batch copies the shards it touches.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "epoch.h"
+#include "per_thread.h"
+
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class read_mostly_map
+{
+private:
+    typedef std::unordered_map<Key, Value, Hash> table;
+
+    // padded rather than aligned - new[] needn't honour over-aligned types
+    struct shard
+    {
+        std::atomic<table const*> snapshot;
+        char padding[cache_line_size - sizeof(std::atomic<table const*>)];
+
+        shard() : snapshot(new table())
+        {
+        }
+        ~shard()
+        {
+            delete snapshot.load(std::memory_order_relaxed);
+        }
+    };
+
+    unsigned const shard_bits;
+    std::unique_ptr<shard[]> const shards;
+    Hash const hasher;
+    std::mutex writer_mutex;
+
+    static unsigned bits_for(std::size_t num_shards)
+    {
+        unsigned bits = 0;
+        while ((std::size_t(1) << bits) < num_shards)
+            ++bits;
+        return bits;
+    }
+
+    shard& shard_for(Key const& key) const
+    {
+        // multiplicative hash so the shard takes the high bits, leaving the low ones for the table
+        std::uint64_t const mixed = static_cast<std::uint64_t>(hasher(key)) * 0x9E3779B97F4A7C15ull;
+        return shards[shard_bits ? static_cast<std::size_t>(mixed >> (64 - shard_bits)) : 0];
+    }
+
+public:
+    // num_shards is rounded up to a power of two
+    explicit read_mostly_map(std::size_t num_shards = 64) :
+        shard_bits(bits_for(num_shards)),
+        shards(new shard[std::size_t(1) << shard_bits]),
+        hasher()
+    {
+    }
+
+    read_mostly_map(read_mostly_map const&) = delete;
+    read_mostly_map& operator=(read_mostly_map const&) = delete;
+
+    // Calls visitor(value) for key's value without copying it, returning false if there's no entry.
+    // visitor runs inside the read section, so mustn't update this map.
+    template<typename Visitor>
+    bool visit(Key const& key, Visitor visitor) const
+    {
+        shard const& s = shard_for(key);
+        epoch_guard guard;
+
+        table const& snapshot = *s.snapshot.load(std::memory_order_acquire);
+        typename table::const_iterator const it = snapshot.find(key);
+        if (it == snapshot.end())
+            return false;
+
+        visitor(it->second);
+        return true;
+    }
+
+    bool find(Key const& key, Value& value) const
+    {
+        return visit(key, [&value](Value const& found) { value = found; });
+    }
+
+    // Value() if there's no entry - matches dns_cache::find_entry.
+    Value find(Key const& key) const
+    {
+        Value value = Value();
+        find(key, value);
+        return value;
+    }
+
+    // Applies a batch of (key, value) pairs, copying each affected shard once.
+    template<typename Iterator>
+    void update(Iterator first, Iterator last)
+    {
+        std::lock_guard<std::mutex> lk(writer_mutex);
+
+        std::size_t const num_shards = std::size_t(1) << shard_bits;
+        std::vector<std::unique_ptr<table>> copies(num_shards);
+
+        for (; first != last; ++first)
+        {
+            shard& s = shard_for(first->first);
+            std::unique_ptr<table>& copy = copies[&s - shards.get()];
+            if (!copy)
+                copy.reset(new table(*s.snapshot.load(std::memory_order_relaxed)));
+
+            (*copy)[first->first] = first->second;
+        }
+
+        for (std::size_t i = 0; i < num_shards; ++i)
+        {
+            if (copies[i])
+                epoch_retire(shards[i].snapshot.exchange(copies[i].release(), std::memory_order_acq_rel));
+        }
+    }
+
+    void update_or_add_entry(Key const& key, Value const& value)
+    {
+        std::pair<Key, Value> const entry(key, value);
+        update(&entry, &entry + 1);
+    }
+};
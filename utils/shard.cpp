@@ -0,0 +1,465 @@
+// shard.cpp : the shared memory transport and worker processes for shard.h.
+//
+
+#include "stdafx.h"
+
+#include "shard.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include "per_thread.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+namespace {
+
+// The rings must work between processes, so their atomics mustn't fall back on a lock in one process.
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "shared memory needs address free atomics");
+
+// A single producer, single consumer ring with a fixed capacity and trivially copyable values, so it can
+// live in the region. Each index is only written by its own side, so a process that dies part way through a
+// push or pop leaves nothing that blocks the other side - at worst an entry it hadn't yet published or
+// released.
+template<typename T, std::size_t Capacity>
+struct shm_ring
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+    alignas(cache_line_size) std::atomic<std::uint64_t> head;   // consumer's
+    alignas(cache_line_size) std::atomic<std::uint64_t> tail;   // producer's
+    T cells[Capacity];
+
+    shm_ring() : head(0), tail(0)
+    {
+    }
+
+    bool try_push(T const& value)
+    {
+        std::uint64_t const t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        cells[t & (Capacity - 1)] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Reads the oldest entry without releasing its cell.
+    bool try_peek(T& value) const
+    {
+        std::uint64_t const h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        value = cells[h & (Capacity - 1)];
+        return true;
+    }
+
+    void drop()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool try_pop(T& value)
+    {
+        if (!try_peek(value))
+            return false;
+        drop();
+        return true;
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
+
+// One worker's mailboxes, and what it's working on.
+struct shm_worker
+{
+    shm_ring<shard_work, 4> inbox;       // coordinator to worker
+    shm_ring<shard_result, 4> outbox;    // worker to coordinator
+    alignas(cache_line_size) std::atomic<std::uint64_t> available;   // set by the worker, cleared once it's died
+    std::atomic<std::uint64_t> segment;  // one more than the segment in progress, 0 when idle
+    std::atomic<std::uint64_t> first;
+    std::atomic<std::uint64_t> last;
+
+    shm_worker() : available(0), segment(0), first(0), last(0)
+    {
+    }
+};
+
+char const region_magic[8] = { 'E', 'U', 'L', 'R', 'S', 'H', 'R', 'D' };
+
+struct shm_region
+{
+    std::atomic<std::uint64_t> ready;     // set last by the coordinator, once everything else is constructed
+    char magic[8];
+    unsigned workers;
+    alignas(cache_line_size) std::atomic<std::uint64_t> bound;
+    alignas(cache_line_size) std::atomic<std::uint64_t> closed;
+    shm_worker slots[shm_transport::max_workers];
+
+    explicit shm_region(unsigned workers_) : ready(0), workers(workers_), bound(0), closed(0)
+    {
+        std::memcpy(magic, region_magic, sizeof(magic));
+        ready.store(1, std::memory_order_release);
+    }
+};
+
+// Polls with a doubling sleep: processes can't wait on each other's atomics portably.
+class poll_backoff
+{
+public:
+    poll_backoff() : delay(1)
+    {
+    }
+
+    void operator()()
+    {
+        std::this_thread::sleep_for(delay);
+        delay = std::min<std::chrono::microseconds>(delay * 2, std::chrono::milliseconds(1));
+    }
+
+private:
+    std::chrono::microseconds delay;
+};
+
+std::string region_name(std::string const& name)
+{
+#if defined(_WIN32)
+    return "Local\\" + name;
+#else
+    return "/" + name;
+#endif
+}
+
+}  // namespace
+
+struct shm_transport::mapping
+{
+    std::string name;
+    bool owner;
+    shm_region* region;
+    unsigned next_post;      // coordinator's round robin positions
+    unsigned next_collect;
+#if defined(_WIN32)
+    HANDLE file;
+#endif
+
+    mapping(std::string const& name_, bool owner_) :
+        name(region_name(name_)), owner(owner_), region(nullptr), next_post(0), next_collect(0)
+    {
+#if defined(_WIN32)
+        if (owner)
+        {
+            ULARGE_INTEGER size;
+            size.QuadPart = sizeof(shm_region);
+            file = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, size.HighPart, size.LowPart,
+                name.c_str());
+        }
+        else
+            file = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+        if (!file)
+            throw shard_error("can't map shared memory " + name);
+
+        void* const view = MapViewOfFile(file, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(shm_region));
+        if (!view)
+        {
+            CloseHandle(file);
+            throw shard_error("can't map shared memory " + name);
+        }
+#else
+        int const fd = owner ? shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600) : shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0)
+            throw shard_error("can't open shared memory " + name);
+        if (owner && ftruncate(fd, sizeof(shm_region)) != 0)
+        {
+            ::close(fd);
+            shm_unlink(name.c_str());
+            throw shard_error("can't size shared memory " + name);
+        }
+
+        void* const view = mmap(nullptr, sizeof(shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED)
+        {
+            if (owner)
+                shm_unlink(name.c_str());
+            throw shard_error("can't map shared memory " + name);
+        }
+#endif
+        region = static_cast<shm_region*>(view);
+    }
+
+    ~mapping()
+    {
+        if (owner)
+            region->~shm_region();
+#if defined(_WIN32)
+        UnmapViewOfFile(region);
+        CloseHandle(file);
+#else
+        munmap(region, sizeof(shm_region));
+        if (owner)
+            shm_unlink(name.c_str());
+#endif
+    }
+};
+
+shard_transport::~shard_transport()
+{
+}
+
+shm_transport::shm_transport(std::unique_ptr<mapping> mapped_) : mapped(std::move(mapped_))
+{
+}
+
+shm_transport::~shm_transport()
+{
+}
+
+std::unique_ptr<shm_transport> shm_transport::create(std::string const& name, unsigned workers)
+{
+    if (workers > max_workers)
+        throw shard_error("too many shard workers");
+
+    auto m = std::make_unique<mapping>(name, true);
+    new (m->region) shm_region(workers);
+    return std::unique_ptr<shm_transport>(new shm_transport(std::move(m)));
+}
+
+std::unique_ptr<shm_transport> shm_transport::open(std::string const& name)
+{
+    auto m = std::make_unique<mapping>(name, false);
+    shm_region const& r = *m->region;
+    if (r.ready.load(std::memory_order_acquire) != 1 || std::memcmp(r.magic, region_magic, sizeof(region_magic)) != 0)
+        throw shard_error("shared memory " + name + " isn't a shard region");
+    return std::unique_ptr<shm_transport>(new shm_transport(std::move(m)));
+}
+
+bool shm_transport::try_post(shard_work const& work)
+{
+    shm_region& r = *mapped->region;
+    for (unsigned tried = 0; tried < r.workers; ++tried)
+    {
+        shm_worker& slot = r.slots[mapped->next_post];
+        mapped->next_post = (mapped->next_post + 1) % r.workers;
+        if (slot.available.load(std::memory_order_acquire) && slot.inbox.try_push(work))
+            return true;
+    }
+    return false;
+}
+
+bool shm_transport::try_collect(shard_result& result)
+{
+    shm_region& r = *mapped->region;
+    for (unsigned tried = 0; tried < r.workers; ++tried)
+    {
+        shm_worker& slot = r.slots[mapped->next_collect];
+        mapped->next_collect = (mapped->next_collect + 1) % r.workers;
+        if (slot.outbox.try_pop(result))
+            return true;
+    }
+    return false;
+}
+
+std::vector<shard_work> shm_transport::abandoned(unsigned worker)
+{
+    // worker is dead, so the coordinator can take over the consuming side of its inbox; results it had
+    // already published stay in its outbox to be collected
+    shm_worker& slot = mapped->region->slots[worker];
+    slot.available.store(0, std::memory_order_release);
+
+    std::vector<shard_work> lost;
+    if (std::uint64_t const segment = slot.segment.exchange(0, std::memory_order_acquire))
+        lost.push_back(shard_work{ segment - 1, slot.first.load(std::memory_order_relaxed), slot.last.load(std::memory_order_relaxed) });
+    shard_work queued;
+    while (slot.inbox.try_pop(queued))
+        lost.push_back(queued);
+    return lost;
+}
+
+bool shm_transport::idle() const
+{
+    shm_region const& r = *mapped->region;
+    for (unsigned i = 0; i < r.workers; ++i)
+    {
+        if (!r.slots[i].inbox.empty() || r.slots[i].segment.load(std::memory_order_acquire))
+            return false;
+    }
+    return true;
+}
+
+void shm_transport::close()
+{
+    mapped->region->closed.store(1, std::memory_order_release);
+}
+
+bool shm_transport::take(unsigned worker, shard_work& work)
+{
+    shm_region& r = *mapped->region;
+    shm_worker& slot = r.slots[worker];
+    slot.available.store(1, std::memory_order_release);
+
+    poll_backoff backoff;
+    for (;;)
+    {
+        // recorded as in progress before its cell is released, so dying in between can only duplicate it
+        if (slot.inbox.try_peek(work))
+        {
+            slot.first.store(work.first, std::memory_order_relaxed);
+            slot.last.store(work.last, std::memory_order_relaxed);
+            slot.segment.store(work.segment + 1, std::memory_order_release);
+            slot.inbox.drop();
+            return true;
+        }
+        if (r.closed.load(std::memory_order_acquire))
+            return false;
+        backoff();
+    }
+}
+
+void shm_transport::put(unsigned worker, shard_result const& result)
+{
+    shm_worker& slot = mapped->region->slots[worker];
+
+    poll_backoff backoff;
+    while (!slot.outbox.try_push(result))
+        backoff();
+
+    // only once the result is queued, so idle() never sees a segment that's neither queued nor in progress
+    slot.segment.store(0, std::memory_order_release);
+}
+
+std::uint64_t shm_transport::bound() const
+{
+    return mapped->region->bound.load(std::memory_order_acquire);
+}
+
+void shm_transport::raise_bound(std::uint64_t value)
+{
+    std::atomic<std::uint64_t>& bound = mapped->region->bound;
+    std::uint64_t current = bound.load(std::memory_order_relaxed);
+    while (current < value && !bound.compare_exchange_weak(current, value, std::memory_order_acq_rel))
+    {
+    }
+}
+
+struct shard_process::handle
+{
+#if defined(_WIN32)
+    PROCESS_INFORMATION info;
+#else
+    pid_t pid;
+#endif
+    std::optional<int> code;
+};
+
+shard_process::shard_process(std::vector<std::string> const& args) : process(std::make_unique<handle>())
+{
+#if defined(_WIN32)
+    char path[MAX_PATH];
+    if (!GetModuleFileNameA(nullptr, path, MAX_PATH))
+        throw shard_error("can't find the executable");
+
+    std::string command_line = std::string("\"") + path + "\"";
+    for (auto const& arg : args)
+        command_line += " \"" + arg + "\"";
+
+    STARTUPINFOA startup = {};
+    startup.cb = sizeof(startup);
+    if (!CreateProcessA(path, &command_line[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &process->info))
+        throw shard_error("can't start shard worker");
+    CloseHandle(process->info.hThread);
+#else
+    char const* const path = "/proc/self/exe";
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(path));
+    for (auto const& arg : args)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    if (posix_spawn(&process->pid, path, nullptr, nullptr, argv.data(), environ) != 0)
+        throw shard_error("can't start shard worker");
+#endif
+}
+
+shard_process::~shard_process()
+{
+    if (exit_code())
+        return;
+#if defined(_WIN32)
+    TerminateProcess(process->info.hProcess, 1);
+#else
+    kill(process->pid, SIGKILL);
+#endif
+    wait();
+}
+
+std::optional<int> shard_process::exit_code()
+{
+    if (process->code)
+        return process->code;
+#if defined(_WIN32)
+    if (WaitForSingleObject(process->info.hProcess, 0) != WAIT_OBJECT_0)
+        return std::nullopt;
+    DWORD code;
+    GetExitCodeProcess(process->info.hProcess, &code);
+    CloseHandle(process->info.hProcess);
+    process->code = static_cast<int>(code);
+#else
+    int status;
+    if (waitpid(process->pid, &status, WNOHANG) != process->pid)
+        return std::nullopt;
+    process->code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+#endif
+    return process->code;
+}
+
+int shard_process::wait()
+{
+    if (process->code)
+        return *process->code;
+#if defined(_WIN32)
+    WaitForSingleObject(process->info.hProcess, INFINITE);
+    return *exit_code();
+#else
+    int status;
+    pid_t waited;
+    do
+    {
+        waited = waitpid(process->pid, &status, 0);
+    } while (waited < 0 && errno == EINTR);
+    process->code = waited < 0 ? -1 : WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return *process->code;
+#endif
+}
+
+unsigned long current_process_id()
+{
+#if defined(_WIN32)
+    return GetCurrentProcessId();
+#else
+    return static_cast<unsigned long>(getpid());
+#endif
+}
@@ -0,0 +1,318 @@
+#pragma once
+
+// Sharding a search across worker processes.
+// sharded_search splits [0, total) into segments, as resumable_search does (checkpoint.h), but runs them in
+// separate processes, each a copy of the current executable started with --shard-worker arguments. A worker
+// that crashes takes only its own segments with it: the coordinator hands them to other workers and starts a
+// replacement process.
+// Work and results travel through a shard_transport. shm_transport is the single host implementation: for
+// each worker an inbox and an outbox, single producer single consumer rings laid out in a named shared memory
+// region (POSIX shm_open, or a pagefile backed file mapping on Windows), and a shared best bound that every
+// worker can prune with. With no ring shared between workers, one killed part way through a push or pop
+// can't block the others; the coordinator takes back its inbox once it notices. A transport between hosts
+// only has to implement the same interface.
+// Processes can't wait on each other's atomics portably, so an empty ring is polled with a backoff of up to
+// a millisecond - segments should take much longer than that.
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "topology.h"
+
+class shard_error : public std::runtime_error
+{
+public:
+    explicit shard_error(std::string const& what) : std::runtime_error(what)
+    {
+    }
+};
+
+// Segment segment of the search: [first, last).
+struct shard_work
+{
+    std::uint64_t segment;
+    std::uint64_t first;
+    std::uint64_t last;
+};
+
+struct shard_result
+{
+    std::uint64_t segment;
+    std::uint64_t value;
+};
+
+// Carries work from the coordinator to workers 0 .. workers - 1 and results back. Work is posted to a
+// particular worker, which takes one segment at a time, so the transport knows what each one holds.
+class __declspec(dllexport) shard_transport
+{
+public:
+    virtual ~shard_transport();
+
+    // Coordinator side. try_post returns false if every live worker's queue is full.
+    virtual bool try_post(shard_work const& work) = 0;
+    virtual bool try_collect(shard_result& result) = 0;
+
+    // The segments posted to worker that it didn't return results for - call once it has died. The worker
+    // takes no more until a replacement calls take.
+    virtual std::vector<shard_work> abandoned(unsigned worker) = 0;
+
+    // No work queued and none in progress, so any segment without a result has been lost.
+    virtual bool idle() const = 0;
+
+    // No more work: take() returns false once the queue is empty.
+    virtual void close() = 0;
+
+    // Worker side. take waits for work.
+    virtual bool take(unsigned worker, shard_work& work) = 0;
+    virtual void put(unsigned worker, shard_result const& result) = 0;
+
+    // The best value found so far by any worker, for pruning.
+    virtual std::uint64_t bound() const = 0;
+    virtual void raise_bound(std::uint64_t value) = 0;
+};
+
+// Transport over a named shared memory region on this host.
+class __declspec(dllexport) shm_transport : public shard_transport
+{
+public:
+    static constexpr unsigned max_workers = 256;
+
+    // Coordinator: creates the region, removing it again on destruction.
+    static std::unique_ptr<shm_transport> create(std::string const& name, unsigned workers);
+
+    // Worker: opens the region the coordinator created.
+    static std::unique_ptr<shm_transport> open(std::string const& name);
+
+    ~shm_transport() override;
+
+    bool try_post(shard_work const& work) override;
+    bool try_collect(shard_result& result) override;
+    std::vector<shard_work> abandoned(unsigned worker) override;
+    bool idle() const override;
+    void close() override;
+    bool take(unsigned worker, shard_work& work) override;
+    void put(unsigned worker, shard_result const& result) override;
+    std::uint64_t bound() const override;
+    void raise_bound(std::uint64_t value) override;
+
+private:
+    struct mapping;
+    std::unique_ptr<mapping> mapped;
+
+    explicit shm_transport(std::unique_ptr<mapping> mapped_);
+};
+
+// Make the coordinator's transport for name and a number of workers, and open it from a worker. sharded_search
+// and serve_shard take them, to run over something other than shm_transport.
+typedef std::function<std::unique_ptr<shard_transport>(std::string const& name, unsigned workers)> shard_transport_creator;
+typedef std::function<std::unique_ptr<shard_transport>(std::string const& name)> shard_transport_opener;
+
+// A copy of the current executable, started with args.
+class __declspec(dllexport) shard_process
+{
+public:
+    explicit shard_process(std::vector<std::string> const& args);
+
+    // Kills the process if it's still running.
+    ~shard_process();
+
+    shard_process(shard_process const&) = delete;
+    shard_process& operator=(shard_process const&) = delete;
+
+    // Returns the exit code once the process has ended, without waiting.
+    std::optional<int> exit_code();
+
+    int wait();
+
+private:
+    struct handle;
+    std::unique_ptr<handle> process;
+};
+
+// The process id, for naming regions.
+__declspec(dllexport) unsigned long current_process_id();
+
+struct shard_worker_args
+{
+    std::string job;       // which search, chosen by the caller of sharded_search
+    std::string region;    // transport name
+    unsigned index;
+};
+
+// The worker's arguments if this process was started by sharded_search, checked at the top of main:
+//   if (std::optional<shard_worker_args> const shard = parse_shard_worker_args(argc, argv))
+//       return serve_shard(*shard, ...);
+inline std::optional<shard_worker_args> parse_shard_worker_args(int argc, char const* const* argv)
+{
+    if (argc != 5 || std::string_view(argv[1]) != "--shard-worker")
+        return std::nullopt;
+    return shard_worker_args{ argv[2], argv[3], static_cast<unsigned>(std::stoul(argv[4])) };
+}
+
+// Runs segments until the coordinator closes the transport; func(first, last, bound) returns the result
+// for [first, last), which also raises the shared bound if raise is set. open_transport must match the
+// coordinator's shard_options::create_transport (empty for shm_transport). Returns the process's exit code.
+template<typename Func>
+int serve_shard(shard_worker_args const& args, Func func, bool raise = false,
+    shard_transport_opener const& open_transport = shard_transport_opener())
+{
+    std::unique_ptr<shard_transport> const transport =
+        open_transport ? open_transport(args.region) : shm_transport::open(args.region);
+
+    shard_work work;
+    while (transport->take(args.index, work))
+    {
+        std::uint64_t const value = func(work.first, work.last, transport->bound());
+        if (raise)
+            transport->raise_bound(value);
+        transport->put(args.index, shard_result{ work.segment, value });
+    }
+    return 0;
+}
+
+struct shard_options
+{
+    unsigned workers = 0;        // processes; 0 for one per hardware thread
+    unsigned max_restarts = 8;   // replacement processes started for crashed workers, over the whole search
+    shard_transport_creator create_transport;   // empty for shm_transport
+};
+
+// Returns combine(...combine(init, r0), ...) over the results of every segment [first, last) of [0, total),
+// computed by worker processes running serve_shard for job. combine must be associative and commutative.
+// Throws shard_error if every worker has died and no restarts are left.
+template<typename Combine>
+std::uint64_t sharded_search(std::string const& job, std::uint64_t total, std::uint64_t segment_size,
+    std::uint64_t init, Combine combine, shard_options const& options = shard_options())
+{
+    segment_size = std::max<std::uint64_t>(segment_size, 1);
+    std::uint64_t const segments = (total + segment_size - 1) / segment_size;
+    if (!segments)
+        return init;
+
+    // the default is capped at what shm_transport takes; a given count is up to the transport
+    unsigned const requested = options.workers ? options.workers :
+        options.create_transport ? cpu_topology::host().logical_count() :
+        std::min(cpu_topology::host().logical_count(), shm_transport::max_workers);
+    unsigned const workers = static_cast<unsigned>(std::min<std::uint64_t>(requested, segments));
+
+    std::string const name = "euler_shard_" + std::to_string(current_process_id()) + "_" +
+        std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    std::unique_ptr<shard_transport> const transport =
+        options.create_transport ? options.create_transport(name, workers) : shm_transport::create(name, workers);
+
+    auto start = [&](unsigned index) {
+        return std::make_unique<shard_process>(std::vector<std::string>{ "--shard-worker", job, name, std::to_string(index) });
+    };
+
+    std::vector<std::unique_ptr<shard_process>> processes;
+    for (unsigned i = 0; i < workers; ++i)
+        processes.push_back(start(i));
+
+    std::deque<shard_work> pending;
+    for (std::uint64_t segment = 0; segment < segments; ++segment)
+    {
+        std::uint64_t const first = segment * segment_size;
+        pending.push_back(shard_work{ segment, first, std::min(first + segment_size, total) });
+    }
+    std::vector<bool> finished(static_cast<std::size_t>(segments), false);
+    std::uint64_t remaining = segments;
+    std::uint64_t result = init;
+    unsigned restarts = 0;
+    std::chrono::microseconds backoff(1);
+
+    auto collect = [&]() {
+        bool collected = false;
+        shard_result found;
+        while (transport->try_collect(found))
+        {
+            collected = true;
+            if (finished[static_cast<std::size_t>(found.segment)])
+                continue; // worked twice, after being given up for lost
+            finished[static_cast<std::size_t>(found.segment)] = true;
+            result = combine(result, found.value);
+            --remaining;
+        }
+        return collected;
+    };
+
+    while (remaining)
+    {
+        bool progress = false;
+
+        while (!pending.empty() && transport->try_post(pending.front()))
+        {
+            pending.pop_front();
+            progress = true;
+        }
+
+        if (collect())
+            progress = true;
+
+        unsigned alive = 0;
+        for (unsigned i = 0; i < workers; ++i)
+        {
+            if (!processes[i])
+                continue;
+            if (!processes[i]->exit_code())
+            {
+                ++alive;
+                continue;
+            }
+
+            // crashed (or exited early) - requeue its segments and replace it
+            for (shard_work const& lost : transport->abandoned(i))
+                pending.push_front(lost);
+            processes[i].reset();
+            if (restarts < options.max_restarts)
+            {
+                ++restarts;
+                processes[i] = start(i);
+                ++alive;
+            }
+            progress = true;
+        }
+        if (!alive && remaining)
+            throw shard_error("every shard worker died");
+
+        // a worker that died between taking a segment and recording it leaves no trace but a missing result
+        if (!progress && pending.empty() && transport->idle() && !collect() && remaining)
+        {
+            for (std::uint64_t segment = 0; segment < segments; ++segment)
+            {
+                if (!finished[static_cast<std::size_t>(segment)])
+                {
+                    std::uint64_t const first = segment * segment_size;
+                    pending.push_back(shard_work{ segment, first, std::min(first + segment_size, total) });
+                }
+            }
+        }
+
+        if (progress)
+            backoff = std::chrono::microseconds(1);
+        else
+        {
+            std::this_thread::sleep_for(backoff);
+            backoff = std::min<std::chrono::microseconds>(backoff * 2, std::chrono::milliseconds(1));
+        }
+    }
+
+    transport->close();
+    for (auto& process : processes)
+    {
+        if (process)
+            process->wait();
+    }
+    return result;
+}
@@ -0,0 +1,416 @@
+// sieve.cpp : the linear and segmented sieves, and sieve files, for sieve.h.
+//
+
+#include "stdafx.h"
+
+#include "sieve.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#include "parallel.h"
+#include "topology.h"
+#include "wide_uint.h"
+
+namespace {
+
+char const sieve_magic[8] = { 'E', 'U', 'L', 'R', 'S', 'I', 'E', 'V' };
+std::uint32_t const sieve_version = 1;
+std::size_t const table_count = 5;
+std::size_t const table_alignment = 64;
+
+// Bytes per entry of each table, in sieve_tables order.
+std::size_t const entry_sizes[table_count] = { sizeof(std::uint32_t), sizeof(std::uint32_t), sizeof(std::int8_t),
+    sizeof(std::uint16_t), sizeof(std::uint64_t) };
+
+struct sieve_file_header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t tables;
+    std::uint64_t limit;
+    std::uint64_t offsets[table_count];   // 0 for tables not present
+};
+
+void check_limit(std::uint64_t limit)
+{
+    if (limit > max_sieve_limit)
+        throw sieve_error("sieve limit above 2^32");
+}
+
+// The entries for n = 0 and n = 1, those below limit.
+void set_small_entries(std::uint64_t limit, sieve_outputs const& outputs)
+{
+    for (std::uint32_t n = 0; n < 2 && n < limit; ++n)
+    {
+        if (outputs.smallest_factor)
+            outputs.smallest_factor[n] = n;
+        if (outputs.totient)
+            outputs.totient[n] = n;
+        if (outputs.mobius)
+            outputs.mobius[n] = static_cast<std::int8_t>(n);
+        if (outputs.divisor_count)
+            outputs.divisor_count[n] = static_cast<std::uint16_t>(n);
+        if (outputs.divisor_sum)
+            outputs.divisor_sum[n] = n;
+    }
+}
+
+// A base prime of the segmented sieve, with magic = ceil(2^64 / p): for 32 bit n, n / p is the high half of
+// n * magic, and p divides n just when the low half is below magic (Lemire, Kaser and Kurz).
+struct base_prime
+{
+    std::uint32_t p;
+    std::uint64_t magic;
+
+    explicit base_prime(std::uint32_t p_) : p(p_), magic(UINT64_MAX / p_ + 1)
+    {
+    }
+
+    bool divides(std::uint32_t n) const
+    {
+        return n * magic <= magic - 1;
+    }
+
+    std::uint32_t divide(std::uint32_t n) const
+    {
+        std::uint64_t high;
+        detail::mul_add(magic, n, 0, 0, high);
+        return static_cast<std::uint32_t>(high);
+    }
+};
+
+// Sieves n in [first, last) - rest is scratch for what's left of each n once the base primes are divided out.
+void sieve_segment(std::uint64_t first, std::uint64_t last, std::vector<base_prime> const& primes,
+    sieve_outputs const& outputs, std::vector<std::uint32_t>& rest)
+{
+    std::size_t const length = static_cast<std::size_t>(last - first);
+    std::uint32_t* const factor = outputs.smallest_factor ? outputs.smallest_factor + first : nullptr;
+    std::uint32_t* const totient = outputs.totient ? outputs.totient + first : nullptr;
+    std::int8_t* const mobius = outputs.mobius ? outputs.mobius + first : nullptr;
+    std::uint16_t* const divisor_count = outputs.divisor_count ? outputs.divisor_count + first : nullptr;
+    std::uint64_t* const divisor_sum = outputs.divisor_sum ? outputs.divisor_sum + first : nullptr;
+
+    rest.resize(length);
+    for (std::size_t i = 0; i < length; ++i)
+        rest[i] = static_cast<std::uint32_t>(first + i);
+    if (factor)
+        std::fill(factor, factor + length, 0);
+    if (totient)
+        std::fill(totient, totient + length, 1);
+    if (mobius)
+        std::fill(mobius, mobius + length, 1);
+    if (divisor_count)
+        std::fill(divisor_count, divisor_count + length, 1);
+    if (divisor_sum)
+        std::fill(divisor_sum, divisor_sum + length, 1);
+
+    // Every n < last has at most one prime factor above sqrt(last - 1), so dividing out the primes up to
+    // that leaves 1 or a prime
+    for (base_prime const& prime : primes)
+    {
+        std::uint64_t const p = prime.p;
+        if (p * p >= last)
+            break;
+
+        std::uint64_t const start = std::max<std::uint64_t>((first + p - 1) / p * p, p);
+        for (std::uint64_t n = start; n < last; n += p)
+        {
+            std::size_t const i = static_cast<std::size_t>(n - first);
+            std::uint32_t remaining = rest[i];
+            std::uint64_t power = 1, previous = 1, power_sum = 1;
+            unsigned exponent = 0;
+            do
+            {
+                remaining = prime.divide(remaining);
+                previous = power;
+                power *= p;
+                power_sum += power;
+                ++exponent;
+            } while (prime.divides(remaining));
+            rest[i] = remaining;
+
+            if (factor && !factor[i])
+                factor[i] = prime.p;
+            if (totient)
+                totient[i] *= static_cast<std::uint32_t>(power - previous);
+            if (mobius)
+                mobius[i] = exponent == 1 ? static_cast<std::int8_t>(-mobius[i]) : std::int8_t(0);
+            if (divisor_count)
+                divisor_count[i] = static_cast<std::uint16_t>(divisor_count[i] * (exponent + 1));
+            if (divisor_sum)
+                divisor_sum[i] *= power_sum;
+        }
+    }
+
+    for (std::size_t i = 0; i < length; ++i)
+    {
+        std::uint32_t const q = rest[i];
+        if (q < 2)
+            continue;
+        if (factor && !factor[i])
+            factor[i] = q;
+        if (totient)
+            totient[i] *= q - 1;
+        if (mobius)
+            mobius[i] = static_cast<std::int8_t>(-mobius[i]);
+        if (divisor_count)
+            divisor_count[i] = static_cast<std::uint16_t>(divisor_count[i] * 2);
+        if (divisor_sum)
+            divisor_sum[i] *= std::uint64_t(q) + 1;
+    }
+
+    if (first < 2)
+        set_small_entries(last, outputs);
+}
+
+}  // namespace
+
+void linear_sieve(std::uint64_t limit, sieve_outputs const& outputs)
+{
+    check_limit(limit);
+    std::size_t const length = static_cast<std::size_t>(limit);
+
+    // The smallest factor drives the sieve, so it's needed whether or not it's an output
+    std::vector<std::uint32_t> own_factor;
+    std::uint32_t* factor = outputs.smallest_factor;
+    if (factor)
+        std::fill(factor, factor + length, 0);
+    else
+    {
+        own_factor.resize(length);
+        factor = own_factor.data();
+    }
+
+    // The exponent e of n's smallest prime p, and 1 + p + ... + p^e - n = i * p shares them with i but one
+    std::vector<std::uint8_t> exponents(outputs.divisor_count || outputs.divisor_sum ? length : 0);
+    std::vector<std::uint64_t> power_sums(outputs.divisor_sum ? length : 0);
+
+    std::uint32_t* const totient = outputs.totient;
+    std::int8_t* const mobius = outputs.mobius;
+    std::uint16_t* const divisor_count = outputs.divisor_count;
+    std::uint64_t* const divisor_sum = outputs.divisor_sum;
+    bool const exponent_wanted = !exponents.empty();
+
+    std::vector<std::uint32_t> primes;
+    for (std::uint64_t i = 2; i < limit; ++i)
+    {
+        if (!factor[i])
+        {
+            std::uint32_t const p = static_cast<std::uint32_t>(i);
+            factor[i] = p;
+            primes.push_back(p);
+            if (totient)
+                totient[i] = p - 1;
+            if (mobius)
+                mobius[i] = -1;
+            if (divisor_count)
+                divisor_count[i] = 2;
+            if (divisor_sum)
+                divisor_sum[i] = power_sums[i] = std::uint64_t(p) + 1;
+            if (exponent_wanted)
+                exponents[i] = 1;
+        }
+
+        std::uint32_t const smallest = factor[i];
+        for (std::uint32_t p : primes)
+        {
+            std::uint64_t const n = i * p;
+            if (p > smallest || n >= limit)
+                break;
+
+            factor[n] = p;
+            if (p == smallest)
+            {
+                if (totient)
+                    totient[n] = totient[i] * p;
+                if (mobius)
+                    mobius[n] = 0;
+                if (exponent_wanted)
+                    exponents[n] = static_cast<std::uint8_t>(exponents[i] + 1);
+                if (divisor_count)
+                    divisor_count[n] = static_cast<std::uint16_t>(divisor_count[i] / (exponents[i] + 1) * (exponents[n] + 1));
+                if (divisor_sum)
+                {
+                    power_sums[n] = power_sums[i] * p + 1;
+                    divisor_sum[n] = divisor_sum[i] / power_sums[i] * power_sums[n];
+                }
+            }
+            else
+            {
+                if (totient)
+                    totient[n] = totient[i] * (p - 1);
+                if (mobius)
+                    mobius[n] = static_cast<std::int8_t>(-mobius[i]);
+                if (exponent_wanted)
+                    exponents[n] = 1;
+                if (divisor_count)
+                    divisor_count[n] = static_cast<std::uint16_t>(divisor_count[i] * 2);
+                if (divisor_sum)
+                {
+                    power_sums[n] = std::uint64_t(p) + 1;
+                    divisor_sum[n] = divisor_sum[i] * power_sums[n];
+                }
+            }
+        }
+    }
+
+    set_small_entries(limit, outputs);
+}
+
+void segmented_sieve(std::uint64_t limit, sieve_outputs const& outputs, sieve_options const& options)
+{
+    check_limit(limit);
+    if (limit < 2)
+    {
+        set_small_entries(limit, outputs);
+        return;
+    }
+
+    std::uint64_t root = static_cast<std::uint64_t>(std::sqrt(static_cast<double>(limit - 1)));
+    while (root * root > limit - 1)
+        --root;
+    while ((root + 1) * (root + 1) <= limit - 1)
+        ++root;
+
+    std::vector<base_prime> primes;
+    {
+        sieve_outputs base;
+        std::vector<std::uint32_t> base_factor(static_cast<std::size_t>(root + 1));
+        base.smallest_factor = base_factor.data();
+        linear_sieve(root + 1, base);
+        for (std::uint32_t n = 2; n <= root; ++n)
+        {
+            if (base_factor[n] == n)
+                primes.push_back(base_prime(n));
+        }
+    }
+
+    std::size_t segment_size = options.segment_size;
+    if (!segment_size)
+    {
+        std::size_t bytes = sizeof(std::uint32_t);   // rest
+        unsigned const wanted[table_count] = { outputs.smallest_factor != nullptr, outputs.totient != nullptr,
+            outputs.mobius != nullptr, outputs.divisor_count != nullptr, outputs.divisor_sum != nullptr };
+        for (std::size_t t = 0; t < table_count; ++t)
+            bytes += wanted[t] * entry_sizes[t];
+        segment_size = std::max<std::size_t>(cpu_topology::host().l2_size() / bytes, 4096);
+    }
+
+    std::uint64_t const segments = (limit + segment_size - 1) / segment_size;
+    std::size_t const threads = static_cast<std::size_t>(
+        std::min<std::uint64_t>(options.threads ? options.threads : detail::hardware_threads(), segments));
+
+    // handed out one at a time as threads come free, so segments of uneven cost still balance
+    std::atomic<std::uint64_t> next_segment(0);
+    detail::run_blocks(threads, [&](std::size_t) {
+        std::vector<std::uint32_t> rest;
+        for (std::uint64_t segment; (segment = next_segment.fetch_add(1, std::memory_order_relaxed)) < segments;)
+        {
+            std::uint64_t const first = segment * segment_size;
+            sieve_segment(first, std::min<std::uint64_t>(first + segment_size, limit), primes, outputs, rest);
+        }
+    });
+}
+
+void write_sieve_file(std::string const& path, std::uint64_t limit, unsigned tables, sieve_options const& options)
+{
+    check_limit(limit);
+    tables &= sieve_all;
+
+    sieve_file_header header = {};
+    header.version = sieve_version;
+    header.tables = tables;
+    header.limit = limit;
+
+    std::uint64_t end = (sizeof(header) + table_alignment - 1) / table_alignment * table_alignment;
+    for (std::size_t t = 0; t < table_count; ++t)
+    {
+        if (!(tables & (1u << t)))
+            continue;
+        header.offsets[t] = end;
+        end = (end + limit * entry_sizes[t] + table_alignment - 1) / table_alignment * table_alignment;
+    }
+
+    std::unique_ptr<mapped_file> file = mapped_file::create(path, end);
+    unsigned char* const base = file->data();
+    sieve_outputs outputs;
+    if (tables & sieve_smallest_factor)
+        outputs.smallest_factor = reinterpret_cast<std::uint32_t*>(base + header.offsets[0]);
+    if (tables & sieve_totient)
+        outputs.totient = reinterpret_cast<std::uint32_t*>(base + header.offsets[1]);
+    if (tables & sieve_mobius)
+        outputs.mobius = reinterpret_cast<std::int8_t*>(base + header.offsets[2]);
+    if (tables & sieve_divisor_count)
+        outputs.divisor_count = reinterpret_cast<std::uint16_t*>(base + header.offsets[3]);
+    if (tables & sieve_divisor_sum)
+        outputs.divisor_sum = reinterpret_cast<std::uint64_t*>(base + header.offsets[4]);
+
+    segmented_sieve(limit, outputs, options);
+
+    // The magic goes in last, so a file left half written isn't taken for a sieve file
+    std::memcpy(base, &header, sizeof(header));
+    file->flush();
+    std::memcpy(base, sieve_magic, sizeof(sieve_magic));
+    file->flush();
+}
+
+sieve_file::sieve_file(std::string const& path) : file(mapped_file::open(path)), length(0), present(0), offsets()
+{
+    sieve_file_header header;
+    if (file->size() < sizeof(header))
+        throw sieve_error(path + " is too short for a sieve file");
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic, sieve_magic, sizeof(sieve_magic)) != 0)
+        throw sieve_error(path + " isn't a sieve file");
+    if (header.version != sieve_version)
+        throw sieve_error(path + " is a sieve file of another version");
+    if (header.limit > max_sieve_limit || (header.tables & ~unsigned(sieve_all)))
+        throw sieve_error(path + " has a bad sieve file header");
+
+    for (std::size_t t = 0; t < table_count; ++t)
+    {
+        if (!(header.tables & (1u << t)))
+            continue;
+        std::uint64_t const offset = header.offsets[t];
+        if (offset < sizeof(header) || offset % table_alignment || offset > file->size()
+            || (file->size() - offset) / entry_sizes[t] < header.limit)
+            throw sieve_error(path + " has a table outside the file");
+        offsets[t] = offset;
+    }
+
+    length = header.limit;
+    present = header.tables;
+}
+
+void const* sieve_file::table(unsigned index) const
+{
+    return present & (1u << index) ? file->data() + offsets[index] : nullptr;
+}
+
+std::uint32_t const* sieve_file::smallest_factor() const
+{
+    return static_cast<std::uint32_t const*>(table(0));
+}
+
+std::uint32_t const* sieve_file::totient() const
+{
+    return static_cast<std::uint32_t const*>(table(1));
+}
+
+std::int8_t const* sieve_file::mobius() const
+{
+    return static_cast<std::int8_t const*>(table(2));
+}
+
+std::uint16_t const* sieve_file::divisor_count() const
+{
+    return static_cast<std::uint16_t const*>(table(3));
+}
+
+std::uint64_t const* sieve_file::divisor_sum() const
+{
+    return static_cast<std::uint64_t const*>(table(4));
+}
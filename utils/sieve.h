@@ -0,0 +1,168 @@
+#pragma once
+
+// Tables of the multiplicative functions for every n below a limit, rather than factorising each n in turn:
+// smallest prime factor, Euler's totient phi(n), Mobius mu(n), divisor count d(n) and divisor sum sigma(n).
+//  - linear_sieve is the O(N) linear sieve on one thread. Each composite is reached once, as i * p with p
+//    its smallest prime factor, and its values follow from i's. It needs a table of the exponent of each n's
+//    smallest prime for d(n), and of 1 + p + ... + p^e for sigma(n), so it's for tables that fit in memory.
+//  - segmented_sieve splits [0, limit) into cache sized segments, sieved in parallel. In each, every base
+//    prime p up to sqrt(limit) visits its multiples, divides its powers out and multiplies in their
+//    contribution, and whatever is left over is a prime above sqrt(limit). That's O(N log log N), but in
+//    cache, on every core, and written straight into the output arrays - which can be a mapped file, so the
+//    tables can be bigger than memory (write_sieve_file, read back by sieve_file).
+// Values are as compact as n below 2^32 allows: 32 bits for the smallest factor and phi, 8 for mu, 16 for
+// d(n) (at most 1344) and 64 for sigma(n). Entries 0 and 1 are 0 and 1 (smallest factor 1 for 1).
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+class sieve_error : public std::runtime_error
+{
+public:
+    explicit sieve_error(std::string const& what) : std::runtime_error(what)
+    {
+    }
+};
+
+// Which tables to fill, combined with |.
+enum sieve_tables : unsigned
+{
+    sieve_smallest_factor = 1 << 0,
+    sieve_totient = 1 << 1,
+    sieve_mobius = 1 << 2,
+    sieve_divisor_count = 1 << 3,
+    sieve_divisor_sum = 1 << 4,
+    sieve_all = (1 << 5) - 1
+};
+
+// Limits are at most this, so every n fits in 32 bits.
+std::uint64_t const max_sieve_limit = std::uint64_t(1) << 32;
+
+// Where each table's entry for n = 0 is, nullptr for tables not wanted.
+struct sieve_outputs
+{
+    std::uint32_t* smallest_factor = nullptr;
+    std::uint32_t* totient = nullptr;
+    std::int8_t* mobius = nullptr;
+    std::uint16_t* divisor_count = nullptr;
+    std::uint64_t* divisor_sum = nullptr;
+};
+
+// Tables for n in [0, limit), empty for those not asked for.
+struct multiplicative_tables
+{
+    std::uint64_t limit = 0;
+    std::vector<std::uint32_t> smallest_factor;
+    std::vector<std::uint32_t> totient;
+    std::vector<std::int8_t> mobius;
+    std::vector<std::uint16_t> divisor_count;
+    std::vector<std::uint64_t> divisor_sum;
+
+    // Sizes the tables asked for and returns where they are. Throws sieve_error if limit_ is above
+    // max_sieve_limit.
+    sieve_outputs allocate(std::uint64_t limit_, unsigned tables)
+    {
+        if (limit_ > max_sieve_limit)
+            throw sieve_error("sieve limit above 2^32");
+        limit = limit_;
+        std::size_t const length = static_cast<std::size_t>(limit);
+        sieve_outputs outputs;
+        if (tables & sieve_smallest_factor)
+        {
+            smallest_factor.resize(length);
+            outputs.smallest_factor = smallest_factor.data();
+        }
+        if (tables & sieve_totient)
+        {
+            totient.resize(length);
+            outputs.totient = totient.data();
+        }
+        if (tables & sieve_mobius)
+        {
+            mobius.resize(length);
+            outputs.mobius = mobius.data();
+        }
+        if (tables & sieve_divisor_count)
+        {
+            divisor_count.resize(length);
+            outputs.divisor_count = divisor_count.data();
+        }
+        if (tables & sieve_divisor_sum)
+        {
+            divisor_sum.resize(length);
+            outputs.divisor_sum = divisor_sum.data();
+        }
+        return outputs;
+    }
+};
+
+struct sieve_options
+{
+    std::size_t segment_size = 0;   // numbers per segment; 0 to fit a segment's tables in L2
+    unsigned threads = 0;           // 0 for one per hardware thread
+};
+
+// Fills outputs for n in [0, limit) by the linear sieve. Throws sieve_error if limit is above
+// max_sieve_limit.
+__declspec(dllexport) void linear_sieve(std::uint64_t limit, sieve_outputs const& outputs);
+
+// Fills outputs for n in [0, limit) a segment at a time, on several threads.
+__declspec(dllexport) void segmented_sieve(std::uint64_t limit, sieve_outputs const& outputs,
+    sieve_options const& options = sieve_options());
+
+inline multiplicative_tables linear_sieve(std::uint64_t limit, unsigned tables = sieve_all)
+{
+    multiplicative_tables result;
+    linear_sieve(limit, result.allocate(limit, tables));
+    return result;
+}
+
+inline multiplicative_tables segmented_sieve(std::uint64_t limit, unsigned tables = sieve_all,
+    sieve_options const& options = sieve_options())
+{
+    multiplicative_tables result;
+    segmented_sieve(limit, result.allocate(limit, tables), options);
+    return result;
+}
+
+// Sieves [0, limit) by segmented_sieve into a new file at path: a header, then each table (64 byte aligned).
+__declspec(dllexport) void write_sieve_file(std::string const& path, std::uint64_t limit, unsigned tables,
+    sieve_options const& options = sieve_options());
+
+// The tables in a file from write_sieve_file, mapped read-only - nullptr for those it doesn't have.
+class __declspec(dllexport) sieve_file
+{
+public:
+    // Throws sieve_error if path isn't a sieve file (or mapped_file_error if it can't be mapped).
+    explicit sieve_file(std::string const& path);
+
+    std::uint64_t limit() const
+    {
+        return length;
+    }
+
+    unsigned tables() const
+    {
+        return present;
+    }
+
+    std::uint32_t const* smallest_factor() const;
+    std::uint32_t const* totient() const;
+    std::int8_t const* mobius() const;
+    std::uint16_t const* divisor_count() const;
+    std::uint64_t const* divisor_sum() const;
+
+private:
+    std::unique_ptr<mapped_file> file;
+    std::uint64_t length;
+    unsigned present;
+    std::uint64_t offsets[5];   // of each table, in sieve_tables order
+
+    void const* table(unsigned index) const;
+};
@@ -0,0 +1,210 @@
+// simd.cpp : cpuid detection and dispatch for the simd.h kernels.
+//
+
+#include "stdafx.h"
+
+#include "simd.h"
+
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#include <immintrin.h>
+#define SIMD_X86
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#define SIMD_X86
+#endif
+
+extern detail::simd_kernel_table const scalar_kernels;
+extern detail::simd_kernel_table const sse42_kernels;
+extern detail::simd_kernel_table const avx2_kernels;
+extern detail::simd_kernel_table const avx512_kernels;
+
+namespace {
+
+#if defined(SIMD_X86)
+void cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4])
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+    for (int i = 0; i < 4; ++i)
+        regs[i] = static_cast<unsigned>(info[i]);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// which register state the OS saves on a context switch
+unsigned long long xgetbv0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return static_cast<unsigned long long>(edx) << 32 | eax;
+#endif
+}
+
+bool bit(unsigned reg, int n)
+{
+    return (reg >> n & 1) != 0;
+}
+
+isa_level detect()
+{
+    unsigned regs[4]; // eax, ebx, ecx, edx
+    cpuid(0, 0, regs);
+    unsigned const max_leaf = regs[0];
+
+    cpuid(1, 0, regs);
+    if (!bit(regs[2], 19) || !bit(regs[2], 20) || !bit(regs[2], 23)) // SSE4.1, SSE4.2, POPCNT
+        return isa_level::scalar;
+
+    bool const avx = bit(regs[2], 28) && bit(regs[2], 12); // AVX, FMA
+    if (!avx || !bit(regs[2], 27) || max_leaf < 7) // OSXSAVE
+        return isa_level::sse42;
+
+    unsigned long long const xcr0 = xgetbv0();
+    if ((xcr0 & 0x6) != 0x6) // XMM and YMM state
+        return isa_level::sse42;
+
+    cpuid(7, 0, regs);
+    if (!bit(regs[1], 5) || !bit(regs[1], 8)) // AVX2, BMI2
+        return isa_level::sse42;
+
+    bool const avx512 = bit(regs[1], 16) && bit(regs[1], 17) && bit(regs[1], 30) && bit(regs[1], 31); // F DQ BW VL
+    if (!avx512 || (xcr0 & 0xE0) != 0xE0) // opmask, upper ZMM and high ZMM state
+        return isa_level::avx2;
+
+    return isa_level::avx512;
+}
+#else
+isa_level detect()
+{
+    return isa_level::scalar;
+}
+#endif
+
+detail::simd_kernel_table const* table_for(isa_level level)
+{
+    switch (level)
+    {
+    case isa_level::avx512:
+        return &avx512_kernels;
+    case isa_level::avx2:
+        return &avx2_kernels;
+    case isa_level::sse42:
+        return &sse42_kernels;
+    default:
+        return &scalar_kernels;
+    }
+}
+
+// detected on first use, so kernels called from other files' static initialisers still dispatch
+struct dispatch
+{
+    isa_level const detected;
+    std::atomic<isa_level> active;
+    std::atomic<detail::simd_kernel_table const*> kernels;
+
+    dispatch() : detected(detect()), active(detected), kernels(table_for(detected))
+    {
+    }
+};
+
+dispatch& state()
+{
+    static dispatch d;
+    return d;
+}
+
+detail::simd_kernel_table const& current()
+{
+    return *state().kernels.load(std::memory_order_relaxed);
+}
+
+}  // namespace
+
+isa_level cpu_isa()
+{
+    return state().detected;
+}
+
+isa_level kernel_isa()
+{
+    return state().active.load(std::memory_order_relaxed);
+}
+
+isa_level set_kernel_isa(isa_level level)
+{
+    dispatch& d = state();
+    if (level > d.detected)
+        level = d.detected;
+    d.active.store(level, std::memory_order_relaxed);
+    d.kernels.store(table_for(level), std::memory_order_relaxed);
+    return level;
+}
+
+char const* isa_name(isa_level level)
+{
+    switch (level)
+    {
+    case isa_level::avx512:
+        return "avx512";
+    case isa_level::avx2:
+        return "avx2";
+    case isa_level::sse42:
+        return "sse4.2";
+    default:
+        return "scalar";
+    }
+}
+
+long long simd_sum(int const* data, std::size_t length)
+{
+    return current().sum_i32(data, length);
+}
+
+long long simd_sum(long long const* data, std::size_t length)
+{
+    return current().sum_i64(data, length);
+}
+
+void simd_mark_palindromes(std::uint32_t const* values, std::size_t length, std::uint8_t* is_palindrome)
+{
+    current().mark_palindromes(values, length, is_palindrome);
+}
+
+std::size_t simd_count_primes(std::uint32_t first, std::uint32_t last)
+{
+    if (first >= last)
+        return 0;
+
+    // the primes up to sqrt(last - 1), by a small sieve, are the divisors to try
+    std::uint32_t const limit = static_cast<std::uint32_t>(std::sqrt(static_cast<double>(last - 1))) + 1;
+    std::vector<bool> composite(limit + 1, false);
+    std::vector<std::uint32_t> divisors;
+    std::vector<std::uint64_t> magic;
+    for (std::uint32_t d = 2; d <= limit; ++d)
+    {
+        if (composite[d])
+            continue;
+        divisors.push_back(d);
+        magic.push_back(UINT64_MAX / d + 1);
+        for (std::uint64_t multiple = std::uint64_t(d) * d; multiple <= limit; multiple += d)
+            composite[static_cast<std::size_t>(multiple)] = true;
+    }
+
+    return current().count_undivided(first, last, divisors.data(), magic.data(), divisors.size());
+}
+
+void simd_montgomery_multiply(std::uint32_t const* x, std::uint32_t const* y, std::uint32_t* products,
+    std::size_t length, std::uint32_t modulus, std::uint32_t inverse)
+{
+    current().montgomery_multiply(x, y, products, length, modulus, inverse);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+// Runtime CPU feature dispatch for the vectorised kernels.
+// The kernels (simd_kernels.h) are compiled once per instruction set level, in simd_scalar.cpp,
+// simd_sse42.cpp, simd_avx2.cpp and simd_avx512.cpp, and the best level this CPU and OS support is picked
+// via cpuid the first time one is called - so one binary runs the AVX-512 loops where it can and the baseline
+// ones elsewhere. set_kernel_isa() switches levels, eg to compare them in a benchmark.
+
+#include <cstddef>
+#include <cstdint>
+
+enum class isa_level
+{
+    scalar, // the compiler's baseline (SSE2 on x64)
+    sse42,
+    avx2,
+    avx512  // F, BW, DQ and VL
+};
+
+// Best level the CPU and OS support.
+__declspec(dllexport) isa_level cpu_isa();
+
+// Level the kernels are running at - cpu_isa() unless set_kernel_isa() lowered it.
+__declspec(dllexport) isa_level kernel_isa();
+
+// Selects level, or the best supported level below it. Not safe to call while kernels are running.
+__declspec(dllexport) isa_level set_kernel_isa(isa_level level);
+
+__declspec(dllexport) char const* isa_name(isa_level level);
+
+__declspec(dllexport) long long simd_sum(int const* data, std::size_t length);
+__declspec(dllexport) long long simd_sum(long long const* data, std::size_t length);
+
+// is_palindrome[i] = 1 if values[i] reads the same reversed (in decimal), otherwise 0.
+__declspec(dllexport) void simd_mark_palindromes(std::uint32_t const* values, std::size_t length,
+    std::uint8_t* is_palindrome);
+
+// Primes in [first, last), by trial division of blocks of candidates at once.
+__declspec(dllexport) std::size_t simd_count_primes(std::uint32_t first, std::uint32_t last);
+
+// products[i] = x[i] * y[i] / 2^32 mod modulus, the Montgomery product of residues below an odd modulus, with
+// inverse = modulus^-1 mod 2^32 (see montgomery in modular.h).
+__declspec(dllexport) void simd_montgomery_multiply(std::uint32_t const* x, std::uint32_t const* y,
+    std::uint32_t* products, std::size_t length, std::uint32_t modulus, std::uint32_t inverse);
+
+namespace detail {
+
+// One per level, defined by including simd_kernels.h.
+struct simd_kernel_table
+{
+    long long (*sum_i32)(int const* data, std::size_t length);
+    long long (*sum_i64)(long long const* data, std::size_t length);
+    void (*mark_palindromes)(std::uint32_t const* values, std::size_t length, std::uint8_t* is_palindrome);
+    // candidates in [first, last), at least 2, with no divisor d among divisors with d * d <= candidate;
+    // magic[i] = UINT64_MAX / divisors[i] + 1
+    std::size_t (*count_undivided)(std::uint32_t first, std::uint32_t last, std::uint32_t const* divisors,
+        std::uint64_t const* magic, std::size_t num_divisors);
+    void (*montgomery_multiply)(std::uint32_t const* x, std::uint32_t const* y, std::uint32_t* products,
+        std::size_t length, std::uint32_t modulus, std::uint32_t inverse);
+};
+
+}  // namespace detail
@@ -0,0 +1,23 @@
+// simd_avx512.cpp : the simd.h kernels compiled for AVX-512 (F, BW, DQ and VL).
+// Built with /arch:AVX512 (EnableEnhancedInstructionSet in utils.vcxproj), and without the precompiled
+// header, which is built without it.
+
+#include "stdafx.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f,avx512bw,avx512dq,avx512vl,avx2,bmi2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC target("avx512f,avx512bw,avx512dq,avx512vl,avx2,bmi2,fma")
+#endif
+#endif
+
+#define SIMD_TABLE avx512_kernels
+#include "simd_kernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__clang__)
+#pragma clang attribute pop
+#endif
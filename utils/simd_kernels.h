@@ -0,0 +1,122 @@
+#pragma once
+
+// Kernel bodies for simd.h - included once by each simd_<level>.cpp, which sets the instruction set for the
+// file and defines SIMD_TABLE to name its table.
+// The loops are plain C++ written for the auto-vectoriser: fixed trip counts, no early exits and selects
+// instead of branches. Everything here has internal linkage and calls nothing from the standard library, so
+// no inline function compiled for one level can be picked by the linker for a caller at another.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "simd.h"
+
+#ifndef SIMD_TABLE
+#error define SIMD_TABLE before including simd_kernels.h
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize("tree-vectorize", "unroll-loops")
+#endif
+
+namespace {
+
+// candidates tested together by count_undivided
+std::size_t const trial_block = 1024;
+
+long long sum_i32(int const* data, std::size_t length)
+{
+    long long sum = 0;
+    for (std::size_t i = 0; i < length; ++i)
+        sum += data[i];
+    return sum;
+}
+
+// unsigned, so overflow wraps rather than being undefined
+long long sum_i64(long long const* data, std::size_t length)
+{
+    std::uint64_t sum = 0;
+    for (std::size_t i = 0; i < length; ++i)
+        sum += static_cast<std::uint64_t>(data[i]);
+    return static_cast<long long>(sum);
+}
+
+// Reverses every value's digits in lockstep, for as many rounds as the longest value has digits; a lane
+// whose value has run out of digits keeps its result.
+void mark_palindromes(std::uint32_t const* values, std::size_t length, std::uint8_t* is_palindrome)
+{
+    for (std::size_t i = 0; i < length; ++i)
+    {
+        std::uint32_t rest = values[i];
+        std::uint64_t reversed = 0;
+        for (int digit = 0; digit < 10; ++digit)
+        {
+            std::uint32_t const quotient = rest / 10;
+            std::uint64_t const next = reversed * 10 + (rest - quotient * 10);
+            reversed = rest ? next : reversed;
+            rest = quotient;
+        }
+        is_palindrome[i] = static_cast<std::uint8_t>(reversed == values[i]);
+    }
+}
+
+// n % d == 0 exactly when n * magic (mod 2^64) <= magic - 1, for 32 bit n (Lemire, Kaser and Kurz) - a
+// multiply that vectorises where division doesn't.
+std::size_t count_undivided(std::uint32_t first, std::uint32_t last, std::uint32_t const* divisors,
+    std::uint64_t const* magic, std::size_t num_divisors)
+{
+    std::size_t count = 0;
+    std::uint64_t candidates[trial_block];
+    std::uint64_t divided[trial_block];
+
+    for (std::uint64_t base = first; base < last; base += trial_block)
+    {
+        std::size_t const length = static_cast<std::size_t>(last - base < trial_block ? last - base : trial_block);
+        std::uint64_t const top = base + length - 1;
+
+        for (std::size_t i = 0; i < length; ++i)
+        {
+            candidates[i] = base + i;
+            divided[i] = candidates[i] < 2;
+        }
+
+        for (std::size_t k = 0; k < num_divisors; ++k)
+        {
+            std::uint64_t const d = divisors[k];
+            if (d * d > top)
+                break;
+
+            std::uint64_t const m = magic[k];
+            for (std::size_t i = 0; i < length; ++i)
+            {
+                std::uint64_t const n = candidates[i];
+                divided[i] |= static_cast<std::uint64_t>(n * m <= m - 1) & static_cast<std::uint64_t>(d * d <= n);
+            }
+        }
+
+        for (std::size_t i = 0; i < length; ++i)
+            count += static_cast<std::size_t>(divided[i] == 0);
+    }
+    return count;
+}
+
+// REDC a lane at a time: with m = lo(x * y) * inverse, m * modulus has the same low half as x * y, so the
+// product is hi(x * y) - hi(m * modulus), plus modulus if that went below 0 - a select, not a branch.
+void montgomery_multiply(std::uint32_t const* x, std::uint32_t const* y, std::uint32_t* products,
+    std::size_t length, std::uint32_t modulus, std::uint32_t inverse)
+{
+    for (std::size_t i = 0; i < length; ++i)
+    {
+        std::uint64_t const product = static_cast<std::uint64_t>(x[i]) * y[i];
+        std::uint32_t const m = static_cast<std::uint32_t>(product) * inverse;
+        std::uint32_t const high = static_cast<std::uint32_t>(product >> 32);
+        std::uint32_t const m_high = static_cast<std::uint32_t>((static_cast<std::uint64_t>(m) * modulus) >> 32);
+        products[i] = high - m_high + (high < m_high ? modulus : 0);
+    }
+}
+
+}  // namespace
+
+extern detail::simd_kernel_table const SIMD_TABLE;
+detail::simd_kernel_table const SIMD_TABLE = { &sum_i32, &sum_i64, &mark_palindromes, &count_undivided,
+    &montgomery_multiply };
@@ -0,0 +1,11 @@
+// simd_scalar.cpp : the simd.h kernels compiled for the compiler's baseline instruction set.
+// Built with the project's default settings.
+
+#include "stdafx.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#define SIMD_TABLE scalar_kernels
+#include "simd_kernels.h"
+
@@ -0,0 +1,22 @@
+// simd_sse42.cpp : the simd.h kernels compiled for SSE4.2.
+// MSVC has no /arch switch between SSE2 and AVX, so there this file builds at the baseline.
+
+#include "stdafx.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse4.2,popcnt"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC target("sse4.2,popcnt")
+#endif
+#endif
+
+#define SIMD_TABLE sse42_kernels
+#include "simd_kernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__clang__)
+#pragma clang attribute pop
+#endif
@@ -0,0 +1,233 @@
+#pragma once
+
+// Wait free single producer, single consumer ring buffer.
+// The producer owns tail, the consumer owns head, each on its own cache line next to a cached copy of the
+// other side's index - so a push or pop only reads the other side's line when its cached copy says the ring
+// is full/empty. push_n/pop_n move a batch for one index update.
+// With Blocking, push and wait_and_pop spin then park when the ring is full/empty; without it there's no
+// notification cost at all and only the try_ operations are available.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "atomic_wait.h"
+#include "per_thread.h"
+
+template<typename T, bool Blocking = false>
+class spsc_queue
+{
+private:
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type slot;
+
+    std::size_t const mask;
+    std::unique_ptr<slot[]> const buffer;
+
+    // consumer's line
+    alignas(cache_line_size) std::atomic<std::size_t> head;
+    std::size_t cached_tail;
+
+    // producer's line
+    alignas(cache_line_size) std::atomic<std::size_t> tail;
+    std::size_t cached_head;
+
+    alignas(cache_line_size) event_count not_empty;
+    alignas(cache_line_size) event_count not_full;
+
+    static std::size_t round_up_pow2(std::size_t n)
+    {
+        std::size_t size = 2;
+        while (size < n)
+            size <<= 1;
+        return size;
+    }
+
+    T* at(std::size_t pos) const
+    {
+        return reinterpret_cast<T*>(&buffer[pos & mask]);
+    }
+
+    // free slots, refreshing the cached head if fewer than wanted
+    std::size_t free_slots(std::size_t pos, std::size_t wanted)
+    {
+        std::size_t free = mask + 1 - (pos - cached_head);
+        if (free < wanted)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            free = mask + 1 - (pos - cached_head);
+        }
+        return free;
+    }
+
+    // filled slots, refreshing the cached tail if fewer than wanted
+    std::size_t filled_slots(std::size_t pos, std::size_t wanted)
+    {
+        std::size_t filled = cached_tail - pos;
+        if (filled < wanted)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            filled = cached_tail - pos;
+        }
+        return filled;
+    }
+
+    void pushed()
+    {
+        if (Blocking)
+            not_empty.notify_one();
+    }
+
+    void popped()
+    {
+        if (Blocking)
+            not_full.notify_one();
+    }
+
+public:
+    // capacity is rounded up to a power of two
+    explicit spsc_queue(std::size_t capacity = 1024) :
+        mask(round_up_pow2(capacity) - 1),
+        buffer(new slot[mask + 1]),
+        head(0),
+        cached_tail(0),
+        tail(0),
+        cached_head(0)
+    {
+    }
+
+    ~spsc_queue()
+    {
+        std::size_t const last = tail.load(std::memory_order_relaxed);
+        for (std::size_t pos = head.load(std::memory_order_relaxed); pos != last; ++pos)
+        {
+            at(pos)->~T();
+        }
+    }
+
+    spsc_queue(spsc_queue const&) = delete;
+    spsc_queue& operator=(spsc_queue const&) = delete;
+
+    // producer
+
+    bool try_push(T& new_value)
+    {
+        std::size_t const pos = tail.load(std::memory_order_relaxed);
+        if (!free_slots(pos, 1))
+            return false;
+
+        new (at(pos)) T(std::move(new_value));
+        tail.store(pos + 1, std::memory_order_release);
+        pushed();
+        return true;
+    }
+
+    // Moves up to count values from first, returning how many fit.
+    template<typename InputIterator>
+    std::size_t push_n(InputIterator first, std::size_t count)
+    {
+        std::size_t const pos = tail.load(std::memory_order_relaxed);
+        std::size_t const n = std::min(count, free_slots(pos, count));
+
+        for (std::size_t i = 0; i < n; ++i, ++first)
+        {
+            new (at(pos + i)) T(std::move(*first));
+        }
+
+        if (n)
+        {
+            tail.store(pos + n, std::memory_order_release);
+            pushed();
+        }
+        return n;
+    }
+
+    void push(T new_value)
+    {
+        static_assert(Blocking, "push waits for space - use spsc_queue<T, true> or try_push");
+        not_full.wait_until([&] { return try_push(new_value); });
+    }
+
+    // Pushes all count values, waiting for space as needed.
+    template<typename ForwardIterator>
+    void push_all(ForwardIterator first, std::size_t count)
+    {
+        static_assert(Blocking, "push_all waits for space - use spsc_queue<T, true> or push_n");
+        while (count)
+        {
+            std::size_t n = 0;
+            not_full.wait_until([&] { return (n = push_n(first, count)) != 0; });
+            std::advance(first, n);
+            count -= n;
+        }
+    }
+
+    // consumer
+
+    bool try_pop(T& value)
+    {
+        std::size_t const pos = head.load(std::memory_order_relaxed);
+        if (!filled_slots(pos, 1))
+            return false;
+
+        T* const stored = at(pos);
+        value = std::move(*stored);
+        stored->~T();
+        head.store(pos + 1, std::memory_order_release);
+        popped();
+        return true;
+    }
+
+    // Moves up to max_count values to out, returning how many were available.
+    template<typename OutputIterator>
+    std::size_t pop_n(OutputIterator out, std::size_t max_count)
+    {
+        std::size_t const pos = head.load(std::memory_order_relaxed);
+        std::size_t const n = std::min(max_count, filled_slots(pos, max_count));
+
+        for (std::size_t i = 0; i < n; ++i, ++out)
+        {
+            T* const stored = at(pos + i);
+            *out = std::move(*stored);
+            stored->~T();
+        }
+
+        if (n)
+        {
+            head.store(pos + n, std::memory_order_release);
+            popped();
+        }
+        return n;
+    }
+
+    void wait_and_pop(T& value)
+    {
+        static_assert(Blocking, "wait_and_pop waits for data - use spsc_queue<T, true> or try_pop");
+        not_empty.wait_until([&] { return try_pop(value); });
+    }
+
+    // Waits for at least one value, then pops up to max_count.
+    template<typename OutputIterator>
+    std::size_t wait_and_pop_n(OutputIterator out, std::size_t max_count)
+    {
+        static_assert(Blocking, "wait_and_pop_n waits for data - use spsc_queue<T, true> or pop_n");
+        std::size_t n = 0;
+        not_empty.wait_until([&] { return (n = pop_n(out, max_count)) != 0; });
+        return n;
+    }
+
+    // either side, only a snapshot
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    std::size_t capacity() const
+    {
+        return mask + 1;
+    }
+};
@@ -0,0 +1,835 @@
+#pragma once
+
+// C++20 coroutine tasks on the thread_pool.
+// task<T> is lazy: it starts when awaited, and co_await on a task transfers straight into it (and back out
+// again at its end) by symmetric transfer, so awaiting a sub-task is a couple of jumps, with no thread or
+// pool round trip and no stack growth however deep the chain. Frames come from per-thread size class free
+// lists (detail::frame_pool), so a spawn costs nanoseconds rather than a std::thread or std::async.
+// Where work runs is explicit:
+//   co_await schedule_on(pool)          continue on a pool worker
+//   co_await when_all_on(pool, tasks)   run tasks in parallel on the pool, resume once all are done
+//   co_await delay(pool, duration)      resume on the pool after duration
+//   co_await queue.pop()                resume once an async_queue has a value
+//   co_await scheduler.schedule()       resume on the thread running a thread_scheduler (eg a GUI thread)
+//   co_await future                     resume once a task_future (see future.h) is ready
+// start(pool, task) and sync_wait(task) bridge from ordinary code.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "adaptive_sync.h"
+#include "future.h"
+#include "thread_pool.h"
+
+template<typename T = void>
+class task;
+
+namespace detail {
+
+// Coroutine frame allocator - free lists per size class and per thread, so allocating a frame is a pop and
+// freeing one a push. Frames freed on another thread join that thread's lists; each list keeps at most
+// max_cached blocks and returns the rest to the heap.
+class frame_pool
+{
+public:
+    static std::size_t const granularity = 64;
+    static std::size_t const num_classes = 16; // frames up to 1KB, larger go to the heap
+    static std::size_t const max_cached = 1024;
+
+    static void* allocate(std::size_t size)
+    {
+        std::size_t const index = class_of(size);
+        if (index >= num_classes)
+            return ::operator new(size);
+
+        free_list& list = lists().classes[index];
+        if (block* const b = list.head)
+        {
+            list.head = b->next;
+            --list.count;
+            return b;
+        }
+        return ::operator new((index + 1) * granularity);
+    }
+
+    static void deallocate(void* p, std::size_t size)
+    {
+        std::size_t const index = class_of(size);
+        if (index >= num_classes)
+        {
+            ::operator delete(p);
+            return;
+        }
+
+        free_list& list = lists().classes[index];
+        if (list.count >= max_cached)
+        {
+            ::operator delete(p);
+            return;
+        }
+
+        block* const b = static_cast<block*>(p);
+        b->next = list.head;
+        list.head = b;
+        ++list.count;
+    }
+
+private:
+    struct block
+    {
+        block* next;
+    };
+
+    struct free_list
+    {
+        block* head = nullptr;
+        std::size_t count = 0;
+    };
+
+    struct thread_lists
+    {
+        free_list classes[num_classes];
+
+        ~thread_lists()
+        {
+            for (free_list& list : classes)
+            {
+                while (block* const b = list.head)
+                {
+                    list.head = b->next;
+                    ::operator delete(b);
+                }
+            }
+        }
+    };
+
+    static std::size_t class_of(std::size_t size)
+    {
+        return (size + granularity - 1) / granularity - 1;
+    }
+
+    static thread_lists& lists()
+    {
+        thread_local thread_lists lists;
+        return lists;
+    }
+};
+
+struct promise_base
+{
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    static void* operator new(std::size_t size)
+    {
+        return frame_pool::allocate(size);
+    }
+
+    static void operator delete(void* p, std::size_t size)
+    {
+        frame_pool::deallocate(p, size);
+    }
+
+    // resumes whoever awaited the task, by symmetric transfer
+    struct final_awaiter
+    {
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) const noexcept
+        {
+            std::coroutine_handle<> const next = finished.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+    };
+
+    std::suspend_always initial_suspend() const noexcept
+    {
+        return {};
+    }
+
+    final_awaiter final_suspend() const noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception() noexcept
+    {
+        error = std::current_exception();
+    }
+};
+
+template<typename T>
+struct task_promise_type : promise_base
+{
+    std::optional<T> value;
+
+    task<T> get_return_object() noexcept;
+
+    template<typename U>
+    void return_value(U&& result)
+    {
+        value.emplace(std::forward<U>(result));
+    }
+
+    T result()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template<>
+struct task_promise_type<void> : promise_base
+{
+    task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept
+    {
+    }
+
+    void result() const
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+// Fire and forget coroutine for starting tasks from outside - runs when resumed, frees itself at the end.
+struct detached
+{
+    struct promise_type
+    {
+        static void* operator new(std::size_t size)
+        {
+            return frame_pool::allocate(size);
+        }
+
+        static void operator delete(void* p, std::size_t size)
+        {
+            frame_pool::deallocate(p, size);
+        }
+
+        detached get_return_object() noexcept
+        {
+            return detached{ std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+
+        std::suspend_always initial_suspend() const noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never final_suspend() const noexcept
+        {
+            return {};
+        }
+
+        void return_void() const noexcept
+        {
+        }
+
+        // detached bodies catch everything themselves
+        void unhandled_exception() const noexcept
+        {
+            std::terminate();
+        }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+}  // namespace detail
+
+template<typename T>
+class [[nodiscard]] task
+{
+public:
+    typedef detail::task_promise_type<T> promise_type;
+
+    task() noexcept
+    {
+    }
+
+    explicit task(std::coroutine_handle<promise_type> handle_) noexcept : handle(handle_)
+    {
+    }
+
+    task(task&& other) noexcept : handle(std::exchange(other.handle, nullptr))
+    {
+    }
+
+    task& operator=(task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    ~task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    task(task const&) = delete;
+    task& operator=(task const&) = delete;
+
+    bool valid() const noexcept
+    {
+        return handle != nullptr;
+    }
+
+    // Starts the task and suspends the awaiter until it finishes, returning its result.
+    auto operator co_await() noexcept
+    {
+        struct awaiter
+        {
+            std::coroutine_handle<promise_type> callee;
+
+            bool await_ready() const noexcept
+            {
+                return !callee || callee.done();
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+            {
+                callee.promise().continuation = caller;
+                return callee;
+            }
+
+            T await_resume()
+            {
+                return callee.promise().result();
+            }
+        };
+        return awaiter{ handle };
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+
+template<typename T>
+task<T> task_promise_type<T>::get_return_object() noexcept
+{
+    return task<T>(std::coroutine_handle<task_promise_type>::from_promise(*this));
+}
+
+inline task<void> task_promise_type<void>::get_return_object() noexcept
+{
+    return task<void>(std::coroutine_handle<task_promise_type>::from_promise(*this));
+}
+
+// Due coroutines are posted to their pool by one background thread.
+class timer_service
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    static timer_service& instance()
+    {
+        static timer_service service;
+        return service;
+    }
+
+    void add(clock::time_point due, thread_pool& pool, std::coroutine_handle<> handle)
+    {
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            timers.push(timer{ due, &pool, handle });
+        }
+        cond.notify_one();
+    }
+
+private:
+    struct timer
+    {
+        clock::time_point due;
+        thread_pool* pool;
+        std::coroutine_handle<> handle;
+
+        bool operator>(timer const& other) const
+        {
+            return due > other.due;
+        }
+    };
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::priority_queue<timer, std::vector<timer>, std::greater<timer>> timers;
+    bool done;
+    std::thread worker;
+
+    timer_service() : done(false), worker(&timer_service::run, this)
+    {
+    }
+
+    ~timer_service()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            done = true;
+        }
+        cond.notify_one();
+        worker.join();
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lk(mutex);
+        while (!done)
+        {
+            if (timers.empty())
+            {
+                cond.wait(lk);
+                continue;
+            }
+
+            timer const next = timers.top();
+            if (clock::now() < next.due)
+            {
+                cond.wait_until(lk, next.due);
+                continue;
+            }
+
+            timers.pop();
+            lk.unlock();
+            std::coroutine_handle<> const handle = next.handle;
+            next.pool->post([handle]() { handle.resume(); });
+            lk.lock();
+        }
+    }
+};
+
+}  // namespace detail
+
+// co_await schedule_on(pool) - the rest of the coroutine runs on a pool worker.
+inline auto schedule_on(thread_pool& pool) noexcept
+{
+    struct awaiter
+    {
+        thread_pool& pool;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) const
+        {
+            pool.post([handle]() { handle.resume(); });
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+    };
+    return awaiter{ pool };
+}
+
+// co_await delay(pool, duration) - resumes on pool once duration has passed, without holding a thread.
+template<typename Rep, typename Period>
+auto delay(thread_pool& pool, std::chrono::duration<Rep, Period> duration)
+{
+    struct awaiter
+    {
+        thread_pool& pool;
+        detail::timer_service::clock::time_point due;
+
+        bool await_ready() const noexcept
+        {
+            return detail::timer_service::clock::now() >= due;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) const
+        {
+            detail::timer_service::instance().add(due, pool, handle);
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+    };
+    return awaiter{ pool, detail::timer_service::clock::now() +
+        std::chrono::duration_cast<detail::timer_service::clock::duration>(duration) };
+}
+
+// Runs every task in parallel on pool; the awaiter resumes once all have finished, with their results in
+// order (or the first exception). The last task to finish resumes the awaiter directly.
+template<typename T>
+task<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>> when_all_on(thread_pool& pool,
+    std::vector<task<T>> tasks)
+{
+    typedef std::conditional_t<std::is_void_v<T>, detail::unit, std::optional<T>> slot;
+
+    struct join_state
+    {
+        std::atomic<std::size_t> remaining;
+        std::coroutine_handle<> waiter;
+        std::vector<slot> results;
+        std::mutex error_mutex;
+        std::exception_ptr error;
+    };
+
+    struct join_awaiter
+    {
+        join_state& state;
+        thread_pool& pool;
+        std::vector<task<T>>& tasks;
+
+        static detail::detached run_one(join_state& state, thread_pool& pool, task<T>& child, std::size_t index)
+        {
+            co_await schedule_on(pool);
+            try
+            {
+                if constexpr (std::is_void_v<T>)
+                    co_await child;
+                else
+                    state.results[index].emplace(co_await child);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lk(state.error_mutex);
+                if (!state.error)
+                    state.error = std::current_exception();
+            }
+
+            if (state.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                state.waiter.resume();
+        }
+
+        bool await_ready() const noexcept
+        {
+            return tasks.empty();
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            state.waiter = handle;
+            for (std::size_t i = 0; i < tasks.size(); ++i)
+                run_one(state, pool, tasks[i], i).handle.resume();
+
+            // the extra count stops a fast finisher resuming us before we've suspended
+            return state.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+    };
+
+    join_state state;
+    state.remaining.store(tasks.size() + 1, std::memory_order_relaxed);
+    state.results.resize(tasks.size());
+
+    co_await join_awaiter{ state, pool, tasks };
+
+    if (state.error)
+        std::rethrow_exception(state.error);
+
+    if constexpr (!std::is_void_v<T>)
+    {
+        std::vector<T> results;
+        results.reserve(state.results.size());
+        for (auto& result : state.results)
+            results.push_back(std::move(*result));
+        co_return results;
+    }
+}
+
+// Runs t on pool, returning a task_future for its result.
+template<typename T>
+task_future<T> start(thread_pool& pool, task<T> t)
+{
+    struct runner
+    {
+        static detail::detached run(thread_pool& pool, task<T> t, task_promise<T> promise)
+        {
+            co_await schedule_on(pool);
+            try
+            {
+                if constexpr (std::is_void_v<T>)
+                {
+                    co_await t;
+                    promise.set_value();
+                }
+                else
+                {
+                    promise.set_value(co_await t);
+                }
+            }
+            catch (...)
+            {
+                promise.set_exception(std::current_exception());
+            }
+        }
+    };
+
+    task_promise<T> promise(pool);
+    task_future<T> result = promise.get_future();
+    runner::run(pool, std::move(t), std::move(promise)).handle.resume();
+    return result;
+}
+
+// Runs t to completion from ordinary code, blocking the calling thread (which runs the task until its
+// first hop elsewhere).
+template<typename T>
+T sync_wait(task<T> t)
+{
+    struct runner
+    {
+        static detail::detached run(task<T> t, task_promise<T> promise)
+        {
+            try
+            {
+                if constexpr (std::is_void_v<T>)
+                {
+                    co_await t;
+                    promise.set_value();
+                }
+                else
+                {
+                    promise.set_value(co_await t);
+                }
+            }
+            catch (...)
+            {
+                promise.set_exception(std::current_exception());
+            }
+        }
+    };
+
+    task_promise<T> promise;
+    task_future<T> result = promise.get_future();
+    runner::run(std::move(t), std::move(promise)).handle.resume();
+    return result.get();
+}
+
+// co_await future - resumes once the task_future is ready, on its pool. The resume is registered on the
+// shared state rather than as a then() stage, which a cancelled chain would skip, leaving the coroutine
+// suspended for good.
+template<typename T>
+auto operator co_await(task_future<T>&& future)
+{
+    struct awaiter
+    {
+        task_future<T> pending;
+
+        bool await_ready() const
+        {
+            return pending.is_ready();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            // pending keeps the state alive until the coroutine resumes
+            detail::shared_state<T>* const state = detail::future_access::state(pending).get();
+            state->on_ready([state, handle]() { state->pool.post([handle]() { handle.resume(); }); });
+        }
+
+        T await_resume()
+        {
+            return pending.get();
+        }
+    };
+    return awaiter{ std::move(future) };
+}
+
+// Queue whose pop is awaited rather than blocked on - a popping coroutine is suspended until a value
+// arrives, then resumed on pool with it.
+template<typename T>
+class async_queue
+{
+public:
+    explicit async_queue(thread_pool& pool_ = thread_pool::default_pool()) : pool(pool_)
+    {
+    }
+
+    async_queue(async_queue const&) = delete;
+    async_queue& operator=(async_queue const&) = delete;
+
+    void push(T value)
+    {
+        std::unique_lock<std::mutex> lk(mutex);
+        if (waiters.empty())
+        {
+            values.push_back(std::move(value));
+            return;
+        }
+
+        pop_awaiter* const waiter = waiters.front();
+        waiters.pop_front();
+        lk.unlock();
+
+        waiter->value.emplace(std::move(value));
+        std::coroutine_handle<> const handle = waiter->handle;
+        pool.post([handle]() { handle.resume(); });
+    }
+
+    bool try_pop(T& value)
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        if (values.empty())
+            return false;
+
+        value = std::move(values.front());
+        values.pop_front();
+        return true;
+    }
+
+    struct pop_awaiter
+    {
+        async_queue& queue;
+        std::coroutine_handle<> handle;
+        std::optional<T> value;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle_)
+        {
+            std::lock_guard<std::mutex> lk(queue.mutex);
+            if (!queue.values.empty())
+            {
+                value.emplace(std::move(queue.values.front()));
+                queue.values.pop_front();
+                return false;
+            }
+
+            handle = handle_;
+            queue.waiters.push_back(this);
+            return true;
+        }
+
+        T await_resume()
+        {
+            return std::move(*value);
+        }
+    };
+
+    // co_await queue.pop()
+    pop_awaiter pop()
+    {
+        return pop_awaiter{ *this, nullptr, std::nullopt };
+    }
+
+private:
+    thread_pool& pool;
+    std::mutex mutex;
+    std::deque<T> values;
+    std::deque<pop_awaiter*> waiters;
+};
+
+// Resumes coroutines on whichever thread runs it - the post_task_for_gui_thread pattern (thread/Ch4
+// Synchronizing Concurrent Operations.cpp) as an awaitable: co_await gui.schedule() continues on the GUI
+// thread, which calls run_pending() from its message loop (or run() if it has nothing else to do).
+class thread_scheduler
+{
+public:
+    thread_scheduler() : stopped(false)
+    {
+    }
+
+    thread_scheduler(thread_scheduler const&) = delete;
+    thread_scheduler& operator=(thread_scheduler const&) = delete;
+
+    auto schedule() noexcept
+    {
+        struct awaiter
+        {
+            thread_scheduler& scheduler;
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) const
+            {
+                {
+                    std::lock_guard<std::mutex> lk(scheduler.mutex);
+                    scheduler.ready.push_back(handle);
+                }
+                scheduler.work.notify_one();
+            }
+
+            void await_resume() const noexcept
+            {
+            }
+        };
+        return awaiter{ *this };
+    }
+
+    // Resumes everything scheduled so far, returning how many were resumed.
+    std::size_t run_pending()
+    {
+        std::deque<std::coroutine_handle<>> batch;
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            batch.swap(ready);
+        }
+
+        for (std::coroutine_handle<> handle : batch)
+            handle.resume();
+        return batch.size();
+    }
+
+    // Resumes coroutines as they're scheduled until stop().
+    void run()
+    {
+        while (!stopped.load(std::memory_order_acquire))
+        {
+            work.wait_until([this] { return has_pending() || stopped.load(std::memory_order_acquire); });
+            run_pending();
+        }
+    }
+
+    void stop()
+    {
+        stopped.store(true, std::memory_order_release);
+        work.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::deque<std::coroutine_handle<>> ready;
+    std::atomic<bool> stopped;
+    event_count work;
+
+    bool has_pending()
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        return !ready.empty();
+    }
+};
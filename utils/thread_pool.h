@@ -0,0 +1,224 @@
+#pragma once
+
+// Fixed size thread pool executor.
+// Each worker has its own task queue: tasks posted from a worker go on its own queue and are taken newest
+// first (still warm in its cache), tasks posted from outside are dealt round robin, and an idle worker steals
+// the oldest task from the others. Idle workers spin briefly and then park (see atomic_wait.h), so posting
+// to a busy pool costs no wake up call.
+// Workers can be pinned, one per physical core before any shares a core with its SMT sibling (see topology.h).
+// Tasks posted with a cancellation_token are skipped, not run, once it's cancelled.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "atomic_wait.h"
+#include "cancellation.h"
+#include "per_thread.h"
+#include "topology.h"
+
+class thread_pool
+{
+public:
+    typedef std::function<void()> task;
+
+    explicit thread_pool(unsigned num_threads = default_thread_count(), bool pin_workers = false) :
+        pending(0),
+        done(false),
+        next_queue(0)
+    {
+        num_threads = std::max(num_threads, 1u);
+        for (unsigned i = 0; i < num_threads; ++i)
+            queues.emplace_back(new worker_queue());
+
+        if (pin_workers)
+            placement = cpu_topology::host().placement();
+
+        try
+        {
+            for (unsigned i = 0; i < num_threads; ++i)
+                threads.emplace_back(&thread_pool::worker_thread, this, i);
+        }
+        catch (...)
+        {
+            stop();
+            throw;
+        }
+    }
+
+    // Runs every task already posted, then joins the workers.
+    ~thread_pool()
+    {
+        stop();
+    }
+
+    thread_pool(thread_pool const&) = delete;
+    thread_pool& operator=(thread_pool const&) = delete;
+
+    // Shared pool with a worker per hardware thread.
+    static thread_pool& default_pool()
+    {
+        static thread_pool pool;
+        return pool;
+    }
+
+    // The pool the calling thread is a worker of, or nullptr.
+    static thread_pool* current()
+    {
+        return this_worker().pool;
+    }
+
+    std::size_t size() const
+    {
+        return queues.size();
+    }
+
+    template<typename Func>
+    void post(Func func)
+    {
+        worker_info const& me = this_worker();
+        std::size_t const index = me.pool == this ? me.index
+            : next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+
+        {
+            std::lock_guard<std::mutex> lk(queues[index]->mutex);
+            queues[index]->tasks.emplace_back(std::move(func));
+        }
+
+        pending.fetch_add(1, std::memory_order_release);
+        work.notify_one();
+    }
+
+    // As post, but func is dropped unrun if token is cancelled before a worker reaches it. A running func
+    // has to poll token itself to stop early.
+    template<typename Func>
+    void post(Func func, cancellation_token token)
+    {
+        post([func = std::move(func), token = std::move(token)]() mutable {
+            if (!token.is_cancelled())
+                func();
+        });
+    }
+
+    // Runs one queued task on the calling thread, if there is one - lets a thread that's waiting for a
+    // result help rather than block.
+    bool run_pending_task()
+    {
+        worker_info const& me = this_worker();
+        task t;
+        if (!take(me.pool == this ? me.index : 0, t))
+            return false;
+
+        t();
+        return true;
+    }
+
+private:
+    // padded so workers locking neighbouring queues don't share a line
+    struct worker_queue
+    {
+        std::mutex mutex;
+        std::deque<task> tasks;
+        char padding[cache_line_size];
+    };
+
+    struct worker_info
+    {
+        thread_pool* pool;
+        std::size_t index;
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<std::thread> threads;
+    std::vector<unsigned> placement; // cpu for each worker in turn, empty if unpinned
+
+    alignas(cache_line_size) std::atomic<std::size_t> pending;
+    std::atomic<bool> done;
+    std::atomic<std::size_t> next_queue;
+    event_count work;
+
+    static unsigned default_thread_count()
+    {
+        return cpu_topology::host().logical_count();
+    }
+
+    static worker_info& this_worker()
+    {
+        thread_local worker_info info = { nullptr, 0 };
+        return info;
+    }
+
+    // own queue newest first, then steal oldest first
+    bool take(std::size_t index, task& t)
+    {
+        if (!pending.load(std::memory_order_acquire))
+            return false;
+
+        {
+            worker_queue& own = *queues[index];
+            std::lock_guard<std::mutex> lk(own.mutex);
+            if (!own.tasks.empty())
+            {
+                t = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        for (std::size_t i = 1; i < queues.size(); ++i)
+        {
+            worker_queue& other = *queues[(index + i) % queues.size()];
+            std::lock_guard<std::mutex> lk(other.mutex);
+            if (!other.tasks.empty())
+            {
+                t = std::move(other.tasks.front());
+                other.tasks.pop_front();
+                pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker_thread(std::size_t index)
+    {
+        worker_info& me = this_worker();
+        me.pool = this;
+        me.index = index;
+        if (!placement.empty())
+            pin_this_thread(placement[index % placement.size()]);
+
+        task t;
+        for (;;)
+        {
+            work.wait_until([&] {
+                return take(index, t) || (done.load(std::memory_order_acquire) && !pending.load(std::memory_order_acquire));
+            });
+            if (!t)
+                return;
+
+            t();
+            t = nullptr;
+        }
+    }
+
+    void stop()
+    {
+        done.store(true, std::memory_order_release);
+        work.notify_all();
+
+        for (auto& t : threads)
+        {
+            if (t.joinable())
+                t.join();
+        }
+    }
+};
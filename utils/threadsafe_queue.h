@@ -0,0 +1,85 @@
+#pragma once
+
+// Mutex and condition_variable queue (see thread/Ch4 Synchronizing Concurrent Operations.cpp) - values are
+// moved rather than copied in and out. Takes an allocator for its deque; pmr::threadsafe_queue takes a
+// std::pmr::memory_resource. bounded_queue.h has a lock free alternative with the same interface.
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <queue>
+#include <utility>
+
+template<typename T, typename Allocator = std::allocator<T>>
+class threadsafe_queue
+{
+private:
+    mutable std::mutex mut;
+    std::queue<T, std::deque<T, Allocator>> data_queue;
+    Allocator alloc;
+    std::condition_variable data_cond;
+public:
+    threadsafe_queue()
+    {}
+    explicit threadsafe_queue(Allocator const& alloc_) : data_queue(alloc_), alloc(alloc_)
+    {}
+    threadsafe_queue(threadsafe_queue const& other)
+    {
+        std::lock_guard<std::mutex> lk(other.mut);
+        data_queue = other.data_queue;
+    }
+    threadsafe_queue& operator=(threadsafe_queue const&) = delete;
+    void push(T new_value)
+    {
+        std::lock_guard<std::mutex> lk(mut);
+        data_queue.push(std::move(new_value));
+        data_cond.notify_one();
+    }
+    void wait_and_pop(T& value)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        data_cond.wait(lk, [this] {return !data_queue.empty(); });
+        value = std::move(data_queue.front());
+        data_queue.pop();
+    }
+    std::shared_ptr<T> wait_and_pop()
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        data_cond.wait(lk, [this] {return !data_queue.empty(); });
+        std::shared_ptr<T> res(std::allocate_shared<T>(alloc, std::move(data_queue.front())));
+        data_queue.pop();
+        return res;
+    }
+    bool try_pop(T& value)
+    {
+        std::lock_guard<std::mutex> lk(mut);
+        if (data_queue.empty())
+            return false;
+        value = std::move(data_queue.front());
+        data_queue.pop();
+        return true;
+    }
+    std::shared_ptr<T> try_pop()
+    {
+        std::lock_guard<std::mutex> lk(mut);
+        if (data_queue.empty())
+            return std::shared_ptr<T>();
+        std::shared_ptr<T> res(std::allocate_shared<T>(alloc, std::move(data_queue.front())));
+        data_queue.pop();
+        return res;
+    }
+    bool empty() const
+    {
+        std::lock_guard<std::mutex> lk(mut);
+        return data_queue.empty();
+    }
+};
+
+namespace pmr {
+
+template<typename T>
+using threadsafe_queue = ::threadsafe_queue<T, std::pmr::polymorphic_allocator<T>>;
+
+}  // namespace pmr
@@ -0,0 +1,241 @@
+#pragma once
+
+// Thread safe stacks - the mutex based threadsafe_stack (see thread/Ch3 Sharing Data.cpp) and a lock free
+// Treiber stack with the same push/pop interface.
+// Both take an allocator for their nodes; pmr::threadsafe_stack and pmr::lock_free_stack take a
+// std::pmr::memory_resource (eg pool_resource from memory_resource.h, which is safe to share between threads).
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <stack>
+#include <utility>
+
+struct empty_stack : std::exception
+{
+    const char* what() const throw()
+    {
+        return "empty stack";
+    }
+};
+
+template<typename T, typename Allocator = std::allocator<T>>
+class threadsafe_stack
+{
+private:
+    std::stack<T, std::deque<T, Allocator>> data;
+    Allocator alloc;
+    mutable std::mutex m;
+public:
+    threadsafe_stack() {}
+    explicit threadsafe_stack(Allocator const& alloc_) : data(alloc_), alloc(alloc_) {}
+    threadsafe_stack(const threadsafe_stack& other)
+    {
+        std::lock_guard<std::mutex> lock(other.m);
+        data = other.data;
+    }
+    threadsafe_stack& operator=(const threadsafe_stack&) = delete;
+    void push(T new_value)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        data.push(std::move(new_value));
+    }
+    std::shared_ptr<T> pop()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (data.empty()) throw empty_stack();
+        std::shared_ptr<T> const res(std::allocate_shared<T>(alloc, std::move(data.top())));
+        data.pop();
+        return res;
+    }
+    void pop(T& value)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (data.empty()) throw empty_stack();
+        value = std::move(data.top());
+        data.pop();
+    }
+    bool try_pop(T& value)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (data.empty()) return false;
+        value = std::move(data.top());
+        data.pop();
+        return true;
+    }
+    bool empty() const
+    {
+        std::lock_guard<std::mutex> lock(m);
+        return data.empty();
+    }
+};
+
+// Lock free stack with split reference counts.
+// head carries an external count alongside the node pointer: a popping thread increments it before touching
+// the node, so the node can't be deleted under it (safe reclamation), and any push/pop in between changes
+// the count so a recycled address can't satisfy a stale compare_exchange (ABA). Each node's internal count
+// tracks threads that have finished with it; the node is deleted once external and internal counts cancel.
+// The count is pointer sized and sits beside the pointer, updated with a double width CAS (cmpxchg16b on
+// x64; GCC needs -latomic for it): every pop that loses a race leaves the head's count raised, so a narrower count packed into spare
+// pointer bits could wrap under contention and free a node still in use.
+template<typename T, typename Allocator = std::allocator<T>>
+class lock_free_stack
+{
+private:
+    struct node;
+
+    struct alignas(2 * sizeof(void*)) counted_node_ptr
+    {
+        std::intptr_t external_count;
+        node* ptr;
+    };
+
+    struct node
+    {
+        T data;
+        std::atomic<std::intptr_t> internal_count;
+        counted_node_ptr next; // only written before the node is published
+
+        explicit node(T&& data_) : data(std::move(data_)), internal_count(0), next{ 0, nullptr }
+        {
+        }
+    };
+
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<node> node_allocator;
+    typedef std::allocator_traits<node_allocator> node_traits;
+
+    std::atomic<counted_node_ptr> head;
+    node_allocator alloc; // used from every thread, so must be thread safe (std::allocator and pool_resource are)
+
+    node* create_node(T&& value)
+    {
+        node* const p = node_traits::allocate(alloc, 1);
+        try
+        {
+            node_traits::construct(alloc, p, std::move(value));
+        }
+        catch (...)
+        {
+            node_traits::deallocate(alloc, p, 1);
+            throw;
+        }
+        return p;
+    }
+
+    void destroy_node(node* p)
+    {
+        node_traits::destroy(alloc, p);
+        node_traits::deallocate(alloc, p, 1);
+    }
+
+    // Claims a reference to the current head, returning false (without touching the count) if it's empty.
+    bool increase_head_count(counted_node_ptr& old_counter)
+    {
+        counted_node_ptr new_counter;
+        do
+        {
+            if (!old_counter.ptr)
+                return false;
+            new_counter = old_counter;
+            ++new_counter.external_count;
+        } while (!head.compare_exchange_strong(old_counter, new_counter,
+            std::memory_order_acquire, std::memory_order_relaxed));
+
+        old_counter = new_counter;
+        return true;
+    }
+
+public:
+    lock_free_stack() : head(counted_node_ptr{ 0, nullptr })
+    {
+    }
+
+    explicit lock_free_stack(Allocator const& alloc_) : head(counted_node_ptr{ 0, nullptr }), alloc(alloc_)
+    {
+    }
+
+    ~lock_free_stack()
+    {
+        node* ptr = head.load(std::memory_order_relaxed).ptr;
+        while (ptr)
+        {
+            node* const next = ptr->next.ptr;
+            destroy_node(ptr);
+            ptr = next;
+        }
+    }
+
+    lock_free_stack(const lock_free_stack&) = delete;
+    lock_free_stack& operator=(const lock_free_stack&) = delete;
+
+    void push(T new_value)
+    {
+        node* const new_node = create_node(std::move(new_value));
+        counted_node_ptr const new_head = { 1, new_node };
+
+        new_node->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(new_node->next, new_head,
+            std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    bool try_pop(T& value)
+    {
+        counted_node_ptr old_head = head.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            if (!increase_head_count(old_head))
+                return false;
+
+            node* const ptr = old_head.ptr;
+
+            if (head.compare_exchange_strong(old_head, ptr->next, std::memory_order_relaxed))
+            {
+                value = std::move(ptr->data);
+
+                // less the reference this thread held and the one head held
+                std::intptr_t const count_increase = old_head.external_count - 2;
+                if (ptr->internal_count.fetch_add(count_increase, std::memory_order_release) == -count_increase)
+                    destroy_node(ptr);
+
+                return true;
+            }
+            else if (ptr->internal_count.fetch_add(-1, std::memory_order_relaxed) == 1)
+            {
+                ptr->internal_count.load(std::memory_order_acquire);
+                destroy_node(ptr);
+            }
+        }
+    }
+
+    void pop(T& value)
+    {
+        if (!try_pop(value)) throw empty_stack();
+    }
+
+    std::shared_ptr<T> pop()
+    {
+        T value;
+        pop(value);
+        return std::allocate_shared<T>(Allocator(alloc), std::move(value));
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_relaxed).ptr == nullptr;
+    }
+};
+
+namespace pmr {
+
+template<typename T>
+using threadsafe_stack = ::threadsafe_stack<T, std::pmr::polymorphic_allocator<T>>;
+
+template<typename T>
+using lock_free_stack = ::lock_free_stack<T, std::pmr::polymorphic_allocator<T>>;
+
+}  // namespace pmr
@@ -0,0 +1,425 @@
+#pragma once
+
+// CPU topology and thread affinity.
+// std::thread::hardware_concurrency() counts SMT siblings as cores and says nothing about caches or sockets.
+// cpu_topology reads which logical CPUs this process may run on, the core, package and NUMA node of each,
+// and the data cache sizes - from /sys on Linux, GetLogicalProcessorInformation on Windows - so parallel
+// algorithms can size blocks from the real L2 and a pool can place one worker per core before doubling up
+// on SMT siblings. Read once, on first use.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <ostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+struct logical_cpu
+{
+    unsigned id;      // as the OS numbers it, for pin_this_thread
+    unsigned core;    // index into the physical cores, shared by SMT siblings
+    unsigned package; // socket
+    unsigned node;    // NUMA node
+};
+
+class cpu_topology
+{
+public:
+    // The host's topology, restricted to the CPUs in this process's affinity mask.
+    static cpu_topology const& host()
+    {
+        static cpu_topology const topology;
+        return topology;
+    }
+
+    std::vector<logical_cpu> const& cpus() const
+    {
+        return cpu_list;
+    }
+
+    unsigned logical_count() const
+    {
+        return static_cast<unsigned>(cpu_list.size());
+    }
+
+    unsigned core_count() const
+    {
+        return cores;
+    }
+
+    unsigned package_count() const
+    {
+        return packages;
+    }
+
+    unsigned node_count() const
+    {
+        return nodes;
+    }
+
+    // per core caches, in bytes
+    std::size_t l1d_size() const
+    {
+        return l1d;
+    }
+
+    std::size_t l2_size() const
+    {
+        return l2;
+    }
+
+    // the largest cache, usually shared by a package's cores
+    std::size_t llc_size() const
+    {
+        return llc;
+    }
+
+    // Logical CPU ids in the order to place threads: first one per core, taking nodes in turn so the load
+    // spreads across sockets, then the second SMT sibling of each core, and so on.
+    std::vector<unsigned> placement() const
+    {
+        std::vector<std::vector<logical_cpu>> rounds;
+        std::vector<unsigned> seen_per_core(cores, 0);
+        for (logical_cpu const& cpu : cpu_list)
+        {
+            unsigned const round = seen_per_core[cpu.core]++;
+            if (round >= rounds.size())
+                rounds.resize(round + 1);
+            rounds[round].push_back(cpu);
+        }
+
+        std::vector<unsigned> order;
+        for (auto& round : rounds)
+        {
+            // interleave nodes: the k-th core of each node before the (k+1)-th of any
+            std::vector<unsigned> rank_in_node(nodes, 0);
+            std::vector<std::pair<unsigned, unsigned>> keyed; // (rank, node) per cpu
+            for (logical_cpu const& cpu : round)
+                keyed.push_back(std::make_pair(rank_in_node[cpu.node]++, cpu.node));
+
+            std::vector<std::size_t> index(round.size());
+            for (std::size_t i = 0; i < index.size(); ++i)
+                index[i] = i;
+            std::stable_sort(index.begin(), index.end(),
+                [&](std::size_t a, std::size_t b) { return keyed[a] < keyed[b]; });
+
+            for (std::size_t i : index)
+                order.push_back(round[i].id);
+        }
+        return order;
+    }
+
+    std::vector<unsigned> cpus_of_node(unsigned node) const
+    {
+        std::vector<unsigned> ids;
+        for (logical_cpu const& cpu : cpu_list)
+        {
+            if (cpu.node == node)
+                ids.push_back(cpu.id);
+        }
+        return ids;
+    }
+
+    void describe(std::ostream& os) const
+    {
+        os << logical_count() << " cpus, " << cores << " cores, " << packages << " packages, " << nodes
+            << " numa nodes, L1d " << l1d / 1024 << "K, L2 " << l2 / 1024 << "K, LLC " << llc / 1024 << "K\n";
+    }
+
+private:
+    std::vector<logical_cpu> cpu_list;
+    unsigned cores;
+    unsigned packages;
+    unsigned nodes;
+    std::size_t l1d;
+    std::size_t l2;
+    std::size_t llc;
+
+    cpu_topology() : cores(0), packages(0), nodes(1), l1d(0), l2(0), llc(0)
+    {
+        read();
+
+        if (cpu_list.empty())
+        {
+            unsigned const hardware = std::thread::hardware_concurrency(); // hint, may be 0
+            for (unsigned i = 0; i < (hardware != 0 ? hardware : 2); ++i)
+                cpu_list.push_back(logical_cpu{ i, i, 0, 0 });
+            nodes = 1;
+        }
+        number_cores();
+
+        // conservative defaults where the OS didn't say
+        if (!l1d)
+            l1d = 32 * 1024;
+        if (!l2)
+            l2 = 256 * 1024;
+        llc = std::max(llc, l2);
+    }
+
+    // renumber cores densely from the OS's (package, core) ids, and count packages
+    void number_cores()
+    {
+        std::vector<std::pair<unsigned, unsigned>> keys;
+        std::set<unsigned> package_ids;
+        for (logical_cpu const& cpu : cpu_list)
+        {
+            keys.push_back(std::make_pair(cpu.package, cpu.core));
+            package_ids.insert(cpu.package);
+        }
+
+        std::vector<std::pair<unsigned, unsigned>> distinct = keys;
+        std::sort(distinct.begin(), distinct.end());
+        distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+
+        for (std::size_t i = 0; i < cpu_list.size(); ++i)
+        {
+            cpu_list[i].core = static_cast<unsigned>(
+                std::lower_bound(distinct.begin(), distinct.end(), keys[i]) - distinct.begin());
+        }
+        cores = static_cast<unsigned>(distinct.size());
+        packages = static_cast<unsigned>(package_ids.size());
+    }
+
+#if defined(_WIN32)
+    // One processor group (up to 64 logical CPUs), which is all the affinity mask below can address anyway.
+    void read()
+    {
+        DWORD length = 0;
+        GetLogicalProcessorInformation(nullptr, &length);
+        std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+        if (info.empty() || !GetLogicalProcessorInformation(info.data(), &length))
+            return;
+
+        DWORD_PTR process_mask = 0;
+        DWORD_PTR system_mask = 0;
+        if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+            process_mask = ~DWORD_PTR(0);
+
+        unsigned const max_cpus = sizeof(ULONG_PTR) * 8;
+        std::vector<logical_cpu> all(max_cpus, logical_cpu{ 0, 0, 0, 0 });
+        std::vector<bool> present(max_cpus, false);
+        unsigned core = 0;
+        unsigned package = 0;
+        unsigned max_node = 0;
+
+        for (auto const& entry : info)
+        {
+            for (unsigned i = 0; i < max_cpus; ++i)
+            {
+                if (!(entry.ProcessorMask & (ULONG_PTR(1) << i)))
+                    continue;
+
+                all[i].id = i;
+                switch (entry.Relationship)
+                {
+                case RelationProcessorCore:
+                    all[i].core = core;
+                    present[i] = true;
+                    break;
+                case RelationProcessorPackage:
+                    all[i].package = package;
+                    break;
+                case RelationNumaNode:
+                    all[i].node = entry.NumaNode.NodeNumber;
+                    max_node = std::max<unsigned>(max_node, entry.NumaNode.NodeNumber);
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            if (entry.Relationship == RelationProcessorCore)
+                ++core;
+            else if (entry.Relationship == RelationProcessorPackage)
+                ++package;
+            else if (entry.Relationship == RelationCache && entry.Cache.Type != CacheInstruction)
+                add_cache(entry.Cache.Level, entry.Cache.Size);
+        }
+
+        for (unsigned i = 0; i < max_cpus; ++i)
+        {
+            if (present[i] && (process_mask & (DWORD_PTR(1) << i)))
+                cpu_list.push_back(all[i]);
+        }
+        nodes = max_node + 1;
+    }
+#else
+    static bool read_file(std::string const& path, std::string& contents)
+    {
+        std::ifstream file(path);
+        return static_cast<bool>(std::getline(file, contents));
+    }
+
+    static unsigned read_unsigned(std::string const& path, unsigned fallback)
+    {
+        std::string contents;
+        return read_file(path, contents) ? static_cast<unsigned>(std::strtoul(contents.c_str(), nullptr, 10))
+            : fallback;
+    }
+
+    // "0-3,8,10-11"
+    static std::vector<unsigned> parse_cpu_list(std::string const& list)
+    {
+        std::vector<unsigned> ids;
+        char const* p = list.c_str();
+        while (*p >= '0' && *p <= '9')
+        {
+            char* end = nullptr;
+            unsigned long const first = std::strtoul(p, &end, 10);
+            unsigned long last = first;
+            if (*end == '-')
+                last = std::strtoul(end + 1, &end, 10);
+            for (unsigned long id = first; id <= last; ++id)
+                ids.push_back(static_cast<unsigned>(id));
+            p = *end == ',' ? end + 1 : end;
+        }
+        return ids;
+    }
+
+    // "48K", "2048K", "32M"
+    static std::size_t parse_size(std::string const& size)
+    {
+        char* end = nullptr;
+        std::size_t bytes = std::strtoul(size.c_str(), &end, 10);
+        if (*end == 'K')
+            bytes *= 1024;
+        else if (*end == 'M')
+            bytes *= 1024 * 1024;
+        else if (*end == 'G')
+            bytes *= 1024 * 1024 * 1024;
+        return bytes;
+    }
+
+    void read()
+    {
+        std::string const cpu_root = "/sys/devices/system/cpu/";
+        std::string const node_root = "/sys/devices/system/node/";
+
+        std::string online;
+        if (!read_file(cpu_root + "online", online))
+            return;
+
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        bool const have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+        std::vector<unsigned> node_of;
+        std::string node_list;
+        if (read_file(node_root + "online", node_list))
+        {
+            for (unsigned node : parse_cpu_list(node_list))
+            {
+                std::string cpus;
+                if (!read_file(node_root + "node" + std::to_string(node) + "/cpulist", cpus))
+                    continue;
+                for (unsigned id : parse_cpu_list(cpus))
+                {
+                    if (id >= node_of.size())
+                        node_of.resize(id + 1, 0);
+                    node_of[id] = node;
+                }
+                nodes = std::max(nodes, node + 1);
+            }
+        }
+
+        for (unsigned id : parse_cpu_list(online))
+        {
+            if (have_mask && id < CPU_SETSIZE && !CPU_ISSET(id, &allowed))
+                continue;
+
+            std::string const topology = cpu_root + "cpu" + std::to_string(id) + "/topology/";
+            logical_cpu cpu;
+            cpu.id = id;
+            cpu.core = read_unsigned(topology + "core_id", id);
+            cpu.package = read_unsigned(topology + "physical_package_id", 0);
+            cpu.node = id < node_of.size() ? node_of[id] : 0;
+            cpu_list.push_back(cpu);
+        }
+
+        if (cpu_list.empty())
+            return;
+
+        std::string const cache_root = cpu_root + "cpu" + std::to_string(cpu_list.front().id) + "/cache/index";
+        for (unsigned index = 0;; ++index)
+        {
+            std::string const dir = cache_root + std::to_string(index) + "/";
+            std::string type;
+            std::string size;
+            if (!read_file(dir + "type", type) || !read_file(dir + "size", size))
+                break;
+            if (type != "Instruction")
+                add_cache(read_unsigned(dir + "level", 0), parse_size(size));
+        }
+    }
+#endif
+
+    void add_cache(unsigned level, std::size_t size)
+    {
+        if (level == 1)
+            l1d = size;
+        else if (level == 2)
+            l2 = size;
+        llc = std::max(llc, size);
+    }
+};
+
+// Pins the calling thread to one logical CPU, returning false if the OS refused.
+inline bool pin_this_thread(unsigned cpu)
+{
+#if defined(_WIN32)
+    if (cpu >= sizeof(DWORD_PTR) * 8)
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#else
+    if (cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#endif
+}
+
+// Lets the calling thread run on any CPU of a NUMA node - memory it touches first is then allocated on
+// that node, so a memory bound loop (a sieve, say) reads local memory.
+inline bool pin_this_thread_to_node(unsigned node)
+{
+    std::vector<unsigned> const cpus = cpu_topology::host().cpus_of_node(node);
+    if (cpus.empty())
+        return false;
+
+#if defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (unsigned cpu : cpus)
+    {
+        if (cpu < sizeof(DWORD_PTR) * 8)
+            mask |= DWORD_PTR(1) << cpu;
+    }
+    return mask && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned cpu : cpus)
+    {
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#endif
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+// Picking the fastest of several implementations by input size.
+// A tuned_function holds named variants of one function of a size (eg p1's Simple and Optimised). tune()
+// times every variant across a sweep of sizes and keeps the crossovers: from which size on each variant is
+// the fastest. Calls then dispatch on the argument, which costs a short search of the crossovers.
+// Crossovers depend on the host, so load_or_tune() keeps them in a small text file, one line per crossover
+// with a signature of the host (instruction set, cpu count, cache sizes). A run on the same host loads them
+// and a run on another host tunes again, adding its own lines.
+// Timings are per call, including call overhead. Each is the best of several trials, and each trial repeats
+// the call until it has run long enough to time.
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "simd.h"
+#include "topology.h"
+
+namespace detail {
+
+// Shortest trial worth timing and the number of trials per variant and size.
+std::chrono::nanoseconds const tuning_trial(std::chrono::microseconds(200));
+int const tuning_trials = 5;
+
+inline char volatile tuning_sink;
+
+// Stops the compiler dropping a call whose result is unused.
+template<typename R>
+void keep_result(R const& result)
+{
+    tuning_sink = *reinterpret_cast<char const volatile*>(&result);
+}
+
+}  // namespace detail
+
+// Host this process runs on, as recorded in tuning files, eg avx512/8cpu/L2_1024K/LLC_32768K.
+inline std::string host_signature()
+{
+    cpu_topology const& host = cpu_topology::host();
+    std::ostringstream signature;
+    signature << isa_name(cpu_isa()) << '/' << host.logical_count() << "cpu/L2_" << host.l2_size() / 1024
+        << "K/LLC_" << host.llc_size() / 1024 << 'K';
+    return signature.str();
+}
+
+// Powers of two from first to last, then last, for tune().
+template<typename N>
+std::vector<N> size_sweep(N first, N last)
+{
+    std::vector<N> sizes;
+    for (N size = std::max<N>(first, 1); size < last; size *= 2)
+        sizes.push_back(size);
+    sizes.push_back(last);
+    return sizes;
+}
+
+template<typename R, typename N>
+class tuned_function
+{
+public:
+    // name identifies the function in tuning files.
+    explicit tuned_function(std::string name_) : name(std::move(name_))
+    {
+    }
+
+    void add(std::string variant, std::function<R(N)> func)
+    {
+        variants.push_back(std::make_pair(std::move(variant), std::move(func)));
+        crossovers.clear();
+    }
+
+    // Times every variant at each size and keeps the sizes at which the fastest one changes.
+    void tune(std::vector<N> const& sizes)
+    {
+        if (variants.empty())
+            throw std::logic_error("tuned_function " + name + " has no variants");
+
+        crossovers.clear();
+        for (N const size : sizes)
+        {
+            std::size_t fastest = 0;
+            double fastest_ns = 0;
+            for (std::size_t v = 0; v < variants.size(); ++v)
+            {
+                double const ns = time_call(variants[v].second, size);
+                if (v == 0 || ns < fastest_ns)
+                {
+                    fastest = v;
+                    fastest_ns = ns;
+                }
+            }
+
+            if (crossovers.empty() || crossovers.back().second != fastest)
+                crossovers.push_back(std::make_pair(size, fastest));
+        }
+    }
+
+    // Loads this host's crossovers from path, or tunes and adds them to path if it has none (or they name a
+    // variant that no longer exists). Returns true if they were loaded.
+    bool load_or_tune(std::string const& path, std::vector<N> const& sizes)
+    {
+        if (load(path))
+            return true;
+        tune(sizes);
+        save(path);
+        return false;
+    }
+
+    bool load(std::string const& path)
+    {
+        std::ifstream file(path);
+        std::string const host = host_signature();
+        std::vector<std::pair<N, std::size_t>> loaded;
+
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream fields(line);
+            std::string line_name, line_host, variant;
+            N size;
+            if (!(fields >> line_name >> line_host >> size >> variant) || line_name != name || line_host != host)
+                continue;
+
+            std::size_t const v = find(variant);
+            if (v == variants.size())
+                return false;
+            loaded.push_back(std::make_pair(size, v));
+        }
+
+        if (loaded.empty())
+            return false;
+        std::sort(loaded.begin(), loaded.end());
+        crossovers = std::move(loaded);
+        return true;
+    }
+
+    // Replaces this function's lines for this host in path, keeping everything else.
+    void save(std::string const& path) const
+    {
+        std::string const host = host_signature();
+        std::vector<std::string> kept;
+        {
+            std::ifstream file(path);
+            std::string line;
+            while (std::getline(file, line))
+            {
+                std::istringstream fields(line);
+                std::string line_name, line_host;
+                fields >> line_name >> line_host;
+                if (line_name != name || line_host != host)
+                    kept.push_back(line);
+            }
+        }
+
+        std::ofstream file(path, std::ios::trunc);
+        for (auto const& line : kept)
+            file << line << '\n';
+        for (auto const& crossover : crossovers)
+            file << name << ' ' << host << ' ' << crossover.first << ' ' << variants[crossover.second].first << '\n';
+        if (!file)
+            throw std::runtime_error("can't write tuning file " + path);
+    }
+
+    // Calls the variant that was fastest for sizes like n - the first variant until tuned.
+    R operator()(N n) const
+    {
+        return variants[choose(n)].second(n);
+    }
+
+    std::string const& variant_for(N n) const
+    {
+        return variants[choose(n)].first;
+    }
+
+    // eg p1: Simple from 1, Optimised from 16
+    void describe(std::ostream& os) const
+    {
+        os << name << ':';
+        char const* separator = " ";
+        for (auto const& crossover : crossovers)
+        {
+            os << separator << variants[crossover.second].first << " from " << crossover.first;
+            separator = ", ";
+        }
+        os << '\n';
+    }
+
+private:
+    std::string name;
+    std::vector<std::pair<std::string, std::function<R(N)>>> variants;
+    std::vector<std::pair<N, std::size_t>> crossovers; // from size, variant - ascending sizes
+
+    std::size_t find(std::string const& variant) const
+    {
+        std::size_t v = 0;
+        while (v < variants.size() && variants[v].first != variant)
+            ++v;
+        return v;
+    }
+
+    std::size_t choose(N n) const
+    {
+        auto const next = std::upper_bound(crossovers.begin(), crossovers.end(), n,
+            [](N value, std::pair<N, std::size_t> const& crossover) { return value < crossover.first; });
+        if (next == crossovers.begin())
+            return crossovers.empty() ? 0 : next->second;
+        return std::prev(next)->second;
+    }
+
+    // Nanoseconds per call, the best of several trials.
+    static double time_call(std::function<R(N)> const& func, N size)
+    {
+        typedef std::chrono::steady_clock clock;
+
+        // the argument is reread every call, so the compiler can't hoist the call out of the loop
+        N volatile argument = size;
+
+        std::size_t reps = 1;
+        double best = 0;
+        for (int trial = 0; trial < detail::tuning_trials;)
+        {
+            clock::time_point const start = clock::now();
+            for (std::size_t i = 0; i < reps; ++i)
+                detail::keep_result(func(argument));
+            clock::duration const elapsed = clock::now() - start;
+
+            if (elapsed < detail::tuning_trial)
+            {
+                reps *= 2;
+                continue;
+            }
+
+            double const ns = std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(reps);
+            if (trial++ == 0 || ns < best)
+                best = ns;
+        }
+        return best;
+    }
+};
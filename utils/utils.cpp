@@ -6,7 +6,8 @@
 #include "utils.h"
 
 #include <chrono>
-#include <iostream>
+
+#include "log_sink.h"
 
 void Profile(std::function<void()> func)
 {
@@ -18,7 +19,44 @@ void Profile(std::function<void()> func)
     end = std::chrono::system_clock::now();
 
     std::chrono::duration<double> elapsed_seconds = end - start;
-    std::cout << " in " << elapsed_seconds.count() << "s\n";
+    out() << " in " << elapsed_seconds.count() << "s\n";
+    default_log_sink().flush();
 }
 
+void Profile(std::function<void(cancellation_token const&, search_progress&)> func, std::chrono::duration<double> budget)
+{
+    cancellation_token token;
+    token.cancel_after(budget);
+    search_progress progress;
+
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    start = std::chrono::system_clock::now();
+
+    try
+    {
+        func(token, progress);
+    }
+    catch (cancelled_error const&)
+    {
+        end = std::chrono::system_clock::now();
+
+        std::chrono::duration<double> elapsed_seconds = end - start;
+        {
+            log_stream line(default_log_sink());
+            line << "Stopped at the " << budget.count() << "s budget after " << elapsed_seconds.count() << "s, "
+                << progress.fraction() * 100 << "% covered";
+            std::string const best = progress.best_so_far();
+            if (!best.empty())
+                line << ", best so far " << best;
+            line << '\n';
+        }
+        default_log_sink().flush();
+        return;
+    }
+
+    end = std::chrono::system_clock::now();
 
+    std::chrono::duration<double> elapsed_seconds = end - start;
+    out() << " in " << elapsed_seconds.count() << "s\n";
+    default_log_sink().flush();
+}
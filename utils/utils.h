@@ -1,6 +1,13 @@
 #pragma once
 
+#include <chrono>
 #include <functional>
 
+#include "cancellation.h"
+
 __declspec(dllexport) void Profile(std::function<void()> func);
 
+// Gives func a token that is cancelled once budget has passed. If func stops with cancelled_error, reports
+// how far it got from progress instead of a result.
+__declspec(dllexport) void Profile(std::function<void(cancellation_token const&, search_progress&)> func,
+    std::chrono::duration<double> budget);
@@ -1,9 +1,26 @@
 #pragma once
 
-#include <iostream>
+#include <chrono>
 
+#include "log_sink.h"
+
+// Queued on the calling thread's line of the default log_sink, which Profile finishes.
 template<typename T>
 void Print(T result)
 {
-    std::cout << "Result is " << result;
+    out() << "Result is " << result;
+}
+
+// Times func() and writes its result as a structured record line, eg
+//   problem=p1 impl=Optimised result=233168 seconds=1.2e-06
+template<typename Func>
+void Record(char const* problem, char const* impl, Func func)
+{
+    std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+    auto const result = func();
+    std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+
+    std::string const text = to_text(result);
+    default_log_sink().write(result_record{ problem, impl, text, elapsed.count() });
+    default_log_sink().flush();
 }
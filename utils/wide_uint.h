@@ -0,0 +1,663 @@
+#pragma once
+
+// Fixed width unsigned integers wider than 64 bits, eg wide_uint<128>, wide_uint<256>, wide_uint<512>.
+// The value is an array of 64-bit limbs on the stack, least significant first - nothing is allocated, so a
+// wide_uint is as cheap to copy and keep in a vector as any other small aggregate. It behaves like the
+// built-in unsigned types, so it can be the T of the problem templates: arithmetic wraps modulo 2^Bits, it
+// converts implicitly from any integer (negative ones wrap) and explicitly to them (keeping the low bits),
+// and it mixes with them in expressions, eg n % 3 == 0.
+//  - a * b keeps the low Bits of the product, schoolbook, skipping zero limbs so multiplying by a small
+//    number is cheap. multiply_full keeps all 2 * Bits, by Karatsuba from karatsuba_limbs limbs up.
+//  - Division by a divisor that fits in a limb is a limb at a time. limb_divisor divides by one that's
+//    fixed in advance (eg 10^19 for to_chars) with a precomputed reciprocal - two multiplications a limb
+//    rather than a hardware division. Wider divisors fall back to shift and subtract, a bit at a time.
+//  - to_chars, to_string and operator<< write it in any base from 2 to 36.
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+namespace detail {
+
+typedef std::uint64_t limb;
+
+// Products of at least this many limbs a side are split by Karatsuba - below it, schoolbook is faster.
+std::size_t const karatsuba_limbs = 32;
+
+// a * b + c + d, which fits in 128 bits - returns the low limb and sets high.
+inline limb mul_add(limb a, limb b, limb c, limb d, limb& high)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    limb hi;
+    limb lo = _umul128(a, b, &hi);
+    lo += c;
+    hi += lo < c;
+    lo += d;
+    hi += lo < d;
+    high = hi;
+    return lo;
+#elif defined(__SIZEOF_INT128__)
+    unsigned __int128 const r = static_cast<unsigned __int128>(a) * b + c + d;
+    high = static_cast<limb>(r >> 64);
+    return static_cast<limb>(r);
+#else
+    limb const mask = 0xFFFFFFFF;
+    limb const ll = (a & mask) * (b & mask);
+    limb const lh = (a & mask) * (b >> 32);
+    limb const hl = (a >> 32) * (b & mask);
+    limb const hh = (a >> 32) * (b >> 32);
+    limb const middle = (ll >> 32) + (lh & mask) + (hl & mask);
+    limb lo = (middle << 32) | (ll & mask);
+    limb hi = hh + (lh >> 32) + (hl >> 32) + (middle >> 32);
+    lo += c;
+    hi += lo < c;
+    lo += d;
+    hi += lo < d;
+    high = hi;
+    return lo;
+#endif
+}
+
+// high:low / d, which must be below 2^64 (high < d) - returns the quotient and sets remainder.
+inline limb div_limb(limb high, limb low, limb d, limb& remainder)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    return _udiv128(high, low, d, &remainder);
+#elif defined(__GNUC__) && defined(__x86_64__)
+    limb q, r;
+    __asm__("divq %4" : "=a"(q), "=d"(r) : "a"(low), "d"(high), "rm"(d));
+    remainder = r;
+    return q;
+#elif defined(__SIZEOF_INT128__)
+    unsigned __int128 const n = (static_cast<unsigned __int128>(high) << 64) | low;
+    remainder = static_cast<limb>(n % d);
+    return static_cast<limb>(n / d);
+#else
+    limb q = 0;
+    for (int bit = 63; bit >= 0; --bit)
+    {
+        bool const overflow = (high >> 63) != 0;
+        high = (high << 1) | (low >> 63);
+        low <<= 1;
+        if (overflow || high >= d)
+        {
+            high -= d;
+            q |= limb(1) << bit;
+        }
+    }
+    remainder = high;
+    return q;
+#endif
+}
+
+inline limb add_carry(limb a, limb b, limb& carry)
+{
+    limb const partial = a + carry;
+    limb const sum = partial + b;
+    carry = (partial < carry) | (sum < b);
+    return sum;
+}
+
+inline limb sub_borrow(limb a, limb b, limb& borrow)
+{
+    limb const partial = a - borrow;
+    limb const difference = partial - b;
+    borrow = (a < borrow) | (partial < b);
+    return difference;
+}
+
+// r[0, rn) += x[0, xn), xn <= rn - returns the carry out of r.
+inline limb add_limbs(limb* r, std::size_t rn, limb const* x, std::size_t xn)
+{
+    limb carry = 0;
+    std::size_t i = 0;
+    for (; i < xn; ++i)
+        r[i] = add_carry(r[i], x[i], carry);
+    for (; carry && i < rn; ++i)
+        r[i] = add_carry(r[i], 0, carry);
+    return carry;
+}
+
+// r[0, rn) -= x[0, xn), xn <= rn - returns the borrow out of r.
+inline limb sub_limbs(limb* r, std::size_t rn, limb const* x, std::size_t xn)
+{
+    limb borrow = 0;
+    std::size_t i = 0;
+    for (; i < xn; ++i)
+        r[i] = sub_borrow(r[i], x[i], borrow);
+    for (; borrow && i < rn; ++i)
+        r[i] = sub_borrow(r[i], 0, borrow);
+    return borrow;
+}
+
+// product[0, 2N) = a[0, N) * b[0, N)
+template<std::size_t N>
+void multiply_limbs(limb const* a, limb const* b, limb* product)
+{
+    if constexpr (N < karatsuba_limbs || N % 2 != 0)
+    {
+        std::fill(product, product + 2 * N, 0);
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            if (!a[i])
+                continue;
+            limb carry = 0;
+            for (std::size_t j = 0; j < N; ++j)
+                product[i + j] = mul_add(a[i], b[j], product[i + j], carry, carry);
+            product[i + N] = carry;
+        }
+    }
+    else
+    {
+        // a * b = z2 << 2H + ((a0 + a1)(b0 + b1) - z0 - z2) << H + z0, three half size products instead of four
+        std::size_t const H = N / 2;
+        multiply_limbs<H>(a, b, product);
+        multiply_limbs<H>(a + H, b + H, product + N);
+
+        limb sum_a[H], sum_b[H];
+        std::copy(a, a + H, sum_a);
+        std::copy(b, b + H, sum_b);
+        limb const carry_a = add_limbs(sum_a, H, a + H, H);
+        limb const carry_b = add_limbs(sum_b, H, b + H, H);
+
+        limb middle[N + 1];
+        multiply_limbs<H>(sum_a, sum_b, middle);
+        middle[N] = carry_a & carry_b;
+        if (carry_a)
+            add_limbs(middle + H, H + 1, sum_b, H);
+        if (carry_b)
+            add_limbs(middle + H, H + 1, sum_a, H);
+        sub_limbs(middle, N + 1, product, N);
+        sub_limbs(middle, N + 1, product + N, N);
+
+        add_limbs(product + H, N + H, middle, N + 1);
+    }
+}
+
+}  // namespace detail
+
+template<unsigned Bits>
+class wide_uint
+{
+    static_assert(Bits >= 128 && Bits % 64 == 0, "wide_uint is a whole number of 64-bit limbs, at least two");
+
+public:
+    static constexpr std::size_t limb_count = Bits / 64;
+
+    constexpr wide_uint() : limbs()
+    {
+    }
+
+    template<typename I, typename std::enable_if<std::is_integral<I>::value, int>::type = 0>
+    constexpr wide_uint(I value) : limbs()
+    {
+        limbs[0] = static_cast<std::uint64_t>(value);
+        if constexpr (std::is_signed<I>::value)
+        {
+            if (value < 0)
+                std::fill(limbs.begin() + 1, limbs.end(), ~std::uint64_t(0));
+        }
+    }
+
+    // Truncates, eg wide_uint<256>(std::pow(10.0, 30)).
+    template<typename F, typename std::enable_if<std::is_floating_point<F>::value, int>::type = 0>
+    explicit wide_uint(F value) : limbs()
+    {
+        if (!(value >= 1))
+            return;
+        int exponent;
+        double const mantissa = std::frexp(static_cast<double>(value), &exponent);
+        *this = static_cast<std::uint64_t>(std::ldexp(mantissa, 64));
+        if (exponent >= 64)
+            *this <<= static_cast<unsigned>(exponent - 64);
+        else
+            *this >>= static_cast<unsigned>(64 - exponent);
+    }
+
+    // Zero extends or truncates.
+    template<unsigned OtherBits>
+    explicit wide_uint(wide_uint<OtherBits> const& other) : limbs()
+    {
+        std::size_t const n = std::min(limb_count, wide_uint<OtherBits>::limb_count);
+        std::copy(other.data(), other.data() + n, limbs.begin());
+    }
+
+    // The low bits, as converting between built-in unsigned types does.
+    template<typename I, typename std::enable_if<std::is_integral<I>::value && !std::is_same<I, bool>::value, int>::type = 0>
+    explicit operator I() const
+    {
+        return static_cast<I>(limbs[0]);
+    }
+
+    explicit operator bool() const
+    {
+        return std::any_of(limbs.begin(), limbs.end(), [](std::uint64_t l) { return l != 0; });
+    }
+
+    explicit operator double() const
+    {
+        double value = 0;
+        for (std::size_t i = limb_count; i-- > 0;)
+            value = std::ldexp(value, 64) + static_cast<double>(limbs[i]);
+        return value;
+    }
+
+    // Limbs, least significant first.
+    std::uint64_t const* data() const
+    {
+        return limbs.data();
+    }
+
+    std::uint64_t* data()
+    {
+        return limbs.data();
+    }
+
+    // Bits needed to write the value - 0 for 0.
+    unsigned bit_width() const
+    {
+        std::size_t const top = top_limb();
+        return top == limb_count ? 0 : static_cast<unsigned>(64 * top) + static_cast<unsigned>(std::bit_width(limbs[top]));
+    }
+
+    wide_uint& operator+=(wide_uint const& other)
+    {
+        detail::add_limbs(limbs.data(), limb_count, other.limbs.data(), limb_count);
+        return *this;
+    }
+
+    wide_uint& operator-=(wide_uint const& other)
+    {
+        detail::sub_limbs(limbs.data(), limb_count, other.limbs.data(), limb_count);
+        return *this;
+    }
+
+    wide_uint& operator*=(wide_uint const& other)
+    {
+        // only the products landing in the low limb_count limbs
+        std::array<std::uint64_t, limb_count> product = {};
+        for (std::size_t i = 0; i < limb_count; ++i)
+        {
+            if (!limbs[i])
+                continue;
+            std::uint64_t carry = 0;
+            for (std::size_t j = 0; i + j < limb_count; ++j)
+                product[i + j] = detail::mul_add(limbs[i], other.limbs[j], product[i + j], carry, carry);
+        }
+        limbs = product;
+        return *this;
+    }
+
+    wide_uint& operator/=(wide_uint const& other)
+    {
+        wide_uint remainder;
+        *this = divide(*this, other, remainder);
+        return *this;
+    }
+
+    wide_uint& operator%=(wide_uint const& other)
+    {
+        divide(*this, other, *this);
+        return *this;
+    }
+
+    wide_uint& operator&=(wide_uint const& other)
+    {
+        for (std::size_t i = 0; i < limb_count; ++i)
+            limbs[i] &= other.limbs[i];
+        return *this;
+    }
+
+    wide_uint& operator|=(wide_uint const& other)
+    {
+        for (std::size_t i = 0; i < limb_count; ++i)
+            limbs[i] |= other.limbs[i];
+        return *this;
+    }
+
+    wide_uint& operator^=(wide_uint const& other)
+    {
+        for (std::size_t i = 0; i < limb_count; ++i)
+            limbs[i] ^= other.limbs[i];
+        return *this;
+    }
+
+    wide_uint& operator<<=(unsigned shift)
+    {
+        if (shift >= Bits)
+            return *this = wide_uint();
+        std::size_t const whole = shift / 64;
+        unsigned const part = shift % 64;
+        for (std::size_t i = limb_count; i-- > 0;)
+        {
+            std::uint64_t l = i >= whole ? limbs[i - whole] << part : 0;
+            if (part && i > whole)
+                l |= limbs[i - whole - 1] >> (64 - part);
+            limbs[i] = l;
+        }
+        return *this;
+    }
+
+    wide_uint& operator>>=(unsigned shift)
+    {
+        if (shift >= Bits)
+            return *this = wide_uint();
+        std::size_t const whole = shift / 64;
+        unsigned const part = shift % 64;
+        for (std::size_t i = 0; i < limb_count; ++i)
+        {
+            std::uint64_t l = i + whole < limb_count ? limbs[i + whole] >> part : 0;
+            if (part && i + whole + 1 < limb_count)
+                l |= limbs[i + whole + 1] << (64 - part);
+            limbs[i] = l;
+        }
+        return *this;
+    }
+
+    wide_uint& operator++()
+    {
+        return *this += 1;
+    }
+
+    wide_uint operator++(int)
+    {
+        wide_uint const old = *this;
+        *this += 1;
+        return old;
+    }
+
+    wide_uint& operator--()
+    {
+        return *this -= 1;
+    }
+
+    wide_uint operator--(int)
+    {
+        wide_uint const old = *this;
+        *this -= 1;
+        return old;
+    }
+
+    wide_uint operator~() const
+    {
+        wide_uint result;
+        for (std::size_t i = 0; i < limb_count; ++i)
+            result.limbs[i] = ~limbs[i];
+        return result;
+    }
+
+    wide_uint operator-() const
+    {
+        return ~*this + 1;
+    }
+
+    // Friends rather than members, so either side may be a built-in integer.
+    friend wide_uint operator+(wide_uint a, wide_uint const& b) { return a += b; }
+    friend wide_uint operator-(wide_uint a, wide_uint const& b) { return a -= b; }
+    friend wide_uint operator*(wide_uint a, wide_uint const& b) { return a *= b; }
+    friend wide_uint operator/(wide_uint a, wide_uint const& b) { return a /= b; }
+    friend wide_uint operator%(wide_uint a, wide_uint const& b) { return a %= b; }
+    friend wide_uint operator&(wide_uint a, wide_uint const& b) { return a &= b; }
+    friend wide_uint operator|(wide_uint a, wide_uint const& b) { return a |= b; }
+    friend wide_uint operator^(wide_uint a, wide_uint const& b) { return a ^= b; }
+    friend wide_uint operator<<(wide_uint a, unsigned shift) { return a <<= shift; }
+    friend wide_uint operator>>(wide_uint a, unsigned shift) { return a >>= shift; }
+
+    friend bool operator==(wide_uint const& a, wide_uint const& b)
+    {
+        return a.limbs == b.limbs;
+    }
+
+    friend std::strong_ordering operator<=>(wide_uint const& a, wide_uint const& b)
+    {
+        for (std::size_t i = limb_count; i-- > 0;)
+        {
+            if (a.limbs[i] != b.limbs[i])
+                return a.limbs[i] <=> b.limbs[i];
+        }
+        return std::strong_ordering::equal;
+    }
+
+    // Returns dividend / divisor and sets remainder, which may be the dividend. Throws std::domain_error
+    // dividing by 0.
+    static wide_uint divide(wide_uint const& dividend, wide_uint const& divisor, wide_uint& remainder)
+    {
+        std::size_t const top = divisor.top_limb();
+        if (top == limb_count)
+            throw std::domain_error("wide_uint division by zero");
+
+        wide_uint quotient;
+        if (top == 0)
+        {
+            std::uint64_t const d = divisor.limbs[0];
+            std::uint64_t r = 0;
+            std::size_t const dividend_top = dividend.top_limb();
+            for (std::size_t i = dividend_top == limb_count ? 0 : dividend_top + 1; i-- > 0;)
+                quotient.limbs[i] = detail::div_limb(r, dividend.limbs[i], d, r);
+            remainder = r;
+            return quotient;
+        }
+
+        if (dividend < divisor)
+        {
+            remainder = dividend;
+            return quotient;
+        }
+
+        // a bit at a time, from the top of the dividend
+        unsigned const shift = dividend.bit_width() - divisor.bit_width();
+        wide_uint r = dividend;
+        wide_uint d = divisor << shift;
+        for (unsigned bit = shift + 1; bit-- > 0;)
+        {
+            if (r >= d)
+            {
+                r -= d;
+                quotient.limbs[bit / 64] |= std::uint64_t(1) << (bit % 64);
+            }
+            d >>= 1;
+        }
+        remainder = r;
+        return quotient;
+    }
+
+private:
+    std::array<std::uint64_t, limb_count> limbs;
+
+    // Index of the most significant non-zero limb, limb_count for 0.
+    std::size_t top_limb() const
+    {
+        for (std::size_t i = limb_count; i-- > 0;)
+        {
+            if (limbs[i])
+                return i;
+        }
+        return limb_count;
+    }
+};
+
+// The whole product, 2 * Bits wide.
+template<unsigned Bits>
+wide_uint<2 * Bits> multiply_full(wide_uint<Bits> const& a, wide_uint<Bits> const& b)
+{
+    wide_uint<2 * Bits> product;
+    detail::multiply_limbs<wide_uint<Bits>::limb_count>(a.data(), b.data(), product.data());
+    return product;
+}
+
+// Division by a 64-bit divisor fixed in advance, multiplying by its reciprocal rather than dividing
+// (Moller and Granlund, Improved division by invariant integers, 2011).
+class limb_divisor
+{
+public:
+    // Throws std::domain_error for 0.
+    explicit limb_divisor(std::uint64_t divisor_) :
+        original(divisor_),
+        shift(divisor_ ? static_cast<unsigned>(std::countl_zero(divisor_)) : 0),
+        normalized(divisor_ << shift),
+        reciprocal(0)
+    {
+        if (!divisor_)
+            throw std::domain_error("wide_uint division by zero");
+        // floor((2^128 - 1) / normalized) - 2^64
+        std::uint64_t remainder;
+        reciprocal = detail::div_limb(~normalized, ~std::uint64_t(0), normalized, remainder);
+    }
+
+    std::uint64_t divisor() const
+    {
+        return original;
+    }
+
+    // Divides value in place and returns the remainder.
+    template<unsigned Bits>
+    std::uint64_t divide(wide_uint<Bits>& value) const
+    {
+        std::uint64_t* const limbs = value.data();
+        std::size_t top = wide_uint<Bits>::limb_count;
+        while (top > 0 && !limbs[top - 1])
+            --top;
+
+        // divides value << shift by normalized, which leaves the quotient alone and shifts the remainder
+        std::uint64_t r = shift && top ? limbs[top - 1] >> (64 - shift) : 0;
+        for (std::size_t i = top; i-- > 0;)
+        {
+            std::uint64_t const low = (limbs[i] << shift) | (shift && i ? limbs[i - 1] >> (64 - shift) : 0);
+            limbs[i] = divide_limb(r, low, r);
+        }
+        return r >> shift;
+    }
+
+private:
+    std::uint64_t original;
+    unsigned shift;
+    std::uint64_t normalized;   // divisor << shift, with its top bit set
+    std::uint64_t reciprocal;
+
+    // high:low / normalized, high < normalized
+    std::uint64_t divide_limb(std::uint64_t high, std::uint64_t low, std::uint64_t& remainder) const
+    {
+        // (q1:q0) = reciprocal * high + (high:low), then q1 + 1 is the quotient or one over or under
+        std::uint64_t q1;
+        std::uint64_t const q0 = detail::mul_add(reciprocal, high, low, 0, q1);
+        q1 += high + 1;
+        std::uint64_t r = low - q1 * normalized;
+        if (r > q0)
+        {
+            --q1;
+            r += normalized;
+        }
+        if (r >= normalized)
+        {
+            ++q1;
+            r -= normalized;
+        }
+        remainder = r;
+        return q1;
+    }
+};
+
+// As std::to_chars, in base 2 to 36.
+template<unsigned Bits>
+std::to_chars_result to_chars(char* first, char* last, wide_uint<Bits> value, int base = 10)
+{
+    // the largest power of base in a limb, and its digits
+    std::uint64_t power = static_cast<std::uint64_t>(base);
+    int digits = 1;
+    while (power <= std::numeric_limits<std::uint64_t>::max() / static_cast<std::uint64_t>(base))
+    {
+        power *= static_cast<std::uint64_t>(base);
+        ++digits;
+    }
+    limb_divisor const chunk(power);
+
+    // a chunk is at least 32 bits
+    std::uint64_t chunks[Bits / 32 + 1];
+    std::size_t count = 0;
+    do
+        chunks[count++] = chunk.divide(value);
+    while (value);
+
+    std::to_chars_result result = std::to_chars(first, last, chunks[--count], base);
+    while (result.ec == std::errc() && count > 0)
+    {
+        if (last - result.ptr < digits)
+            return std::to_chars_result{ last, std::errc::value_too_large };
+
+        char padded[64];
+        char* const end = std::to_chars(padded, padded + sizeof(padded), chunks[--count], base).ptr;
+        std::ptrdiff_t const length = end - padded;
+        std::fill(result.ptr, result.ptr + (digits - length), '0');
+        std::memcpy(result.ptr + (digits - length), padded, static_cast<std::size_t>(length));
+        result.ptr += digits;
+    }
+    return result;
+}
+
+template<unsigned Bits>
+std::string to_string(wide_uint<Bits> const& value)
+{
+    char text[Bits / 3 + 2];
+    return std::string(text, to_chars(text, text + sizeof(text), value).ptr);
+}
+
+// Decimal, or hex or octal as os is set.
+template<unsigned Bits>
+std::ostream& operator<<(std::ostream& os, wide_uint<Bits> const& value)
+{
+    std::ios_base::fmtflags const base = os.flags() & std::ios_base::basefield;
+    char text[Bits / 3 + 2];
+    char* const end = to_chars(text, text + sizeof(text), value,
+        base == std::ios_base::hex ? 16 : base == std::ios_base::oct ? 8 : 10).ptr;
+    return os << std::string(text, end);
+}
+
+namespace std {
+
+template<unsigned Bits>
+class numeric_limits<wide_uint<Bits>>
+{
+public:
+    static constexpr bool is_specialized = true;
+    static constexpr bool is_signed = false;
+    static constexpr bool is_integer = true;
+    static constexpr bool is_exact = true;
+    static constexpr bool is_bounded = true;
+    static constexpr bool is_modulo = true;
+    static constexpr int radix = 2;
+    static constexpr int digits = static_cast<int>(Bits);
+    static constexpr int digits10 = static_cast<int>(Bits * 30103 / 100000);
+
+    static wide_uint<Bits> min()
+    {
+        return wide_uint<Bits>();
+    }
+
+    static wide_uint<Bits> lowest()
+    {
+        return wide_uint<Bits>();
+    }
+
+    static wide_uint<Bits> max()
+    {
+        return ~wide_uint<Bits>();
+    }
+};
+
+}  // namespace std